@@ -0,0 +1,223 @@
+#include "AllocationCheck.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+#include <crtdbg.h>
+#include <mfapi.h>
+
+#include "Camera.h"
+#include "SyntheticSource.h"
+#include "Debug.h"
+
+namespace {
+    std::atomic<uint64_t> heapAllocations = 0;
+
+    const uint32_t CHECK_WIDTH = 1280;
+    const uint32_t CHECK_HEIGHT = 720;
+    const uint32_t CHECK_FPS = 30;
+    const std::chrono::milliseconds FRAME_TIMEOUT(1000);
+
+    // Stand-in for analysis stages that keep per-frame results.
+    const size_t HISTOGRAM_BINS = 256;
+
+    IMFMediaType* createNV12Type(uint32_t width, uint32_t height)
+    {
+        IMFMediaType* type = nullptr;
+        if (HRESULT hr = MFCreateMediaType(&type); FAILED(hr)) {
+            return nullptr;
+        }
+
+        HRESULT hr = type->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+        if (SUCCEEDED(hr)) {
+            hr = type->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12);
+        }
+        if (SUCCEEDED(hr)) {
+            hr = MFSetAttributeSize(type, MF_MT_FRAME_SIZE, width, height);
+        }
+        if (SUCCEEDED(hr)) {
+            hr = MFSetAttributeRatio(type, MF_MT_FRAME_RATE, CHECK_FPS, 1);
+        }
+
+        if (FAILED(hr)) {
+            type->Release();
+            return nullptr;
+        }
+
+        return type;
+    }
+
+    bool analyzeFrame(const Frame& frame)
+    {
+        uint32_t* histogram = frame.arena().allocate<uint32_t>(HISTOGRAM_BINS);
+        if (!histogram) {
+            return false;
+        }
+
+        IMFMediaBuffer* buffer = nullptr;
+        if (HRESULT hr = frame.sample()->GetBufferByIndex(0, &buffer); FAILED(hr)) {
+            return false;
+        }
+
+        uint8_t* data = nullptr;
+        if (SUCCEEDED(buffer->Lock(&data, nullptr, nullptr))) {
+            for (uint32_t i = 0; i < frame.info().width; i++) {
+                histogram[data[i]]++;
+            }
+            (void)buffer->Unlock();
+        }
+
+        buffer->Release();
+        return true;
+    }
+
+#if defined(MFCAMERA_ALLOCATION_CHECK) && defined(_DEBUG)
+    int __cdecl crtAllocHook(int allocType, void*, size_t, int, long, const unsigned char*, int)
+    {
+        if (allocType == _HOOK_ALLOC || allocType == _HOOK_REALLOC) {
+            heapAllocations.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        return TRUE;
+    }
+#endif
+}
+
+#ifdef MFCAMERA_ALLOCATION_CHECK
+
+// In debug builds the CRT hook already sees these.
+#ifndef _DEBUG
+void* operator new(size_t size)
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    std::free(memory);
+}
+#endif
+
+#endif
+
+uint64_t AllocationCheck::allocations()
+{
+    return heapAllocations.load(std::memory_order_relaxed);
+}
+
+bool AllocationCheck::isEnabled()
+{
+#ifdef MFCAMERA_ALLOCATION_CHECK
+    return true;
+#else
+    return false;
+#endif
+}
+
+//-------------------------------------------------------------------
+// Run
+//
+// Synthetic source -> frame stream -> Camera::processSample (frame
+// pool, subscribers, headless DrawDevice) -> consumer stream ->
+// per-frame arena. Everything after warm-up must not allocate.
+//-------------------------------------------------------------------
+
+bool AllocationCheck::run(uint32_t frames, uint32_t warmupFrames)
+{
+    if (!isEnabled()) {
+        Error("Allocation check needs a build with MFCAMERA_ALLOCATION_CHECK\n");
+        return false;
+    }
+
+#if defined(MFCAMERA_ALLOCATION_CHECK) && defined(_DEBUG)
+    _CrtSetAllocHook(crtAllocHook);
+#endif
+
+    IMFMediaType* type = createNV12Type(CHECK_WIDTH, CHECK_HEIGHT);
+    if (!type) {
+        return false;
+    }
+
+    Camera camera(nullptr, nullptr, CHECK_WIDTH, CHECK_HEIGHT, CHECK_FPS);
+    const bool formatSet = camera.setSampleFormat(type);
+    type->Release();
+
+    if (!formatSet) {
+        return false;
+    }
+
+    SyntheticSource source(MFVideoFormat_NV12, CHECK_WIDTH, CHECK_HEIGHT, CHECK_FPS, false);
+    std::shared_ptr<FrameStream> input = source.subscribe(4);
+    std::shared_ptr<FrameStream> output = camera.subscribe(4);
+
+    if (!source.start()) {
+        return false;
+    }
+
+    uint64_t baseline = 0;
+    bool ok = true;
+
+    for (uint32_t i = 0; i < warmupFrames + frames && ok; i++) {
+        if (i == warmupFrames) {
+            baseline = allocations();
+        }
+
+        std::optional<Frame> frame = input->pop(FRAME_TIMEOUT);
+        if (!frame) {
+            Error("Synthetic source stalled at frame %u\n", i);
+            ok = false;
+            break;
+        }
+
+        ok = camera.processSample(frame->sample(), frame->info().streamFlags, frame->info().timestamp);
+        frame.reset();
+
+        if (!ok) {
+            Error("Camera rejected frame %u\n", i);
+            break;
+        }
+
+        // A frame that never reaches the sink did not go through the
+        // path being checked.
+        std::optional<Frame> converted = output->pop(FRAME_TIMEOUT);
+        if (!converted) {
+            Error("Camera published nothing for frame %u\n", i);
+            ok = false;
+            break;
+        }
+
+        ok = analyzeFrame(*converted);
+    }
+
+    const uint64_t steadyStateAllocations = allocations() - baseline;
+
+    source.stop();
+
+#if defined(MFCAMERA_ALLOCATION_CHECK) && defined(_DEBUG)
+    _CrtSetAllocHook(nullptr);
+#endif
+
+    if (!ok) {
+        Error("Allocation check did not complete\n");
+        return false;
+    }
+
+    const FrameArena::Stats arena = camera.arenaStats();
+    Info("Allocation check: %u frames, %llu heap allocations after warm-up, arena %llu allocations, %llu overflows\n",
+        frames, steadyStateAllocations, arena.allocations, arena.overflows);
+
+    return steadyStateAllocations == 0 && arena.overflows == 0;
+}
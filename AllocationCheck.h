@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+//-------------------------------------------------------------------
+// Allocation check
+//
+// Runs the synthetic source through the capture path (Camera, frame
+// streams, headless DrawDevice, VideoBufferLock, FormatConvertor)
+// and fails if anything allocates from the CRT heap once the warm-up
+// frames are done.
+//
+// Allocation tracking replaces the global operator new and is only
+// compiled in with MFCAMERA_ALLOCATION_CHECK defined. Debug builds
+// additionally catch plain malloc through the CRT allocation hook;
+// release builds cannot, since the CRT offers no way to replace
+// malloc, so run the check in a debug build to cover it. Allocations
+// made inside Media Foundation with CoTaskMemAlloc or HeapAlloc are
+// not visible in either.
+//-------------------------------------------------------------------
+
+namespace AllocationCheck {
+    // Number of heap allocations seen since the process started.
+    uint64_t allocations();
+
+    bool isEnabled();
+
+    bool run(uint32_t frames, uint32_t warmupFrames);
+}
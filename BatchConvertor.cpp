@@ -0,0 +1,47 @@
+#include "BatchConvertor.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "WorkerPool.h"
+
+namespace {
+    // Chunks per thread. More chunks balance better at the end of the
+    // batch, fewer chunks mean less contention on the work counter.
+    const size_t CHUNKS_PER_THREAD = 4;
+}
+
+BatchConvertor::BatchConvertor(WorkerPool& pool) : mPool(pool)
+{
+}
+
+size_t BatchConvertor::convert(const FormatConvertor& converter, std::vector<ConversionJob>& jobs) const
+{
+    if (jobs.empty()) {
+        return 0;
+    }
+
+    const size_t chunks = std::min(jobs.size(), size_t(mPool.concurrency()) * CHUNKS_PER_THREAD);
+    const size_t chunkSize = (jobs.size() + chunks - 1) / chunks;
+
+    std::atomic<size_t> converted = 0;
+
+    mPool.run(chunks, [&](size_t chunk) {
+        const size_t begin = chunk * chunkSize;
+        const size_t end = std::min(begin + chunkSize, jobs.size());
+
+        size_t count = 0;
+        for (size_t i = begin; i < end; i++) {
+            ConversionJob& job = jobs[i];
+            job.converted = converter.convert(job.destination, job.destStride, job.source);
+
+            if (job.converted) {
+                ++count;
+            }
+        }
+
+        converted.fetch_add(count, std::memory_order_relaxed);
+    });
+
+    return converted.load();
+}
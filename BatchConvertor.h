@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "FormatConvertor.h"
+
+class WorkerPool;
+
+struct ConversionJob
+{
+    uint8_t* destination = nullptr;
+    uint32_t destStride = 0;
+    FramePlanes source;
+    bool converted = false;
+};
+
+//-------------------------------------------------------------------
+// BatchConvertor
+//
+// Converts many frames of the same format at once. Every worker takes
+// whole frames, in chunks large enough to amortize dispatch but small
+// enough to keep all cores busy until the end of the batch. Used to
+// reprocess recordings (MFCaptureCli --reprocess) and measured with
+// MFCaptureCli --bench-batch.
+//-------------------------------------------------------------------
+
+class BatchConvertor
+{
+public:
+    explicit BatchConvertor(WorkerPool& pool);
+
+    // Returns the number of frames converted. ConversionJob::converted
+    // reports the result of each frame.
+    size_t convert(const FormatConvertor& converter, std::vector<ConversionJob>& jobs) const;
+
+private:
+    WorkerPool& mPool;
+};
@@ -48,10 +48,10 @@ public:
     // The caller must provide the default stride as an input parameter, in case
     // the buffer does not expose IMF2DBuffer. You can calculate the default stride
     // from the media type.
-    // uint32_t stride - Minimum stride (with no padding).
+    // long stride - Minimum stride (with no padding), negative if bottom-up.
     //-------------------------------------------------------------------
 
-    uint8_t *LockBuffer(uint32_t stride, uint32_t height)
+    uint8_t *LockBuffer(long stride, uint32_t height)
     {
         mLocked = false;
         mActualStride = 0;
@@ -77,7 +77,7 @@ public:
         if (stride < 0) {
             // Bottom-up orientation. Return a pointer to the start of the
             // last row *in memory* which is the top row of the image.
-            return data + abs(long(stride)) * (height - 1);
+            return data + ptrdiff_t(-stride) * (height - 1);
         }
 
         // Top-down orientation. Return a pointer to the start of the
@@ -90,6 +90,17 @@ public:
         return mActualStride;
     }
 
+    // Bytes of valid data in the buffer, 0 if unknown.
+    size_t getLength() const
+    {
+        DWORD length = 0;
+        if (HRESULT hr = mBuffer->GetCurrentLength(&length); FAILED(hr)) {
+            return 0;
+        }
+
+        return length;
+    }
+
     void unlock()
     {
         if (!mLocked) {
@@ -13,13 +13,20 @@
 
 #include "Camera.h"
 
+#include <algorithm>
+
 #include <shlwapi.h>
 #include <mferror.h>
 
 #include "SafeRelease.h"
 #include "Debug.h"
+#include "Metrics.h"
 
 namespace {
+    // Frames that consumers may hold on to at the same time.
+    const size_t FRAME_POOL_SIZE = 8;
+    const size_t FRAME_ARENA_SIZE = 512 * 1024;
+
     class MFObjectGuard {
     public:
         MFObjectGuard(IUnknown *object) :mObject(object){}
@@ -31,28 +38,178 @@ namespace {
     private:
         IUnknown* mObject = nullptr;
     };
-}
+
+    // Device clock and exposure, for drivers that attach them.
+    void readCaptureMetadata(IMFSample* sample, FrameMetadata& metadata)
+    {
+        UINT64 value = 0;
+        if (SUCCEEDED(sample->GetUINT64(MFSampleExtension_DeviceTimestamp, &value))) {
+            metadata.deviceTime = int64_t(value);
+        }
+
+        IMFAttributes* capture = nullptr;
+        if (SUCCEEDED(sample->GetUnknown(MFSampleExtension_CaptureMetadata, IID_PPV_ARGS(&capture)))) {
+            if (SUCCEEDED(capture->GetUINT64(MF_CAPTURE_METADATA_EXPOSURE_TIME, &value))) {
+                metadata.exposure = int64_t(value);
+            }
+
+            capture->Release();
+        }
+    }
+
+    enum class DeviceState
+    {
+        Closed = 0, Streaming = 1, Lost = 2
+    };
+
+    struct CameraMetrics
+    {
+        MetricCounter& frames = Metrics::instance().counter("mfcamera_frames_total",
+            "Frames delivered by the capture device.");
+        MetricCounter& poolDrops = Metrics::instance().counter("mfcamera_frame_pool_drops_total",
+            "Frames dropped because every frame pool slot was in use.");
+        MetricGauge& fps = Metrics::instance().gauge("mfcamera_capture_fps",
+            "Capture frame rate over the last second.");
+        MetricGauge& queueDepth = Metrics::instance().gauge("mfcamera_queue_depth",
+            "Deepest subscriber queue after the last frame.");
+        MetricGauge& deviceState = Metrics::instance().gauge("mfcamera_device_state",
+            "Capture device state: 0 closed, 1 streaming, 2 lost.");
+    };
+
+    CameraMetrics& cameraMetrics()
+    {
+        static CameraMetrics metrics;
+        return metrics;
+    }
+
+
+//-------------------------------------------------------------------
+// ReaderCallback
+//
+// Forwards the completions of one source reader to the camera, tagged
+// with the reader's generation. Readers complete asynchronously, so
+// the callback can outlive its place in the camera; detach() cuts the
+// link once the camera no longer wants to hear from it. It waits for a
+// completion in flight on another thread, and may be called from the
+// callback's own completion.
+//-------------------------------------------------------------------
+
+class Camera::ReaderCallback : public IMFSourceReaderCallback
+{
+public:
+    ReaderCallback(Camera* camera, uint64_t generation) : mCamera(camera), mGeneration(generation) {}
+
+    void detach()
+    {
+        std::lock_guard lock(mMutex);
+        mCamera = nullptr;
+    }
+
+    // IUnknown methods
+    HRESULT QueryInterface(REFIID riid, void** ppv) override
+    {
+        static const QITAB qit[] =
+        {
+            QITABENT(ReaderCallback, IMFSourceReaderCallback),
+            { 0 },
+        };
+        return QISearch(this, qit, riid, ppv);
+    }
+
+    ULONG AddRef() override
+    {
+        return InterlockedIncrement(&mRefCount);
+    }
+
+    ULONG Release() override
+    {
+        const ULONG count = InterlockedDecrement(&mRefCount);
+        if (count == 0) {
+            delete this;
+        }
+        return count;
+    }
+
+    // IMFSourceReaderCallback methods
+    HRESULT OnReadSample(HRESULT hrStatus, DWORD /* dwStreamIndex */, DWORD dwStreamFlags,
+        LONGLONG llTimestamp, IMFSample* pSample) override
+    {
+        std::lock_guard lock(mMutex);
+
+        if (!mCamera) {
+            return S_OK;
+        }
+
+        return mCamera->onReadSample(mGeneration, hrStatus, dwStreamFlags, llTimestamp, pSample);
+    }
+
+    HRESULT OnEvent(DWORD, IMFMediaEvent*) override
+    {
+        return S_OK;
+    }
+
+    HRESULT OnFlush(DWORD) override
+    {
+        return S_OK;
+    }
+
+private:
+    ~ReaderCallback() = default;
+
+    Camera* mCamera = nullptr;
+    const uint64_t mGeneration = 0;
+    long mRefCount = 1;
+    std::recursive_mutex mMutex;
+};
 
 
 Camera::Camera(HWND hVideo, HWND hEvent, uint32_t width, uint32_t height, uint32_t fps) :
-    mVideoWindow(hVideo), mAppWindow(hEvent), mWidth(width), mHeight(height), mFps(fps)
+    mVideoWindow(hVideo), mAppWindow(hEvent), mWidth(width), mHeight(height), mFps(fps),
+    mFramePool(std::make_shared<FramePool>(FRAME_POOL_SIZE, FRAME_ARENA_SIZE)),
+    mConverted(FRAME_POOL_SIZE)
 {
 }
 
+Camera::Camera(HWND hVideo, HWND hEvent, const SessionConfig& config) :
+    mVideoWindow(hVideo), mAppWindow(hEvent), mDeviceIdentity(config.device),
+    mWidth(config.width), mHeight(config.height), mFps(config.fps),
+    mResolution(config.resolution), mFormats(config.formats),
+    mFramePool(std::make_shared<FramePool>(config.pipelineDepth, FRAME_ARENA_SIZE)),
+    mConverted(config.pipelineDepth)
+{
+    mDrawDevice.setOrientation(config.orientation);
+
+    mDrawDevice.setSquarePixels(config.squarePixels);
+    mDrawDevice.setDenoise(config.denoiseStrength, config.denoiseThreshold);
+
+    if (config.previewScaler != PreviewScaler::Linear || config.squarePixels || config.denoiseStrength > 0) {
+        mWorkerPool = std::make_unique<WorkerPool>(config.workerThreads, config.affinityMask);
+        mDrawDevice.setScaler(config.previewScaler, mWorkerPool.get());
+    }
+
+    // Only formats the renderer can convert are worth asking for.
+    mFormats.erase(std::remove_if(mFormats.begin(), mFormats.end(), [this](const GUID& format) {
+        return !mDrawDevice.isFormatSupported(format);
+    }), mFormats.end());
+}
+
 Camera::~Camera()
 {
+    joinSwitchThread();
     closeDevice();
+    waitForReleases();
+    closeStreams();
 
     mDrawDevice.DestroyDevice();
 }
 
 bool Camera::init()
 {
-    if (!mDrawDevice.createDevice(mVideoWindow)) {
+    if (!createRenderer()) {
         return false;
     }
 
-    IMFActivate* firstDevice = findFirstDevice();
+    IMFActivate* firstDevice = mDeviceIdentity.empty() ? findFirstDevice() : findDevice(mDeviceIdentity);
     if (!firstDevice) {
         return false;
     }
@@ -63,64 +220,260 @@ bool Camera::init()
     return ok;
 }
 
+bool Camera::createRenderer()
+{
+    if (!mVideoWindow) {
+        return mDrawDevice.isHeadless() || mDrawDevice.createHeadless();
+    }
+
+    return mDrawDevice.createDevice(mVideoWindow);
+}
+
+bool Camera::setSampleFormat(IMFMediaType* type)
+{
+    if (!createRenderer()) {
+        return false;
+    }
+
+    std::lock_guard lock(mMutex);
+    return applyVideoType(type);
+}
+
+bool Camera::processSample(IMFSample* sample, DWORD streamFlags, LONGLONG timestamp)
+{
+    Frame frame = wrapSample(sample, streamFlags, timestamp);
+    Frame converted;
+
+    bool drawn = false;
+    {
+        std::lock_guard lock(mMutex);
+        drawn = drawSample(sample, frame, converted);
+    }
+
+    publishFrame(frame, converted);
+    return drawn;
+}
+
 void Camera::closeDevice()
 {
+    ReaderState active;
+    ReaderState pending;
+
     {
         std::lock_guard lock(mMutex);
 
-        if (mReader) {
-            mReader->Release();
-            mReader = nullptr;
-        }
+        active = std::exchange(mActive, ReaderState());
+        pending = std::exchange(mPending, ReaderState());
+        SafeRelease(&mPendingType);
     }
 
+    // Outside the lock: a callback may be waiting for it.
+    releaseReader(active);
+    releaseReader(pending);
 
-    CoTaskMemFree(mSymbolicLink);
-    mSymbolicLink = nullptr;
-    mSymbolicLinkId = 0;
+    cameraMetrics().deviceState.set(int64_t(DeviceState::Closed));
 }
 
-ULONG Camera::AddRef()
+void Camera::releaseReader(ReaderState& state)
 {
-    return 1;
+    if (state.callback) {
+        state.callback->detach();
+    }
+
+    SafeRelease(&state.reader);
+    SafeRelease(&state.callback);
+
+    CoTaskMemFree(state.symbolicLink);
+    state.symbolicLink = nullptr;
 }
 
-ULONG Camera::Release()
+//-------------------------------------------------------------------
+// ReleaseReaderAsync
+//
+// Releases a replaced reader from a completion, possibly one of that
+// reader. Its callback is detached right away, so nothing reaches the
+// camera once this returns; only the release of the reader, which
+// must not happen inside its own callback, goes to the thread pool.
+// The camera waits for those releases before it goes away.
+//-------------------------------------------------------------------
+
+struct Camera::DeferredRelease
 {
-    return 0;
-}
+    Camera* camera = nullptr;
+    ReaderState state;
+};
 
-HRESULT Camera::QueryInterface(REFIID riid, void** ppv)
+void Camera::releaseReaderAsync(ReaderState& state)
 {
-    static const QITAB qit[] = 
+    if (!state.reader && !state.callback) {
+        return;
+    }
+
+    if (state.callback) {
+        state.callback->detach();
+    }
+
+    auto* released = new DeferredRelease{ this, std::exchange(state, ReaderState()) };
+
     {
-        QITABENT(Camera, IMFSourceReaderCallback),
-        { 0 },
+        std::lock_guard lock(mReleaseMutex);
+        mPendingReleases++;
+    }
+
+    auto release = [](PTP_CALLBACK_INSTANCE, void* context) {
+        auto* released = static_cast<DeferredRelease*>(context);
+        Camera* camera = released->camera;
+
+        releaseReader(released->state);
+        delete released;
+
+        std::lock_guard lock(camera->mReleaseMutex);
+        if (--camera->mPendingReleases == 0) {
+            camera->mReleasesDone.notify_all();
+        }
     };
-    return QISearch(this, qit, riid, ppv);
+
+    if (!TrySubmitThreadpoolCallback(release, released, nullptr)) {
+        // Kept until the camera is destroyed rather than released
+        // inside its own callback.
+        Warn("Cannot release the replaced capture device now\n");
+
+        std::lock_guard lock(mReleaseMutex);
+        mRetiredReaders.push_back(released->state);
+        mPendingReleases--;
+        delete released;
+    }
 }
 
-// Called when the IMFMediaSource::ReadSample method completes.
-HRESULT Camera::OnReadSample(
-    HRESULT hrStatus,
-    DWORD /* dwStreamIndex */,
-    DWORD /* dwStreamFlags */,
-    LONGLONG /* llTimestamp */,
-    IMFSample *pSample      // Can be NULL
-    )
+void Camera::waitForReleases()
 {
+    std::vector<ReaderState> retired;
+
+    {
+        std::unique_lock lock(mReleaseMutex);
+        mReleasesDone.wait(lock, [this] {
+            return mPendingReleases == 0;
+        });
+
+        retired.swap(mRetiredReaders);
+    }
+
+    for (ReaderState& state : retired) {
+        releaseReader(state);
+    }
+}
+
+void Camera::joinSwitchThread()
+{
+    if (mSwitchThread.joinable()) {
+        mSwitchThread.join();
+    }
+}
+
+//-------------------------------------------------------------------
+// OnReadSample
+//
+// Called when IMFSourceReader::ReadSample of the reader with the given
+// generation completes. The first sample of a pending device makes it
+// the active one; samples of replaced readers are ignored and those
+// readers are not asked for more.
+//-------------------------------------------------------------------
+
+HRESULT Camera::onReadSample(uint64_t generation, HRESULT hrStatus, DWORD streamFlags,
+    LONGLONG timestamp, IMFSample* sample)
+{
+    ReaderState previous;
+    bool switched = false;
+    bool active = false;
+
+    {
+        std::lock_guard lock(mMutex);
+
+        if (generation == mPending.generation && mPending.reader) {
+            if (FAILED(hrStatus) || !sample) {
+                // Not live yet; keep the current device.
+                if (FAILED(hrStatus)) {
+                    previous = std::exchange(mPending, ReaderState());
+                    SafeRelease(&mPendingType);
+                }
+                else {
+                    (void)mPending.reader->ReadSample((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0,
+                        nullptr, nullptr, nullptr, nullptr);
+                }
+            }
+            else {
+                switched = commitPendingDevice(previous);
+            }
+        }
+
+        active = generation == mActive.generation;
+    }
+
+    // The replaced reader may be the one calling us.
+    releaseReaderAsync(previous);
+
+    if (switched) {
+        Info("Switched capture device\n");
+    }
+
     if (FAILED(hrStatus)) {
+        if (active) {
+            Error("Capture device stopped (hr=0x%X)\n", hrStatus);
+            cameraMetrics().deviceState.set(int64_t(DeviceState::Lost));
+
+            std::function<void(const std::wstring&)> handler;
+            {
+                std::lock_guard lock(mMutex);
+                handler = mDeviceLostHandler;
+            }
+
+            if (handler) {
+                handler(symbolicLink());
+            }
+        }
         return hrStatus;
     }
 
-    std::lock_guard lock(mMutex);
-    if (pSample) {
-        if (!drawSample(pSample)) {
-            return HRESULT(1);
+    if (!active) {
+        return S_OK;
+    }
+
+    Frame frame;
+    Frame converted;
+    if (sample) {
+        frame = wrapSample(sample, streamFlags, timestamp);
+    }
+
+    bool current = false;
+    bool drawn = true;
+    {
+        std::lock_guard lock(mMutex);
+
+        // The device may have been switched or closed meanwhile.
+        current = generation == mActive.generation && mActive.reader;
+        if (current && sample) {
+            drawn = drawSample(sample, frame, converted);
         }
     }
 
-    return mReader->ReadSample((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0,
+    // Published after drawing, so that the stats of the stages go out
+    // with the frame, and before the next sample is requested.
+    publishFrame(frame, converted);
+
+    if (!current) {
+        return S_OK;
+    }
+
+    if (!drawn) {
+        return HRESULT(1);
+    }
+
+    std::lock_guard lock(mMutex);
+    if (generation != mActive.generation || !mActive.reader) {
+        return S_OK;
+    }
+
+    return mActive.reader->ReadSample((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0,
         nullptr,   // actual
         nullptr,   // flags
         nullptr,   // timestamp
@@ -128,6 +481,29 @@ HRESULT Camera::OnReadSample(
     );
 }
 
+//-------------------------------------------------------------------
+// CommitPendingDevice
+//
+// Makes the pending reader the active one. Called with the lock held;
+// the replaced reader is returned to be released outside the lock.
+//-------------------------------------------------------------------
+
+bool Camera::commitPendingDevice(ReaderState& previous)
+{
+    if (mPendingType) {
+        if (!applyVideoType(mPendingType)) {
+            previous = std::exchange(mPending, ReaderState());
+            SafeRelease(&mPendingType);
+            return false;
+        }
+
+        SafeRelease(&mPendingType);
+    }
+
+    previous = std::exchange(mActive, std::exchange(mPending, ReaderState()));
+    return true;
+}
+
 IMFMediaSource* Camera::createSource(IMFActivate* activate) const
 {
     IMFMediaSource* source = nullptr;
@@ -143,7 +519,7 @@ IMFMediaSource* Camera::createSource(IMFActivate* activate) const
     return nullptr;
 }
 
-IMFAttributes* Camera::createAttributes()
+IMFAttributes* Camera::createAttributes(IMFSourceReaderCallback* callback)
 {
     IMFAttributes* attributes = nullptr;
 
@@ -163,7 +539,7 @@ IMFAttributes* Camera::createAttributes()
         return nullptr;
     }
 
-    if (HRESULT hr = attributes->SetUnknown(MF_SOURCE_READER_ASYNC_CALLBACK, this); FAILED(hr)) {
+    if (HRESULT hr = attributes->SetUnknown(MF_SOURCE_READER_ASYNC_CALLBACK, callback); FAILED(hr)) {
         attributes->Release();
         return nullptr;
     }
@@ -171,38 +547,172 @@ IMFAttributes* Camera::createAttributes()
     return attributes;
 }
 
+// Called with the lock held.
 bool Camera::setupOutputFormat(IMFSourceReader* reader)
+{
+    IMFMediaType* type = negotiateFormat(reader, formatRequest());
+    if (!type) {
+        return false;
+    }
+
+    MFObjectGuard typeGuard(type);
+
+    return applyVideoType(type);
+}
+
+//-------------------------------------------------------------------
+// ApplyVideoType
+//
+// Sets up the renderer for a negotiated type and remembers its
+// geometry for frame metadata. Called with the lock held.
+//-------------------------------------------------------------------
+
+bool Camera::applyVideoType(IMFMediaType* type)
+{
+    if (!mDrawDevice.setVideoType(type)) {
+        return false;
+    }
+
+    const FramePlanKey& key = mDrawDevice.plan().key;
+    mSubtype = key.subtype;
+    mFrameWidth = key.width;
+    mFrameHeight = key.height;
+
+    return true;
+}
+
+bool Camera::isCurrentFormat(IMFMediaType* type) const
+{
+    GUID subtype = GUID_NULL;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    (void)type->GetGUID(MF_MT_SUBTYPE, &subtype);
+    (void)MFGetAttributeSize(type, MF_MT_FRAME_SIZE, &width, &height);
+
+    return subtype == mSubtype && width == mFrameWidth && height == mFrameHeight;
+}
+
+// Called with the lock held.
+Camera::FormatRequest Camera::formatRequest() const
+{
+    FormatRequest request;
+    request.subtype = mSubtype;
+    request.width = mWidth;
+    request.height = mHeight;
+    request.fps = mFps;
+    request.resolution = mResolution;
+
+    return request;
+}
+
+//-------------------------------------------------------------------
+// NegotiateFormat
+//
+// Picks and sets the output type of a reader. When reopening a device,
+// the format the renderer was set up for is preferred.
+//-------------------------------------------------------------------
+
+IMFMediaType* Camera::negotiateFormat(IMFSourceReader* reader, const FormatRequest& request) const
+{
+    IMFMediaType* type = request.subtype == GUID_NULL ? nullptr : selectOutputFormat(reader, request, request.subtype);
+    if (!type) {
+        type = selectPreferredFormat(reader, request);
+    }
+
+    return type;
+}
+
+//-------------------------------------------------------------------
+// SelectOutputFormat
+//
+// Finds a native type with the required resolution and sets it on the
+// reader. requiredSubtype restricts the output subtype, GUID_NULL
+// accepts any format the renderer can convert.
+//-------------------------------------------------------------------
+
+IMFMediaType* Camera::selectOutputFormat(IMFSourceReader* reader, const FormatRequest& request,
+    REFGUID requiredSubtype) const
 {
     // Try to find a suitable output type.
     for (uint32_t i = 0; ; i++) {
         IMFMediaType* nativeType = nullptr;
         HRESULT hr = reader->GetNativeMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, i, &nativeType);
 
-        MFObjectGuard nativeTypeGuard(nativeType);
-
         if (FAILED(hr)) {
+            SafeRelease(&nativeType);
             break;
         }
 
-        if (!checkRequiredResolution(nativeType)) {
-            continue;
+        if (checkRequiredResolution(nativeType, request) && adjustMediaTypeToDevice(reader, nativeType, requiredSubtype)) {
+            return nativeType;
+        }
+
+        nativeType->Release();
+    }
+
+    if (request.resolution != ResolutionPolicy::Closest) {
+        return nullptr;
+    }
+
+    // No exact match: take the nearest mode the renderer converts directly.
+    uint64_t bestScore = UINT64_MAX;
+    IMFMediaType* bestType = nullptr;
+
+    for (uint32_t i = 0; ; i++) {
+        IMFMediaType* nativeType = nullptr;
+        HRESULT hr = reader->GetNativeMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, i, &nativeType);
+
+        if (FAILED(hr)) {
+            SafeRelease(&nativeType);
+            break;
         }
 
-        if (!adjustMediaTypeToDevice(nativeType)) {
+        GUID subtype = GUID_NULL;
+        (void)nativeType->GetGUID(MF_MT_SUBTYPE, &subtype);
+
+        const bool acceptable = mDrawDevice.isFormatSupported(subtype) &&
+            (requiredSubtype == GUID_NULL || subtype == requiredSubtype);
+
+        const uint64_t score = acceptable ? resolutionDistance(nativeType, request) : UINT64_MAX;
+        if (score < bestScore) {
+            bestScore = score;
+            SafeRelease(&bestType);
+            bestType = nativeType;
             continue;
         }
 
-        if (mDrawDevice.setVideoType(nativeType)) {
-            return true;
+        nativeType->Release();
+    }
+
+    if (bestType && !adjustMediaTypeToDevice(reader, bestType, requiredSubtype)) {
+        SafeRelease(&bestType);
+    }
+
+    return bestType;
+}
+
+//-------------------------------------------------------------------
+// SelectPreferredFormat
+//
+// Tries the configured formats in order of preference, then anything
+// the renderer supports.
+//-------------------------------------------------------------------
+
+IMFMediaType* Camera::selectPreferredFormat(IMFSourceReader* reader, const FormatRequest& request) const
+{
+    for (const GUID& format : mFormats) {
+        if (IMFMediaType* type = selectOutputFormat(reader, request, format)) {
+            return type;
         }
     }
 
-    return false;
+    return selectOutputFormat(reader, request, GUID_NULL);
 }
 
-IMFSourceReader* Camera::createReader(IMFMediaSource* source)
+IMFSourceReader* Camera::createReader(IMFMediaSource* source, IMFSourceReaderCallback* callback)
 {
-    IMFAttributes* attributes = createAttributes();
+    IMFAttributes* attributes = createAttributes(callback);
     if (!attributes) {
         return nullptr;
     }
@@ -214,7 +724,31 @@ IMFSourceReader* Camera::createReader(IMFMediaSource* source)
     return SUCCEEDED(hr) ? reader : nullptr;
 }
 
-bool Camera::checkRequiredResolution(IMFMediaType* nativeType) const
+uint64_t Camera::resolutionDistance(IMFMediaType* nativeType, const FormatRequest& request)
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t numerator = 0;
+    uint32_t denominator = 0;
+
+    if (FAILED(MFGetAttributeSize(nativeType, MF_MT_FRAME_SIZE, &width, &height)) ||
+        FAILED(MFGetAttributeRatio(nativeType, MF_MT_FRAME_RATE, &numerator, &denominator)) ||
+        denominator == 0) {
+        return UINT64_MAX;
+    }
+
+    // Pixel count first, frame rate breaks ties.
+    const uint64_t area = uint64_t(width) * height;
+    const uint64_t requested = uint64_t(request.width) * request.height;
+    const uint64_t fps = numerator / denominator;
+
+    const uint64_t areaDistance = area > requested ? area - requested : requested - area;
+    const uint64_t fpsDistance = fps > request.fps ? fps - request.fps : request.fps - fps;
+
+    return areaDistance * 1000 + fpsDistance;
+}
+
+bool Camera::checkRequiredResolution(IMFMediaType* nativeType, const FormatRequest& request)
 {
     uint32_t width = 0;
     uint32_t height = 0;
@@ -230,29 +764,35 @@ bool Camera::checkRequiredResolution(IMFMediaType* nativeType) const
 
     Info("Native resolution %ix%i@%1.3f\n", width, height, float(numerator) / float(denominator));
 
-    return mWidth == width && mHeight == height && mFps == numerator / denominator;
+    return request.width == width && request.height == height && request.fps == numerator / denominator;
 }
 
-bool Camera::adjustMediaTypeToDevice(IMFMediaType* nativeType) const
+bool Camera::adjustMediaTypeToDevice(IMFSourceReader* reader, IMFMediaType* nativeType, REFGUID requiredSubtype) const
 {
     GUID subtype = { 0 };
     if (HRESULT hr = nativeType->GetGUID(MF_MT_SUBTYPE, &subtype); FAILED(hr)) {
         return false;
     }
 
-    if (mDrawDevice.isFormatSupported(subtype)) {
-        return mReader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, nullptr, nativeType) == S_OK;
+    const bool anySubtype = requiredSubtype == GUID_NULL;
+
+    if (mDrawDevice.isFormatSupported(subtype) && (anySubtype || subtype == requiredSubtype)) {
+        return reader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, nullptr, nativeType) == S_OK;
     }
 
     // Can we decode this media type to one of our supported
     // output formats?
-    for (GUID format : mDrawDevice.getSupportedFormats()) {
+    for (const GUID& format : mFormats.empty() ? mDrawDevice.getSupportedFormats() : mFormats) {
+        if (!anySubtype && format != requiredSubtype) {
+            continue;
+        }
+
         if (HRESULT hr = nativeType->SetGUID(MF_MT_SUBTYPE, format); FAILED(hr)) {
             break;
         }
 
         // Try to set this type on the source reader.
-        if (HRESULT hr = mReader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, nullptr, nativeType);
+        if (HRESULT hr = reader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, nullptr, nativeType);
             SUCCEEDED(hr)) {
             return true;
         }
@@ -300,7 +840,71 @@ IMFActivate *Camera::findFirstDevice()
     return firstDevice;
 }
 
-bool Camera::drawSample(IMFSample* sample)
+//-------------------------------------------------------------------
+// FindDevice
+//
+// Enumerates video capture devices and matches the identity against
+// the symbolic link, then the friendly name.
+//-------------------------------------------------------------------
+
+IMFActivate* Camera::findDevice(const std::wstring& identity)
+{
+    IMFAttributes* attributes = nullptr;
+    if (HRESULT hr = MFCreateAttributes(&attributes, 1); FAILED(hr)) {
+        return nullptr;
+    }
+
+    HRESULT hr = attributes->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE,
+        MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
+
+    IMFActivate** devices = nullptr;
+    UINT32 count = 0;
+    if (SUCCEEDED(hr)) {
+        hr = MFEnumDeviceSources(attributes, &devices, &count);
+    }
+
+    attributes->Release();
+
+    if (FAILED(hr)) {
+        return nullptr;
+    }
+
+    IMFActivate* found = nullptr;
+
+    for (const GUID& key : { MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_SYMBOLIC_LINK, MF_DEVSOURCE_ATTRIBUTE_FRIENDLY_NAME }) {
+        for (UINT32 i = 0; i < count && !found; i++) {
+            WCHAR* value = nullptr;
+            if (FAILED(devices[i]->GetAllocatedString(key, &value, nullptr))) {
+                continue;
+            }
+
+            if (_wcsicmp(value, identity.c_str()) == 0) {
+                found = devices[i];
+                found->AddRef();
+            }
+
+            CoTaskMemFree(value);
+        }
+    }
+
+    for (UINT32 i = 0; i < count; i++) {
+        SafeRelease(&devices[i]);
+    }
+    CoTaskMemFree(devices);
+
+    return found;
+}
+
+//-------------------------------------------------------------------
+// DrawSample
+//
+// Headless, a published frame is converted straight into a frame of
+// the converted output, which takes over its metadata. Without a free
+// slot there, the renderer converts into its own buffer and only the
+// raw frame goes out.
+//-------------------------------------------------------------------
+
+bool Camera::drawSample(IMFSample* sample, Frame& frame, Frame& converted)
 {
     // Get the video frame buffer from the sample.
     IMFMediaBuffer* pBuffer = nullptr;
@@ -309,41 +913,153 @@ bool Camera::drawSample(IMFSample* sample)
         return false;
     }
 
-    // Draw the frame.
-    if (!mDrawDevice.DrawFrame(pBuffer)) {
-        SafeRelease(&pBuffer);
-        return false;
+    IMFMediaBuffer* pOutput = nullptr;
+    if (frame && mDrawDevice.isHeadless()) {
+        converted = mConverted.acquire(mDrawDevice.headlessWidth(), mDrawDevice.headlessHeight());
+
+        if (converted && FAILED(converted.sample()->GetBufferByIndex(0, &pOutput))) {
+            converted.reset();
+        }
     }
 
+    // Draw the frame. The stages keep their per-frame data in the
+    // frame's arena.
+    FrameStats stats;
+    const bool drawn = mDrawDevice.DrawFrame(pBuffer, &stats, frame ? &frame.arena() : nullptr, pOutput);
+
+    SafeRelease(&pOutput);
     SafeRelease(&pBuffer);
+
+    if (!drawn) {
+        converted.reset();
+        return false;
+    }
+
+    if (frame) {
+        frame.setStats(stats);
+    }
+
+    if (converted) {
+        FrameInfo info = frame.info();
+        info.subtype = MFVideoFormat_RGB32;
+        info.width = mDrawDevice.headlessWidth();
+        info.height = mDrawDevice.headlessHeight();
+        converted.setInfo(info);
+
+        LONGLONG duration = 0;
+        (void)converted.sample()->SetSampleTime(info.timestamp);
+        if (SUCCEEDED(sample->GetSampleDuration(&duration))) {
+            (void)converted.sample()->SetSampleDuration(duration);
+        }
+    }
+
     return true;
 }
 
 //-------------------------------------------------------------------
-// SetDevice
+// WrapSample
 //
-// Set up preview for a specified video capture device. 
+// Takes a pool slot for the sample and fills in its metadata. Returns
+// an empty frame, counted as dropped, if every slot is in use.
 //-------------------------------------------------------------------
 
-bool Camera::setDevice(IMFActivate *pActivate)
+Frame Camera::wrapSample(IMFSample* sample, DWORD streamFlags, LONGLONG timestamp)
 {
-    Info("SetDevice\n");
-    // Release the current device, if any.
-    closeDevice();
+    LARGE_INTEGER now = {};
+    QueryPerformanceCounter(&now);
+
+    FrameInfo info;
+    info.sequence = mSequence.fetch_add(1, std::memory_order_relaxed);
+    info.timestamp = timestamp;
+    info.captureTime = now.QuadPart;
+    info.sourceId = sourceId();
+    info.streamFlags = streamFlags;
+    info.subtype = mSubtype;
+    info.width = mFrameWidth;
+    info.height = mFrameHeight;
+    readCaptureMetadata(sample, info);
+
+    CameraMetrics& metrics = cameraMetrics();
+    metrics.frames.add();
+    updateFrameRate(now.QuadPart);
+
+    Frame frame = mFramePool->wrap(sample, info);
+    if (!frame) {
+        countDroppedFrame();
+        metrics.poolDrops.add();
+    }
+
+    return frame;
+}
 
+void Camera::publishFrame(const Frame& frame, const Frame& converted)
+{
+    if (!frame) {
+        return;
+    }
+
+    publish(frame);
+    cameraMetrics().queueDepth.set(int64_t(queueDepth()));
+
+    if (converted) {
+        mConverted.publish(converted);
+    }
+}
+
+//-------------------------------------------------------------------
+// UpdateFrameRate
+//
+// Publishes the frame rate once per second. Samples of an old and a
+// new reader may overlap during a switch, so the window is claimed
+// with a compare-exchange.
+//-------------------------------------------------------------------
+
+void Camera::updateFrameRate(LONGLONG now)
+{
+    static const LONGLONG frequency = [] {
+        LARGE_INTEGER value = {};
+        QueryPerformanceFrequency(&value);
+        return value.QuadPart;
+    }();
+
+    const uint64_t frames = mRateFrames.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    LONGLONG start = mRateWindowStart.load(std::memory_order_relaxed);
+    if (start == 0) {
+        mRateWindowStart.compare_exchange_strong(start, now, std::memory_order_relaxed);
+        return;
+    }
+
+    if (now - start < frequency || !mRateWindowStart.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+        return;
+    }
+
+    mRateFrames.fetch_sub(frames, std::memory_order_relaxed);
+    cameraMetrics().fps.set(int64_t(frames * frequency / (now - start)));
+}
+
+//-------------------------------------------------------------------
+// OpenReader
+//
+// Creates the media source and a reader with its own callback for a
+// device. The output format is not negotiated here.
+//-------------------------------------------------------------------
+
+bool Camera::openReader(IMFActivate* activate, ReaderState& state)
+{
     // Create the media source for the device.
-    IMFMediaSource* source = createSource(pActivate);
+    IMFMediaSource* source = createSource(activate);
     if (!source) {
         return false;
     }
 
-    MFObjectGuard gurad(source);
+    MFObjectGuard sourceGuard(source);
 
     // Get the symbolic link.
-    HRESULT symRes = pActivate->GetAllocatedString(
+    HRESULT symRes = activate->GetAllocatedString(
         MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_SYMBOLIC_LINK,
-        &mSymbolicLink,
-        &mSymbolicLinkId
+        &state.symbolicLink,
+        nullptr
     );
 
     if (FAILED(symRes)) {
@@ -351,20 +1067,53 @@ bool Camera::setDevice(IMFActivate *pActivate)
         return false;
     }
 
-    std::lock_guard lock(mMutex);
+    state.generation = ++mNextGeneration;
+    state.callback = new ReaderCallback(this, state.generation);
 
-    mReader = createReader(source);
-    if (!mReader) {
+    state.reader = createReader(source, state.callback);
+    if (!state.reader) {
         source->Shutdown();
+        releaseReader(state);
         return false;
     }
 
-    if (!setupOutputFormat(mReader)) {
+    return true;
+}
+
+//-------------------------------------------------------------------
+// SetDevice
+//
+// Set up preview for a specified video capture device. 
+//-------------------------------------------------------------------
+
+bool Camera::setDevice(IMFActivate *pActivate)
+{
+    Info("SetDevice\n");
+
+    std::lock_guard deviceLock(mDeviceMutex);
+
+    joinSwitchThread();
+
+    // Release the current device, if any.
+    closeDevice();
+
+    ReaderState state;
+    if (!openReader(pActivate, state)) {
+        return false;
+    }
+
+    std::unique_lock lock(mMutex);
+
+    if (!setupOutputFormat(state.reader)) {
+        lock.unlock();
+        releaseReader(state);
         return false;
     }
 
+    mActive = state;
+
     // Ask for the first sample.
-    HRESULT hr = mReader->ReadSample(
+    HRESULT hr = mActive.reader->ReadSample(
         (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
         0,
         nullptr,
@@ -374,13 +1123,107 @@ bool Camera::setDevice(IMFActivate *pActivate)
     );
 
     if (FAILED(hr)) {
+        lock.unlock();
         closeDevice();
         return false;
     }
 
+    cameraMetrics().deviceState.set(int64_t(DeviceState::Streaming));
+    return true;
+}
+
+//-------------------------------------------------------------------
+// SwitchDevice
+//
+// Replaces the current device without tearing down the pipeline.
+// The new device is opened in the background while the current one
+// keeps delivering; it takes over with its first sample. The render
+// sink, the frame pool and all subscribers stay in place, and the
+// renderer is only reconfigured if the new device cannot deliver the
+// current format.
+//-------------------------------------------------------------------
+
+bool Camera::switchDevice(IMFActivate* pActivate)
+{
+    bool active = false;
+    {
+        std::lock_guard lock(mMutex);
+        active = mActive.reader != nullptr;
+    }
+
+    if (!active) {
+        // Nothing to keep alive.
+        return setDevice(pActivate);
+    }
+
+    std::lock_guard deviceLock(mDeviceMutex);
+
+    joinSwitchThread();
+
+    pActivate->AddRef();
+
+    mSwitchThread = std::thread([this, pActivate] {
+        if (SUCCEEDED(CoInitializeEx(nullptr, COINIT_MULTITHREADED))) {
+            openPendingDevice(pActivate);
+            CoUninitialize();
+        }
+
+        pActivate->Release();
+    });
+
     return true;
 }
 
+void Camera::openPendingDevice(IMFActivate* activate)
+{
+    ReaderState state;
+    if (!openReader(activate, state)) {
+        Error("Cannot open the new capture device\n");
+        return;
+    }
+
+    FormatRequest request;
+    {
+        std::lock_guard lock(mMutex);
+        request = formatRequest();
+    }
+
+    IMFMediaType* type = negotiateFormat(state.reader, request);
+    if (!type) {
+        Error("New capture device has no usable format\n");
+        releaseReader(state);
+        return;
+    }
+
+    ReaderState replaced;
+    ReaderState failed;
+
+    {
+        std::lock_guard lock(mMutex);
+
+        replaced = std::exchange(mPending, state);
+        SafeRelease(&mPendingType);
+
+        if (isCurrentFormat(type)) {
+            type->Release();
+        }
+        else {
+            mPendingType = type;
+        }
+
+        HRESULT hr = mPending.reader->ReadSample((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0,
+            nullptr, nullptr, nullptr, nullptr);
+
+        if (FAILED(hr)) {
+            failed = std::exchange(mPending, ReaderState());
+            SafeRelease(&mPendingType);
+        }
+    }
+
+    releaseReader(replaced);
+    releaseReader(failed);
+}
+
 //-------------------------------------------------------------------
 //  ResizeVideo
 //  Resizes the video rectangle.
@@ -402,6 +1245,18 @@ void Camera::resizeVideo(WORD /*width*/, WORD /*height*/)
     MessageBox(NULL, L"ResetDevice failed!", NULL, MB_OK);
 }
 
+void Camera::addStage(std::shared_ptr<FrameStage> stage)
+{
+    std::lock_guard lock(mMutex);
+    mDrawDevice.addStage(std::move(stage));
+}
+
+void Camera::removeStage(const std::shared_ptr<FrameStage>& stage)
+{
+    std::lock_guard lock(mMutex);
+    mDrawDevice.removeStage(stage);
+}
+
 
 //-------------------------------------------------------------------
 //  CheckDeviceLost
@@ -426,10 +1281,30 @@ bool Camera::isDeviceLost(DEV_BROADCAST_HDR *pHdr) const
 
     std::lock_guard lock(mMutex);
 
-    if (!mSymbolicLink) {
+    if (!mActive.symbolicLink) {
         return false;
     }
 
-    return _wcsicmp(mSymbolicLink, pDi->dbcc_name) == 0;
+    return _wcsicmp(mActive.symbolicLink, pDi->dbcc_name) == 0;
+}
+
+std::wstring Camera::symbolicLink() const
+{
+    std::lock_guard lock(mMutex);
+    return mActive.symbolicLink ? std::wstring(mActive.symbolicLink) : std::wstring();
+}
+
+void Camera::format(GUID& subtype, uint32_t& width, uint32_t& height) const
+{
+    std::lock_guard lock(mMutex);
+    subtype = mSubtype;
+    width = mFrameWidth;
+    height = mFrameHeight;
+}
+
+void Camera::setDeviceLostHandler(std::function<void(const std::wstring&)> handler)
+{
+    std::lock_guard lock(mMutex);
+    mDeviceLostHandler = std::move(handler);
 }
 
@@ -13,77 +13,167 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <mfapi.h>
 #include <mfidl.h>
 #include <mfreadwrite.h>
 #include <Dbt.h>
 
+#include "ConvertedSource.h"
 #include "DrawDevice.h"
+#include "SessionConfig.h"
+#include "FramePool.h"
+#include "FrameSource.h"
+#include "WorkerPool.h"
 
 //const UINT WM_APP_PREVIEW_ERROR = WM_APP + 1;    // wparam = HRESULT
 
-class Camera : public IMFSourceReaderCallback
+class Camera : public FrameSource
 {
 public:
     /*
-    * HWND hVideo - Handle to the video window
+    * HWND hVideo - Handle to the video window, nullptr for headless capture
     * HWND hEvent - Handle to the window to receive notifications
     */
     Camera(HWND hVideo, HWND hEvent, uint32_t width, uint32_t height, uint32_t fps);
+    Camera(HWND hVideo, HWND hEvent, const SessionConfig& config);
     ~Camera();
 
 
     bool init();
     bool setDevice(IMFActivate* pActivate);
+    bool switchDevice(IMFActivate* pActivate);
     void closeDevice();
     void resizeVideo(WORD width, WORD height);
     bool isDeviceLost(DEV_BROADCAST_HDR* pHdr) const;
+    std::wstring symbolicLink() const;
 
-    // IUnknown methods
-    HRESULT QueryInterface(REFIID iid, void** ppv) override;
-    ULONG AddRef() override;
-    ULONG Release() override;
-
-    // IMFSourceReaderCallback methods
-    HRESULT OnReadSample(
-        HRESULT hrStatus,
-        DWORD dwStreamIndex,
-        DWORD dwStreamFlags,
-        LONGLONG llTimestamp,
-        IMFSample *pSample
-    ) override;
-
-    HRESULT OnEvent(DWORD, IMFMediaEvent *) override
+    // Negotiated output format; kept after closeDevice() and preferred
+    // when a device is opened again.
+    void format(GUID& subtype, uint32_t& width, uint32_t& height) const;
+
+    // Called from a reader thread when the active device stops with an
+    // error. The argument is the symbolic link of the lost device.
+    void setDeviceLostHandler(std::function<void(const std::wstring&)> handler);
+
+    // Feed samples produced elsewhere (synthetic, replay) through the
+    // capture path instead of a device reader.
+    bool setSampleFormat(IMFMediaType* type);
+    bool processSample(IMFSample* sample, DWORD streamFlags, LONGLONG timestamp);
+
+    // Stages run on every converted frame: overlays, burned-in text.
+    void addStage(std::shared_ptr<FrameStage> stage);
+    void removeStage(const std::shared_ptr<FrameStage>& stage);
+
+    FrameArena::Stats arenaStats() const override { return mFramePool->arenaStats(); }
+
+    // Headless, the frames as converted to RGB32, with square pixels if
+    // configured, published right after the raw ones. Nothing is
+    // published here while the camera draws into a window.
+    FrameSource& convertedFrames() { return mConverted; }
+
+    // Identity is a symbolic link or a friendly name.
+    static IMFActivate* findDevice(const std::wstring& identity);
+
+private:
+    class ReaderCallback;
+
+    // What format negotiation looks for. Taken under the lock, so that
+    // a device can be opened without holding it.
+    struct FormatRequest
     {
-        return S_OK;
-    }
+        GUID subtype = GUID_NULL;   // Negotiated subtype to keep, if any.
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t fps = 0;
+        ResolutionPolicy resolution = ResolutionPolicy::Exact;
+    };
 
-    HRESULT OnFlush(DWORD) override
+    // A reader together with the callback that delivers its samples.
+    struct ReaderState
     {
-        return S_OK;
-    }
+        IMFSourceReader* reader = nullptr;
+        ReaderCallback* callback = nullptr;
+        WCHAR* symbolicLink = nullptr;
+        uint64_t generation = 0;
+    };
 
-private:
-    bool drawSample(IMFSample* sample);
+    HRESULT onReadSample(uint64_t generation, HRESULT hrStatus, DWORD streamFlags,
+        LONGLONG timestamp, IMFSample* sample);
+    bool openReader(IMFActivate* activate, ReaderState& state);
+    void openPendingDevice(IMFActivate* activate);
+    bool commitPendingDevice(ReaderState& previous);
+    static void releaseReader(ReaderState& state);
+    void releaseReaderAsync(ReaderState& state);
+    void waitForReleases();
+    void joinSwitchThread();
+
+    bool createRenderer();
+    bool drawSample(IMFSample* sample, Frame& frame, Frame& converted);
+    Frame wrapSample(IMFSample* sample, DWORD streamFlags, LONGLONG timestamp);
+    void publishFrame(const Frame& frame, const Frame& converted);
+    void updateFrameRate(LONGLONG now);
     IMFMediaSource* createSource(IMFActivate* activate) const;
-    IMFAttributes* createAttributes();
+    IMFAttributes* createAttributes(IMFSourceReaderCallback* callback);
     bool setupOutputFormat(IMFSourceReader *reader);
-    IMFSourceReader* createReader(IMFMediaSource *source);
-    bool checkRequiredResolution(IMFMediaType* nativeType) const;
-    bool adjustMediaTypeToDevice(IMFMediaType* pType) const;
+    FormatRequest formatRequest() const;
+    IMFMediaType* negotiateFormat(IMFSourceReader* reader, const FormatRequest& request) const;
+    IMFMediaType* selectOutputFormat(IMFSourceReader* reader, const FormatRequest& request,
+        REFGUID requiredSubtype) const;
+    IMFMediaType* selectPreferredFormat(IMFSourceReader* reader, const FormatRequest& request) const;
+    bool applyVideoType(IMFMediaType* type);
+    bool isCurrentFormat(IMFMediaType* type) const;
+    IMFSourceReader* createReader(IMFMediaSource *source, IMFSourceReaderCallback* callback);
+    static bool checkRequiredResolution(IMFMediaType* nativeType, const FormatRequest& request);
+    static uint64_t resolutionDistance(IMFMediaType* nativeType, const FormatRequest& request);
+    bool adjustMediaTypeToDevice(IMFSourceReader* reader, IMFMediaType* pType, REFGUID requiredSubtype) const;
     IMFActivate *findFirstDevice();
 
+    std::unique_ptr<WorkerPool> mWorkerPool;   // Declared first: the renderer uses it.
     DrawDevice mDrawDevice;
     HWND mVideoWindow = nullptr;
     HWND mAppWindow = nullptr;
-    IMFSourceReader* mReader = nullptr;
-    WCHAR* mSymbolicLink = nullptr;
-    UINT32 mSymbolicLinkId = 0;
+    std::wstring mDeviceIdentity;
+    ReaderState mActive;
+    ReaderState mPending;
+    IMFMediaType* mPendingType = nullptr;   // Set if the pending device needs a new renderer format.
+    std::atomic<uint64_t> mNextGeneration = 0;
+    std::thread mSwitchThread;
+    std::mutex mDeviceMutex;    // Serializes setDevice and switchDevice.
+    std::function<void(const std::wstring&)> mDeviceLostHandler;
+
+    // Replaced readers still being released, see releaseReaderAsync.
+    struct DeferredRelease;
+    size_t mPendingReleases = 0;
+    std::vector<ReaderState> mRetiredReaders;
+    std::mutex mReleaseMutex;
+    std::condition_variable mReleasesDone;
+
+    // Requested capture mode, as configured.
     uint32_t mWidth = 1280;
     uint32_t mHeight = 720;
     uint32_t mFps = 30;
+    ResolutionPolicy mResolution = ResolutionPolicy::Exact;
+    std::vector<GUID> mFormats;     // Preferred output formats, in order.
+
+    // Negotiated output format, which can differ from the requested
+    // mode with ResolutionPolicy::Closest.
+    GUID mSubtype = GUID_NULL;
+    uint32_t mFrameWidth = 0;
+    uint32_t mFrameHeight = 0;
     mutable std::mutex mMutex;
+
+    std::shared_ptr<FramePool> mFramePool;
+    ConvertedSource mConverted;
+    std::atomic<uint64_t> mSequence = 0;
+    std::atomic<uint64_t> mRateFrames = 0;
+    std::atomic<LONGLONG> mRateWindowStart = 0;
 };
@@ -0,0 +1,50 @@
+#include "ConvertedSource.h"
+
+#include "Debug.h"
+
+ConvertedSource::ConvertedSource(size_t poolSize) : mPoolSize(poolSize)
+{
+}
+
+ConvertedSource::~ConvertedSource()
+{
+    closeStreams();
+}
+
+//-------------------------------------------------------------------
+// Acquire
+//
+// A size whose frames cannot be allocated is not retried until the
+// size changes again.
+//-------------------------------------------------------------------
+
+Frame ConvertedSource::acquire(uint32_t width, uint32_t height)
+{
+    std::lock_guard lock(mMutex);
+
+    if (width != mWidth || height != mHeight) {
+        mWidth = width;
+        mHeight = height;
+
+        // Converted frames have no arena; the stages use the one of the
+        // frame they were converted from.
+        mFramePool = std::make_shared<FramePool>(mPoolSize);
+        if (!mFramePool->allocate(DWORD(width) * height * 4)) {
+            Error("ConvertedSource: cannot allocate %ux%u frames\n", width, height);
+            mFramePool.reset();
+        }
+    }
+
+    Frame frame = mFramePool ? mFramePool->acquire() : Frame();
+    if (!frame) {
+        countDroppedFrame();
+    }
+
+    return frame;
+}
+
+FrameArena::Stats ConvertedSource::arenaStats() const
+{
+    std::lock_guard lock(mMutex);
+    return mFramePool ? mFramePool->arenaStats() : FrameArena::Stats();
+}
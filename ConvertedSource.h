@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "FramePool.h"
+#include "FrameSource.h"
+
+//-------------------------------------------------------------------
+// ConvertedSource
+//
+// The frames of a source as its headless renderer delivers them:
+// RGB32, rotated, rescaled to square pixels and with the stages
+// applied. The producer converts straight into a frame from acquire()
+// and publishes it next to the raw one, so consumers that want the
+// picture rather than the sensor data get it without converting again.
+//
+// The pool is replaced when the frame size changes; frames of the old
+// size stay valid until their consumers release them.
+//-------------------------------------------------------------------
+
+class ConvertedSource : public FrameSource
+{
+public:
+    explicit ConvertedSource(size_t poolSize);
+    ~ConvertedSource();
+
+    // A frame with room for one width x height RGB32 image, or an empty
+    // frame, counted as dropped, if every slot is in use.
+    Frame acquire(uint32_t width, uint32_t height);
+
+    // For frames from acquire(), with their metadata filled in.
+    using FrameSource::publish;
+
+    FrameArena::Stats arenaStats() const override;
+
+private:
+    const size_t mPoolSize;
+    std::shared_ptr<FramePool> mFramePool;
+    uint32_t mWidth = 0;
+    uint32_t mHeight = 0;
+    mutable std::mutex mMutex;
+};
@@ -21,8 +21,12 @@
 
 #include "SafeRelease.h"
 #include "BufferLock.h"
-#include "FormatConvertor.h"
+#include "FrameStage.h"
+#include "Resampler.h"
+#include "TemporalDenoiser.h"
+#include "WorkerPool.h"
 #include "Debug.h"
+#include "Metrics.h"
 
 const DWORD NUM_BACK_BUFFERS = 2;
 
@@ -39,6 +43,9 @@ inline LONG Height(const RECT& r)
 
 namespace {
 
+    // Stage scratch for frames drawn without their own arena.
+    const size_t STAGE_ARENA_SIZE = 512 * 1024;
+
     class MFObjectGuard {
     public:
         MFObjectGuard(IUnknown* object) :mObject(object) {}
@@ -51,6 +58,29 @@ namespace {
         IUnknown* mObject = nullptr;
     };
 
+    MetricHistogram& conversionTime()
+    {
+        static MetricHistogram& histogram = Metrics::instance().histogram("mfcamera_conversion_seconds",
+            "Time to convert one frame to RGB32.");
+        return histogram;
+    }
+
+    // Converts one frame and records how long it took.
+    bool timedConvert(const FormatConvertor& converter, uint8_t* dest, uint32_t destStride,
+        const FramePlanes& source, const Orientation& orientation)
+    {
+        LARGE_INTEGER start = {};
+        QueryPerformanceCounter(&start);
+
+        const bool ok = converter.convert(dest, destStride, source, orientation);
+
+        LARGE_INTEGER end = {};
+        QueryPerformanceCounter(&end);
+
+        conversionTime().observe(ElapsedMicroseconds(start.QuadPart, end.QuadPart));
+        return ok;
+    }
+
     // Static table of output formats and conversion functions.
     struct ConversionFunction
     {
@@ -153,53 +183,6 @@ namespace {
         return rc;
     }
 
-
-    //-----------------------------------------------------------------------------
-    // GetDefaultStride
-    //
-    // Gets the default stride for a video frame, assuming no extra padding bytes.
-    //
-    //-----------------------------------------------------------------------------
-
-    HRESULT GetDefaultStride(IMFMediaType* pType, LONG* plStride)
-    {
-        LONG lStride = 0;
-
-        // Try to get the default stride from the media type.
-        HRESULT hr = pType->GetUINT32(MF_MT_DEFAULT_STRIDE, (UINT32*)&lStride);
-        if (FAILED(hr))
-        {
-            // Attribute not set. Try to calculate the default stride.
-            GUID subtype = GUID_NULL;
-
-            UINT32 width = 0;
-            UINT32 height = 0;
-
-            // Get the subtype and the image size.
-            hr = pType->GetGUID(MF_MT_SUBTYPE, &subtype);
-            if (SUCCEEDED(hr))
-            {
-                hr = MFGetAttributeSize(pType, MF_MT_FRAME_SIZE, &width, &height);
-            }
-            if (SUCCEEDED(hr))
-            {
-                hr = MFGetStrideForBitmapInfoHeader(subtype.Data1, width, &lStride);
-            }
-
-            // Set the attribute for later reference.
-            if (SUCCEEDED(hr))
-            {
-                (void)pType->SetUINT32(MF_MT_DEFAULT_STRIDE, UINT32(lStride));
-            }
-        }
-
-        if (SUCCEEDED(hr))
-        {
-            *plStride = lStride;
-        }
-        return hr;
-    }
-
 }
 
 
@@ -210,6 +193,7 @@ namespace {
 DrawDevice::DrawDevice()
 {
     std::memset(&mD3Params, 0, sizeof(mD3Params));
+    (void)mStageArena.reserve(STAGE_ARENA_SIZE);
 }
 
 
@@ -222,6 +206,19 @@ DrawDevice::~DrawDevice()
     DestroyDevice();
 }
 
+void DrawDevice::setScaler(PreviewScaler scaler, WorkerPool* pool)
+{
+    mScaler = scaler;
+    mScalerPool = pool;
+}
+
+
+void DrawDevice::setDenoise(uint32_t strength, uint32_t motionThreshold)
+{
+    mDenoiseStrength = strength;
+    mDenoiseThreshold = motionThreshold;
+}
+
 
 //-------------------------------------------------------------------
 //  IsFormatSupported
@@ -231,12 +228,7 @@ DrawDevice::~DrawDevice()
 
 bool DrawDevice::isFormatSupported(REFGUID subtype) const
 {
-    auto it = std::find_if(formatConversions.begin(), formatConversions.end(),
-        [subtype](const ConversionFunction &f) {
-            return f.subtype == subtype;
-        });
-
-    return it != formatConversions.end();
+    return findConversionFunction(subtype) != nullptr;
 }
 
 
@@ -304,7 +296,22 @@ bool DrawDevice::createDevice(HWND hwnd)
     return true;
 }
 
-const FormatConvertor *DrawDevice::findConversionFunction(REFGUID subtype) const
+//-------------------------------------------------------------------
+// CreateHeadless
+//
+// Use the converters without Direct3D, e.g. for services and tools
+// that run without a desktop session.
+//-------------------------------------------------------------------
+
+bool DrawDevice::createHeadless()
+{
+    DestroyDevice();
+
+    mHeadless = true;
+    return true;
+}
+
+const FormatConvertor *DrawDevice::findConversionFunction(REFGUID subtype)
 {
     auto it = std::find_if(formatConversions.begin(), formatConversions.end(),
         [subtype](const ConversionFunction& f) {
@@ -323,64 +330,55 @@ const FormatConvertor *DrawDevice::findConversionFunction(REFGUID subtype) const
 
 bool DrawDevice::setVideoType(IMFMediaType *pType)
 {
-    // Find the video subtype.
-    GUID subtype = { 0 };
-    if (HRESULT hr = pType->GetGUID(MF_MT_SUBTYPE, &subtype); FAILED(hr)) {
-        return false;
-    }
+    FramePlanKey key;
+    key.orientation = mOrientation;
+    key.squarePixels = mSquarePixels && mHeadless;
+    key.bands = mScalerPool ? mScalerPool->concurrency() * 2 : 1;
 
-    // Choose a conversion function.
-    // (This also validates the format type.)
-    mRGB32Converter = findConversionFunction(subtype);
-    if (!mRGB32Converter) {
+    if (!key.read(pType)) {
         return false;
     }
 
-    Info("Vide format: %s\n", mRGB32Converter->type().c_str());
+    const FramePlan* plan = mPlans.find(key);
 
-    mFormat = (D3DFORMAT)subtype.Data1;
-
-    //
-    // Get some video attributes.
-    //
+    if (!plan) {
+        // Choose a conversion function.
+        // (This also validates the format type.)
+        const FormatConvertor* converter = findConversionFunction(key.subtype);
+        if (!converter) {
+            return false;
+        }
 
-    // Get the frame size.
-    if (HRESULT hr = MFGetAttributeSize(pType, MF_MT_FRAME_SIZE, &mWidth, &mHeight); FAILED(hr)) {
-        return false;
+        plan = &mPlans.insert(FramePlan::create(key, *converter));
     }
 
-    // Get the interlace mode. Default: assume progressive.
-    mInterlaceMode = (MFVideoInterlaceMode)MFGetAttributeUINT32(
-        pType,
-        MF_MT_INTERLACE_MODE, 
-        MFVideoInterlace_Progressive
-        );
+    mPlan = *plan;
+    mFormat = (D3DFORMAT)key.subtype.Data1;
 
-    // Get the image stride.
-    if (HRESULT hr = GetDefaultStride(pType, &mDefaultStride); FAILED(hr)) {
-        return false;
+    mDenoiser.reset();
+    if (mDenoiseStrength > 0) {
+        mDenoiser = std::make_unique<TemporalDenoiser>(mDenoiseStrength, mDenoiseThreshold, key.bands);
     }
 
-    Info("Resolution %ix%i stride %i\n", mWidth, mHeight, mDefaultStride);
-
-    // Get the pixel aspect ratio. Default: Assume square pixels (1:1)
-    HRESULT ratioRes = MFGetAttributeRatio(pType, MF_MT_PIXEL_ASPECT_RATIO, 
-        (UINT32*)&mAspect.Numerator, (UINT32*)&mAspect.Denominator);
+    Info("Vide format: %s\n", mPlan.converter->type().c_str());
+    Info("Resolution %ix%i stride %i\n", key.width, key.height, key.defaultStride);
 
-    if (FAILED(ratioRes)) {
-        mAspect.Numerator = mAspect.Denominator = 1;
+    if (outputWidth() * outputHeight() != key.width * key.height) {
+        Info("Aperture %i,%i %ix%i\n", key.aperture.left, key.aperture.top,
+            key.aperture.right - key.aperture.left, key.aperture.bottom - key.aperture.top);
     }
 
-    if (!createSwapChains()) {
-        return false;
+    if (mHeadless) {
+        updateHeadlessFrame();
+        return true;
     }
 
     // Update the destination rectangle for the correct
-    // aspect ratio.
+    // aspect ratio. This also decides the swap chain size.
 
     UpdateDestinationRect();
 
-    return true;
+    return createSwapChains();
 }
 
 //-------------------------------------------------------------------
@@ -394,13 +392,83 @@ bool DrawDevice::setVideoType(IMFMediaType *pType)
 void DrawDevice::UpdateDestinationRect()
 {
     RECT rcClient;
-    RECT rcSrc = { 0, 0, long(mWidth), long(mHeight) };
+    RECT rcSrc = { 0, 0, long(outputWidth()), long(outputHeight()) };
 
     GetClientRect(mWindow, &rcClient);
 
-    rcSrc = CorrectAspectRatio(rcSrc, mAspect);
+    rcSrc = CorrectAspectRatio(rcSrc, mPlan.outputAspect);
 
     mDestRect = LetterBoxRect(rcSrc, rcClient);
+
+    updateResampler();
+}
+
+//-------------------------------------------------------------------
+// UpdateResampler
+//
+// Only reductions go through the resampler; enlarging is left to
+// StretchRect, which does not alias.
+//-------------------------------------------------------------------
+
+void DrawDevice::updateResampler()
+{
+    const uint32_t width = uint32_t(std::max(Width(mDestRect), 0L));
+    const uint32_t height = uint32_t(std::max(Height(mDestRect), 0L));
+
+    const bool shrink = mScaler != PreviewScaler::Linear && width > 0 && height > 0 &&
+        (width < outputWidth() || height < outputHeight());
+
+    if (!shrink) {
+        mResampler.reset();
+        mScaleFrame = std::vector<uint8_t>();
+        return;
+    }
+
+    const ResampleFilter filter = mScaler == PreviewScaler::Area ? ResampleFilter::Area : ResampleFilter::Lanczos3;
+
+    if (mResampler && mResampler->filter() == filter &&
+        mResampler->srcWidth() == outputWidth() && mResampler->srcHeight() == outputHeight() &&
+        mResampler->dstWidth() == width && mResampler->dstHeight() == height) {
+        return;
+    }
+
+    const uint32_t bands = mScalerPool ? mScalerPool->concurrency() * 2 : 1;
+
+    mResampler = std::make_unique<Resampler>(outputWidth(), outputHeight(), width, height, filter,
+        Resampler::Layout::RGB32, bands);
+    mScaleFrame.resize(size_t(outputWidth()) * outputHeight() * 4);
+}
+
+//-------------------------------------------------------------------
+// UpdateHeadlessFrame
+//
+// Sizes the headless frame, and the full-size frame that rotated
+// frames are converted into before the square-pixel rescale.
+//-------------------------------------------------------------------
+
+void DrawDevice::updateHeadlessFrame()
+{
+    mScaleFrame = std::vector<uint8_t>();
+
+    if (mPlan.squarePixels) {
+        if (!mPlan.key.orientation.isIdentity()) {
+            mScaleFrame.resize(size_t(outputWidth()) * outputHeight() * 4);
+        }
+
+        Info("Square pixels: %ux%u -> %ux%u\n", outputWidth(), outputHeight(), headlessWidth(), headlessHeight());
+    }
+
+    mHeadlessFrame.resize(size_t(headlessWidth()) * headlessHeight() * 4);
+}
+
+uint32_t DrawDevice::surfaceWidth() const
+{
+    return mResampler ? mResampler->dstWidth() : outputWidth();
+}
+
+uint32_t DrawDevice::surfaceHeight() const
+{
+    return mResampler ? mResampler->dstHeight() : outputHeight();
 }
 
 //-------------------------------------------------------------------
@@ -415,8 +483,8 @@ bool DrawDevice::createSwapChains()
 
     SafeRelease(&mSwapChain);
 
-    pp.BackBufferWidth  = mWidth;
-    pp.BackBufferHeight = mHeight;
+    pp.BackBufferWidth  = surfaceWidth();
+    pp.BackBufferHeight = surfaceHeight();
     pp.Windowed = TRUE;
     pp.SwapEffect = D3DSWAPEFFECT_FLIP;
     pp.hDeviceWindow = mWindow;
@@ -437,12 +505,20 @@ bool DrawDevice::createSwapChains()
 // Draw the video frame.
 //-------------------------------------------------------------------
 
-bool DrawDevice::DrawFrame(IMFMediaBuffer *pBuffer)
+bool DrawDevice::DrawFrame(IMFMediaBuffer *pBuffer, FrameStats* stats, FrameArena* arena, IMFMediaBuffer* pOutput)
 {
-    if (!mRGB32Converter) {
+    if (!mPlan.converter) {
+        return false;
+    }
+
+    if (mDenoiser && !denoise(pBuffer)) {
         return false;
     }
 
+    if (mHeadless) {
+        return drawHeadless(pBuffer, stats, arena, pOutput);
+    }
+
     if (!mDevice || !mSwapChain) {
         return true;
     }
@@ -467,17 +543,35 @@ bool DrawDevice::DrawFrame(IMFMediaBuffer *pBuffer)
     }
 
     VideoBufferLock buffer(pBuffer);
-    const uint8_t* scanLine = buffer.LockBuffer(mDefaultStride, mHeight);
-    if (!scanLine) {
-        return false;
+    const uint8_t* scanLine = buffer.LockBuffer(mPlan.key.defaultStride, mPlan.key.height);
+    bool converted = false;
+
+    if (scanLine) {
+        const FramePlanKey& key = mPlan.key;
+        const FramePlanes source = sourcePlanes(buffer, scanLine);
+
+        if (mResampler) {
+            // Convert at full size, then shrink into the surface.
+            const uint32_t frameStride = outputWidth() * 4;
+            converted = timedConvert(*mPlan.converter, mScaleFrame.data(), frameStride, source, key.orientation);
+            if (converted) {
+                runStages(mScaleFrame.data(), frameStride, outputWidth(), outputHeight(), stats, arena);
+                converted = mResampler->resample(mScaleFrame.data(), frameStride, (uint8_t*)lr.pBits, lr.Pitch,
+                    mScalerPool);
+            }
+        }
+        else {
+            // Convert the frame. This also copies it to the Direct3D surface.
+            converted = timedConvert(*mPlan.converter, (uint8_t*)lr.pBits, lr.Pitch, source, key.orientation);
+            if (converted) {
+                runStages((uint8_t*)lr.pBits, lr.Pitch, outputWidth(), outputHeight(), stats, arena);
+            }
+        }
     }
 
-    const long stride = buffer.getStride();
-
-    // Convert the frame. This also copies it to the Direct3D surface.
-    mRGB32Converter->convert((uint8_t*)lr.pBits, lr.Pitch, scanLine, stride, mWidth, mHeight);
-
-    if (HRESULT hr = pSurf->UnlockRect(); FAILED(hr)) {
+    // The surface is unlocked either way; a frame that was not converted
+    // is not presented.
+    if (HRESULT hr = pSurf->UnlockRect(); FAILED(hr) || !converted) {
         return false;
     }
 
@@ -503,14 +597,151 @@ bool DrawDevice::DrawFrame(IMFMediaBuffer *pBuffer)
     return mDevice->Present(NULL, NULL, NULL, NULL) == S_OK;
 }
 
-std::vector<GUID> DrawDevice::getSupportedFormats() const
+//-------------------------------------------------------------------
+// DrawHeadless
+//
+// Converts into the output buffer, which then holds the whole frame
+// at headlessStride().
+//-------------------------------------------------------------------
+
+bool DrawDevice::drawHeadless(IMFMediaBuffer* pBuffer, FrameStats* stats, FrameArena* arena, IMFMediaBuffer* pOutput)
 {
-    std::vector<GUID> list;
+    if (!pOutput) {
+        return convertHeadless(pBuffer, mHeadlessFrame.data(), stats, arena);
+    }
 
-    std::transform(formatConversions.begin(), formatConversions.end(), std::back_inserter(list),
-        [](const ConversionFunction &c) {
-            return c.subtype;
-        });
+    const DWORD frameBytes = DWORD(headlessStride()) * headlessHeight();
+    DWORD capacity = 0;
+    if (FAILED(pOutput->GetMaxLength(&capacity)) || capacity < frameBytes) {
+        return false;
+    }
+
+    VideoBufferLock output(pOutput);
+    uint8_t* destination = output.LockBuffer(headlessStride(), headlessHeight());
+    if (!destination || output.getStride() != long(headlessStride()) ||
+        !convertHeadless(pBuffer, destination, stats, arena)) {
+        return false;
+    }
+
+    output.unlock();
+    return SUCCEEDED(pOutput->SetCurrentLength(frameBytes));
+}
+
+bool DrawDevice::convertHeadless(IMFMediaBuffer* pBuffer, uint8_t* destination, FrameStats* stats, FrameArena* arena)
+{
+    VideoBufferLock buffer(pBuffer);
+    const uint8_t* scanLine = buffer.LockBuffer(mPlan.key.defaultStride, mPlan.key.height);
+    if (!scanLine) {
+        return false;
+    }
+
+    const FramePlanKey& key = mPlan.key;
+    const FramePlanes source = sourcePlanes(buffer, scanLine);
+    Resampler* rescale = mPlan.squarePixels.get();
+    bool converted = false;
+
+    if (!rescale) {
+        converted = timedConvert(*mPlan.converter, destination, headlessStride(), source, key.orientation);
+    }
+    else if (key.orientation.isIdentity()) {
+        // Anamorphic rescale fused with the conversion.
+        converted = rescale->resample(*mPlan.converter, source,
+            destination, headlessStride(), mScalerPool);
+    }
+    else {
+        const uint32_t frameStride = outputWidth() * 4;
+        converted = timedConvert(*mPlan.converter, mScaleFrame.data(), frameStride, source, key.orientation) &&
+            rescale->resample(mScaleFrame.data(), frameStride, destination, headlessStride(), mScalerPool);
+    }
+
+    if (!converted) {
+        return false;
+    }
+
+    runStages(destination, headlessStride(), headlessWidth(), headlessHeight(), stats, arena);
+    return true;
+}
+
+//-------------------------------------------------------------------
+// SourcePlanes
+//
+// The visible part of the locked frame.
+//-------------------------------------------------------------------
+
+FramePlanes DrawDevice::sourcePlanes(const VideoBufferLock& buffer, const uint8_t* scanLine) const
+{
+    return mPlan.sourcePlanes(scanLine, int32_t(buffer.getStride()), buffer.getLength());
+}
+
+//-------------------------------------------------------------------
+// Denoise
+//
+// Filters the frame in its own buffer. The camera publishes the same
+// sample after drawing it, so recorders and every other subscriber
+// get the filtered frame, also while the preview cannot be drawn.
+//-------------------------------------------------------------------
+
+bool DrawDevice::denoise(IMFMediaBuffer* pBuffer)
+{
+    VideoBufferLock buffer(pBuffer);
+    const uint8_t* scanLine = buffer.LockBuffer(mPlan.key.defaultStride, mPlan.key.height);
+    if (!scanLine) {
+        return false;
+    }
+
+    mDenoiser->processInPlace(sourcePlanes(buffer, scanLine), mScalerPool);
+    return true;
+}
+
+void DrawDevice::addStage(std::shared_ptr<FrameStage> stage)
+{
+    mStages.push_back(std::move(stage));
+}
+
+void DrawDevice::removeStage(const std::shared_ptr<FrameStage>& stage)
+{
+    mStages.erase(std::remove(mStages.begin(), mStages.end(), stage), mStages.end());
+}
+
+//-------------------------------------------------------------------
+// RunStages
+//
+// Without a frame arena the stages share the device's, which only has
+// to last until the next frame.
+//-------------------------------------------------------------------
+
+void DrawDevice::runStages(uint8_t* frame, uint32_t stride, uint32_t width, uint32_t height, FrameStats* stats,
+    FrameArena* arena)
+{
+    if (mStages.empty()) {
+        return;
+    }
+
+    FrameStats unused;
+
+    if (!arena) {
+        mStageArena.reset();
+        arena = &mStageArena;
+    }
+
+    for (const std::shared_ptr<FrameStage>& stage : mStages) {
+        stage->process(frame, stride, width, height, stats ? *stats : unused, *arena);
+    }
+}
+
+const std::vector<GUID>& DrawDevice::getSupportedFormats() const
+{
+    // The table never changes, so the list is built once.
+    static const std::vector<GUID> list = [] {
+        std::vector<GUID> formats;
+
+        std::transform(formatConversions.begin(), formatConversions.end(), std::back_inserter(formats),
+            [](const ConversionFunction &c) {
+                return c.subtype;
+            });
+
+        return formats;
+    }();
 
     return list;
 }
@@ -550,6 +781,10 @@ bool DrawDevice::TestCooperativeLevel()
 
 bool DrawDevice::resetDevice()
 {
+    if (mHeadless) {
+        return true;
+    }
+
     if (mDevice) {
         D3DPRESENT_PARAMETERS d3dpp = mD3Params;
 
@@ -565,13 +800,19 @@ bool DrawDevice::resetDevice()
         }
     }
 
-    if (!mSwapChain && mFormat != D3DFMT_UNKNOWN) {
-        
-        if (!createSwapChains()) {
-            return false;
-        }
+    if (mFormat != D3DFMT_UNKNOWN) {
+        const uint32_t width = surfaceWidth();
+        const uint32_t height = surfaceHeight();
 
+        // The window size decides whether frames are resampled, and
+        // with that the swap chain size.
         UpdateDestinationRect();
+
+        if (!mSwapChain || width != surfaceWidth() || height != surfaceHeight()) {
+            if (!createSwapChains()) {
+                return false;
+            }
+        }
     }
 
     return true;
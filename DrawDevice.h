@@ -14,12 +14,23 @@
 
 #pragma once
 
+#include <memory>
 #include <vector>
 
 #include <d3d9.h>
 #include <mfapi.h>
 
-class FormatConvertor;
+#include "FormatConvertor.h"
+#include "FrameArena.h"
+#include "FramePlan.h"
+#include "SessionConfig.h"
+
+class FrameStage;
+struct FrameStats;
+class Resampler;
+class TemporalDenoiser;
+class VideoBufferLock;
+class WorkerPool;
 
 class DrawDevice
 {
@@ -28,19 +39,82 @@ public:
     ~DrawDevice();
 
     bool createDevice(HWND hwnd);
+    bool createHeadless();
     bool resetDevice();
     void DestroyDevice();
     bool setVideoType(IMFMediaType* pType);
-    bool DrawFrame(IMFMediaBuffer* pBuffer);
+    // Results of the stages go to stats, if given. Stages take their
+    // scratch memory from arena, normally the frame's own; without one
+    // they share an arena of the device. In headless mode the frame is
+    // converted into pOutput, if given, which must hold
+    // headlessStride() * headlessHeight() bytes.
+    bool DrawFrame(IMFMediaBuffer* pBuffer, FrameStats* stats = nullptr, FrameArena* arena = nullptr,
+        IMFMediaBuffer* pOutput = nullptr);
 
     bool isFormatSupported(REFGUID subtype) const;
-    std::vector<GUID> getSupportedFormats() const;
+    const std::vector<GUID>& getSupportedFormats() const;
+
+    // Converter to RGB32 for a supported subtype, or nullptr.
+    static const FormatConvertor* findConversionFunction(REFGUID subtype);
+
+    // Decisions for the current video type.
+    const FramePlan& plan() const { return mPlan; }
+
+    // Rotation and mirroring applied during conversion. Takes effect
+    // with the next setVideoType.
+    void setOrientation(const Orientation& orientation) { mOrientation = orientation; }
+    const Orientation& orientation() const { return mOrientation; }
+
+    // Frames larger than the window are shrunk on the CPU with this
+    // filter instead of by StretchRect. The pool, if any, runs the
+    // resampler bands in parallel. Takes effect with the next
+    // setVideoType or resetDevice.
+    void setScaler(PreviewScaler scaler, WorkerPool* pool = nullptr);
+
+    // Size of the converted frame, after rotation.
+    uint32_t outputWidth() const { return mPlan.outputWidth; }
+    uint32_t outputHeight() const { return mPlan.outputHeight; }
+
+    // Run on every converted frame before it is presented.
+    void addStage(std::shared_ptr<FrameStage> stage);
+    void removeStage(const std::shared_ptr<FrameStage>& stage);
+
+    // Headless mode converts into system memory instead of presenting:
+    // into the output buffer given to DrawFrame, or else into a frame
+    // of its own.
+    bool isHeadless() const { return mHeadless; }
+    uint32_t headlessWidth() const { return mPlan.headlessWidth; }
+    uint32_t headlessHeight() const { return mPlan.headlessHeight; }
+    uint32_t headlessStride() const { return mPlan.headlessWidth * 4; }
+
+    // Headless frames of sources with non-square pixels are rescaled
+    // to square pixels while they are converted, so that recording,
+    // streaming and analysis see the true shape. The preview window
+    // corrects the shape in its destination rectangle instead. Takes
+    // effect with the next setVideoType.
+    void setSquarePixels(bool enabled) { mSquarePixels = enabled; }
+
+    // Temporal noise reduction on the source planes, before conversion.
+    // DrawFrame filters the buffer in place, also when the preview is
+    // not drawn, so whoever reads it afterwards sees the filtered
+    // frame. Strength 0 turns it off. The bands run on the pool given
+    // to setScaler. Takes effect with the next setVideoType.
+    void setDenoise(uint32_t strength, uint32_t motionThreshold);
 
 private:
     bool TestCooperativeLevel();
-    const FormatConvertor *findConversionFunction(REFGUID subtype) const;
     bool createSwapChains();
+    bool drawHeadless(IMFMediaBuffer* pBuffer, FrameStats* stats, FrameArena* arena, IMFMediaBuffer* pOutput);
+    bool convertHeadless(IMFMediaBuffer* pBuffer, uint8_t* destination, FrameStats* stats, FrameArena* arena);
+    bool denoise(IMFMediaBuffer* pBuffer);
+    FramePlanes sourcePlanes(const VideoBufferLock& buffer, const uint8_t* scanLine) const;
+    void runStages(uint8_t* frame, uint32_t stride, uint32_t width, uint32_t height, FrameStats* stats,
+        FrameArena* arena);
+    void updateHeadlessFrame();
     void UpdateDestinationRect();
+    void updateResampler();
+    uint32_t surfaceWidth() const;
+    uint32_t surfaceHeight() const;
 
     HWND mWindow = nullptr;
     IDirect3D9 *mD3D = nullptr;
@@ -48,11 +122,20 @@ private:
     IDirect3DSwapChain9 *mSwapChain = nullptr;
     D3DPRESENT_PARAMETERS mD3Params;
     D3DFORMAT mFormat = D3DFMT_UNKNOWN;
-    uint32_t mWidth = 0;
-    uint32_t mHeight = 0;
-    LONG mDefaultStride = 0;
-    MFRatio mAspect = {1, 1};
-    MFVideoInterlaceMode mInterlaceMode = MFVideoInterlace_Unknown;
+    FramePlan mPlan;
+    FramePlanCache mPlans;
     RECT mDestRect = {};
-    const FormatConvertor* mRGB32Converter = nullptr;
+    Orientation mOrientation;
+    PreviewScaler mScaler = PreviewScaler::Linear;
+    WorkerPool* mScalerPool = nullptr;
+    std::unique_ptr<Resampler> mResampler;
+    std::vector<uint8_t> mScaleFrame;   // Full-size frame the resampler reads.
+    bool mSquarePixels = false;
+    uint32_t mDenoiseStrength = 0;
+    uint32_t mDenoiseThreshold = 0;
+    std::unique_ptr<TemporalDenoiser> mDenoiser;
+    bool mHeadless = false;
+    std::vector<uint8_t> mHeadlessFrame;     // For frames drawn without an output.
+    std::vector<std::shared_ptr<FrameStage>> mStages;
+    FrameArena mStageArena;             // For frames drawn without an arena.
 };
@@ -0,0 +1,239 @@
+#include "FileReplaySource.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "SafeRelease.h"
+#include "Debug.h"
+
+namespace {
+    const size_t FRAME_POOL_SIZE = 8;
+    const size_t FRAME_ARENA_SIZE = 512 * 1024;
+    const std::chrono::milliseconds CONSUMER_WAIT(100);
+    const LONGLONG DEFAULT_FRAME_DURATION = 10'000'000 / 30;
+
+    bool hasExtension(const std::wstring& path, const wchar_t* extension)
+    {
+        const size_t length = wcslen(extension);
+        return path.size() >= length && _wcsicmp(path.c_str() + path.size() - length, extension) == 0;
+    }
+}
+
+FileReplaySource::FileReplaySource(const std::wstring& path, bool realTime, bool loop) :
+    mPath(path), mRealTime(realTime), mLoop(loop),
+    mFramePool(std::make_shared<FramePool>(FRAME_POOL_SIZE, FRAME_ARENA_SIZE))
+{
+}
+
+FileReplaySource::~FileReplaySource()
+{
+    stop();
+    closeStreams();
+}
+
+bool FileReplaySource::start()
+{
+    if (mRunning) {
+        return true;
+    }
+
+    if (!open() || !mFramePool->allocate(mFrameSize)) {
+        return false;
+    }
+
+    mDiscard.resize(mFrameSize);
+    mFinished = false;
+    mRunning = true;
+    mThread = std::thread(&FileReplaySource::run, this);
+
+    return true;
+}
+
+void FileReplaySource::stop()
+{
+    mRunning = false;
+
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+//-------------------------------------------------------------------
+// Open
+//
+// Y4M files are told apart by their extension; everything else is
+// taken for a recorded segment. A segment is replayed at its recorded
+// timestamps, a Y4M file at the frame rate of its header.
+//-------------------------------------------------------------------
+
+bool FileReplaySource::open()
+{
+    mIsY4m = hasExtension(mPath, L".y4m");
+
+    if (mIsY4m) {
+        if (!mY4m.open(mPath)) {
+            return false;
+        }
+
+        const Y4m::StreamHeader& header = mY4m.header();
+        mSubtype = mY4m.subtype();
+        mWidth = header.width;
+        mHeight = header.height;
+        mFrameSize = DWORD(mY4m.frameBytes());
+        mFrameDuration = std::max<LONGLONG>(LONGLONG(header.rateDenominator) * 10'000'000 / header.rateNumerator, 1);
+    }
+    else {
+        if (!mRecording.open(mPath)) {
+            return false;
+        }
+
+        const RecordingFileHeader& header = mRecording.header();
+        const size_t count = mRecording.frameCount();
+
+        mSubtype = header.subtype;
+        mWidth = header.width;
+        mHeight = header.height;
+        mFrameSize = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            mFrameSize = std::max(mFrameSize, DWORD(mRecording.entry(i).size));
+        }
+
+        mFrameDuration = count > 1 ?
+            std::max<LONGLONG>((mRecording.entry(count - 1).timestamp - mRecording.entry(0).timestamp) / LONGLONG(count - 1), 1) :
+            DEFAULT_FRAME_DURATION;
+    }
+
+    mNext = 0;
+    mTimeOffset = 0;
+    mLastTimestamp = 0;
+
+    return mFrameSize > 0;
+}
+
+void FileReplaySource::run()
+{
+    const auto started = std::chrono::steady_clock::now();
+    uint64_t sequence = 0;
+
+    while (mRunning) {
+        if (!mRealTime && !waitForConsumers(CONSUMER_WAIT)) {
+            continue;
+        }
+
+        Frame frame = mFramePool->acquire();
+
+        IMFMediaBuffer* buffer = nullptr;
+        uint8_t* data = nullptr;
+        if (frame && SUCCEEDED(frame.sample()->GetBufferByIndex(0, &buffer)) &&
+            FAILED(buffer->Lock(&data, nullptr, nullptr))) {
+            data = nullptr;
+        }
+
+        // A frame without a slot is still read, so playback keeps its
+        // place in the file.
+        DWORD size = 0;
+        FrameInfo info;
+        const bool read = nextFrame(data ? data : mDiscard.data(), size, info);
+
+        if (data) {
+            (void)buffer->Unlock();
+            (void)buffer->SetCurrentLength(size);
+        }
+        SafeRelease(&buffer);
+
+        if (!read) {
+            if (mLoop && rewind()) {
+                continue;
+            }
+
+            Info("FileReplaySource: end of %S\n", mPath.c_str());
+            mFinished = true;
+            break;
+        }
+
+        if (mRealTime) {
+            std::this_thread::sleep_until(started + std::chrono::nanoseconds(info.timestamp * 100));
+        }
+
+        // Dropped frames still take a sequence number, so consumers see the gap.
+        const uint64_t frameSequence = sequence++;
+
+        if (!data) {
+            countDroppedFrame();
+            continue;
+        }
+
+        LARGE_INTEGER now = {};
+        QueryPerformanceCounter(&now);
+
+        info.sequence = frameSequence;
+        info.captureTime = now.QuadPart;
+        info.sourceId = sourceId();
+        info.subtype = mSubtype;
+        info.width = mWidth;
+        info.height = mHeight;
+        frame.setInfo(info);
+
+        (void)frame.sample()->SetSampleTime(info.timestamp);
+        (void)frame.sample()->SetSampleDuration(mFrameDuration);
+
+        publish(frame);
+    }
+}
+
+//-------------------------------------------------------------------
+// NextFrame
+//
+// Reads the next frame of the current pass into data, with its
+// timestamp relative to the start of playback. A damaged frame ends
+// the pass like the end of the file does.
+//-------------------------------------------------------------------
+
+bool FileReplaySource::nextFrame(uint8_t* data, DWORD& size, FrameMetadata& metadata)
+{
+    if (mIsY4m) {
+        if (!mY4m.readFrame(data)) {
+            return false;
+        }
+
+        size = mFrameSize;
+        metadata = FrameMetadata();
+        metadata.timestamp = LONGLONG(mNext++) * mFrameDuration;
+    }
+    else {
+        if (mNext >= mRecording.frameCount()) {
+            return false;
+        }
+
+        const uint8_t* payload = mRecording.frameData(mNext);
+        const RecordingIndexEntry& entry = mRecording.entry(mNext++);
+        if (!payload || entry.size > mFrameSize) {
+            return false;
+        }
+
+        memcpy(data, payload, entry.size);
+        size = entry.size;
+        metadata = mRecording.metadata(mNext - 1);
+        metadata.timestamp = entry.timestamp - mRecording.entry(0).timestamp;
+    }
+
+    metadata.timestamp += mTimeOffset;
+    mLastTimestamp = metadata.timestamp;
+
+    return true;
+}
+
+// The next pass starts one frame after the last frame of this one.
+bool FileReplaySource::rewind()
+{
+    if (mNext == 0 || (mIsY4m && !mY4m.rewind())) {
+        return false;
+    }
+
+    mTimeOffset = mLastTimestamp + mFrameDuration;
+    mNext = 0;
+
+    return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mfapi.h>
+
+#include "FramePool.h"
+#include "FrameSource.h"
+#include "RecordingReader.h"
+#include "Y4m.h"
+
+//-------------------------------------------------------------------
+// FileReplaySource
+//
+// Plays back a recorded segment (.mfcr) or a YUV4MPEG2 file (.y4m) as
+// a frame source, so that material captured elsewhere, or produced by
+// ffmpeg, runs through the same pipeline as a camera.
+//
+// In real-time mode frames are paced by their timestamps; otherwise
+// a new frame is produced as soon as every subscriber has room for it.
+// With loop set, playback starts over at the end of the file and the
+// timestamps keep counting up. Frames of a segment keep the metadata
+// they were recorded with, apart from sequence, capture time and
+// source.
+//-------------------------------------------------------------------
+
+class FileReplaySource : public FrameSource
+{
+public:
+    FileReplaySource(const std::wstring& path, bool realTime = true, bool loop = false);
+    ~FileReplaySource();
+
+    bool start();
+    void stop();
+
+    // True once a file without loop has been played to the end.
+    bool finished() const { return mFinished.load(std::memory_order_relaxed); }
+
+    uint32_t width() const { return mWidth; }
+    uint32_t height() const { return mHeight; }
+    const GUID& subtype() const { return mSubtype; }
+
+    FrameArena::Stats arenaStats() const override { return mFramePool->arenaStats(); }
+
+private:
+    bool open();
+    void run();
+    bool nextFrame(uint8_t* data, DWORD& size, FrameMetadata& metadata);
+    bool rewind();
+
+    std::wstring mPath;
+    bool mRealTime = true;
+    bool mLoop = false;
+
+    RecordingReader mRecording;
+    Y4mReader mY4m;
+    bool mIsY4m = false;
+
+    GUID mSubtype = GUID_NULL;
+    uint32_t mWidth = 0;
+    uint32_t mHeight = 0;
+    DWORD mFrameSize = 0;
+    LONGLONG mFrameDuration = 0;    // 100ns units.
+    LONGLONG mTimeOffset = 0;       // Start of the current pass.
+    LONGLONG mLastTimestamp = 0;
+    size_t mNext = 0;               // Next frame of the current pass.
+    std::vector<uint8_t> mDiscard;  // Frames read while every slot is taken.
+
+    std::shared_ptr<FramePool> mFramePool;
+    std::atomic<bool> mRunning = false;
+    std::atomic<bool> mFinished = false;
+    std::thread mThread;
+};
@@ -2,6 +2,10 @@
 
 #include <mfapi.h>
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "Simd.h"
 
 #define D3DCOLOR_ARGB(a,r,g,b) \
     ((uint32_t)((((a)&0xff)<<24)|(((r)&0xff)<<16)|(((g)&0xff)<<8)|((b)&0xff)))
@@ -38,23 +42,297 @@ namespace {
 
         return rgbq;
     }
+
+    FramePlanes PackedPlanes(const uint8_t* buffer, int32_t stride, uint32_t width, uint32_t height,
+        uint32_t bytesPerPixel)
+    {
+        FramePlanes frame;
+        frame.width = width;
+        frame.height = height;
+        frame.count = 1;
+        frame.planes[0] = { buffer, stride, width, height, bytesPerPixel };
+
+        return frame;
+    }
+
+    // Start of the region at (x, y) in the first plane.
+    const uint8_t* PackedRegion(const FramePlanes& source, uint32_t x, uint32_t y, uint32_t bytesPerPixel)
+    {
+        const FramePlane& plane = source.planes[0];
+        return plane.data + ptrdiff_t(y) * plane.stride + ptrdiff_t(x) * bytesPerPixel;
+    }
 }
 
-bool FormatConvertorRGB24::convert(uint8_t* destination, uint32_t destStride, const uint8_t* source, uint32_t srcStride, uint32_t width, uint32_t height) const
+FramePlanes FramePlanes::crop(uint32_t x, uint32_t y, uint32_t cropWidth, uint32_t cropHeight) const
 {
-    for (uint32_t y = 0; y < height; y++)
+    FramePlanes cropped = *this;
+    cropped.width = cropWidth;
+    cropped.height = cropHeight;
+
+    for (uint32_t i = 0; i < count; i++) {
+        FramePlane& plane = cropped.planes[i];
+
+        plane.data += ptrdiff_t(y >> plane.shiftY) * plane.stride + ptrdiff_t(x >> plane.shiftX) * plane.sampleBytes;
+        plane.width = cropWidth >> plane.shiftX;
+        plane.height = cropHeight >> plane.shiftY;
+    }
+
+    return cropped;
+}
+
+//-------------------------------------------------------------------
+// Convert with orientation
+//
+// Each 32x32 tile is converted into a buffer on the stack and then
+// copied to its reoriented place in the destination. Source pixel
+// (x, y) lands at destination byte offset
+//
+//     origin + x * stepX + y * stepY
+//
+// The copy walks the tile so that the destination is written
+// sequentially; the transposed reads stay within the 4 KB tile.
+//-------------------------------------------------------------------
+
+namespace {
+    const uint32_t ORIENTATION_TILE = 32;
+}
+
+bool FormatConvertor::convert(uint8_t* destination, uint32_t destStride, const uint8_t* source,
+    int32_t srcStride, uint32_t width, uint32_t height, const Orientation& orientation) const
+{
+    return convert(destination, destStride, planes(source, srcStride, width, height, 0), orientation);
+}
+
+bool FormatConvertor::convert(uint8_t* destination, uint32_t destStride, const FramePlanes& source,
+    const Orientation& orientation) const
+{
+    const uint32_t width = source.width;
+    const uint32_t height = source.height;
+
+    if (orientation.isIdentity()) {
+        return convertRegion(destination, destStride, source, 0, 0, width, height);
+    }
+
+    // Mapping of the flipped source onto the destination, in pixels:
+    // dx = ax * x + ay * y + cx, dy = bx * x + by * y + cy.
+    const int64_t w = width;
+    const int64_t h = height;
+    const int64_t fx = orientation.flipHorizontal ? -1 : 1;
+    const int64_t fy = orientation.flipVertical ? -1 : 1;
+    const int64_t ox = orientation.flipHorizontal ? w - 1 : 0;
+    const int64_t oy = orientation.flipVertical ? h - 1 : 0;
+
+    int64_t ax = 0, ay = 0, cx = 0, bx = 0, by = 0, cy = 0;
+
+    switch (orientation.rotation) {
+    case Orientation::Rotation::None:       // (x, y)
+        ax = fx; cx = ox;
+        by = fy; cy = oy;
+        break;
+    case Orientation::Rotation::Rotate90:   // (h - 1 - y, x)
+        ay = -fy; cx = h - 1 - oy;
+        bx = fx; cy = ox;
+        break;
+    case Orientation::Rotation::Rotate180:  // (w - 1 - x, h - 1 - y)
+        ax = -fx; cx = w - 1 - ox;
+        by = -fy; cy = h - 1 - oy;
+        break;
+    case Orientation::Rotation::Rotate270:  // (y, w - 1 - x)
+        ay = fy; cx = oy;
+        bx = -fx; cy = w - 1 - ox;
+        break;
+    }
+
+    const int64_t stride = destStride;
+    const int64_t stepX = ax * 4 + bx * stride;
+    const int64_t stepY = ay * 4 + by * stride;
+
+    // Rows of the tile map to destination rows unless the frame is
+    // rotated by 90 or 270 degrees.
+    const bool rowsAreRows = ay == 0;
+
+    alignas(16) uint32_t tile[ORIENTATION_TILE * ORIENTATION_TILE];
+
+    for (uint32_t ty = 0; ty < height; ty += ORIENTATION_TILE) {
+        const uint32_t th = std::min(ORIENTATION_TILE, height - ty);
+
+        for (uint32_t tx = 0; tx < width; tx += ORIENTATION_TILE) {
+            const uint32_t tw = std::min(ORIENTATION_TILE, width - tx);
+
+            if (!convertRegion((uint8_t*)tile, ORIENTATION_TILE * 4, source, tx, ty, tw, th)) {
+                return false;
+            }
+
+            uint8_t* origin = destination + (ax * tx + ay * ty + cx) * 4 + (bx * tx + by * ty + cy) * stride;
+
+            if (rowsAreRows) {
+                for (uint32_t j = 0; j < th; j++) {
+                    const uint32_t* in = tile + j * ORIENTATION_TILE;
+                    uint8_t* out = origin + j * stepY;
+
+                    if (stepX == 4) {
+                        memcpy(out, in, tw * 4);
+                        continue;
+                    }
+
+                    for (uint32_t i = 0; i < tw; i++) {
+                        *(uint32_t*)(out + i * stepX) = in[i];
+                    }
+                }
+            }
+            else {
+                for (uint32_t i = 0; i < tw; i++) {
+                    const uint32_t* in = tile + i;
+                    uint8_t* out = origin + i * stepX;
+
+                    for (uint32_t j = 0; j < th; j++) {
+                        *(uint32_t*)(out + j * stepY) = in[j * ORIENTATION_TILE];
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------
+// RGB24 rows
+//
+// RGB24 pixels are stored B, G, R; RGB32 pixels B, G, R, X. The vector
+// paths handle 16 pixels (48 source bytes) per iteration and leave the
+// remainder of each row to the scalar loop.
+//-------------------------------------------------------------------
+
+namespace {
+    void expandRowScalar(uint32_t* dest, const RgbColor* source, uint32_t begin, uint32_t width)
+    {
+        for (uint32_t x = begin; x < width; x++) {
+            dest[x] = D3DCOLOR_XRGB(source[x].red, source[x].green, source[x].blue);
+        }
+    }
+
+    void packRowScalar(RgbColor* dest, const uint8_t* source, uint32_t begin, uint32_t width)
+    {
+        for (uint32_t x = begin; x < width; x++) {
+            dest[x].blue = source[x * 4];
+            dest[x].green = source[x * 4 + 1];
+            dest[x].red = source[x * 4 + 2];
+        }
+    }
+
+#if MFCAMERA_SIMD_SSSE3
+    uint32_t expandRowSimd(uint8_t* dest, const uint8_t* source, uint32_t width)
+    {
+        // Spreads four 3-byte pixels to 4 bytes; the gap is filled with alpha.
+        const __m128i expand = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16) {
+            const __m128i in0 = _mm_loadu_si128((const __m128i*)(source + x * 3));
+            const __m128i in1 = _mm_loadu_si128((const __m128i*)(source + x * 3 + 16));
+            const __m128i in2 = _mm_loadu_si128((const __m128i*)(source + x * 3 + 32));
+
+            // Source bytes 0, 12, 24 and 36 start pixels 0, 4, 8 and 12.
+            const __m128i p0 = in0;
+            const __m128i p1 = _mm_alignr_epi8(in1, in0, 12);
+            const __m128i p2 = _mm_alignr_epi8(in2, in1, 8);
+            const __m128i p3 = _mm_srli_si128(in2, 4);
+
+            __m128i* out = (__m128i*)(dest + x * 4);
+            _mm_storeu_si128(out, _mm_or_si128(_mm_shuffle_epi8(p0, expand), alpha));
+            _mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(p1, expand), alpha));
+            _mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(p2, expand), alpha));
+            _mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(p3, expand), alpha));
+        }
+
+        return x;
+    }
+
+    uint32_t packRowSimd(uint8_t* dest, const uint8_t* source, uint32_t width)
+    {
+        // Moves the 12 colour bytes of four pixels to the front.
+        const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16) {
+            const __m128i* in = (const __m128i*)(source + x * 4);
+            const __m128i p0 = _mm_shuffle_epi8(_mm_loadu_si128(in), pack);
+            const __m128i p1 = _mm_shuffle_epi8(_mm_loadu_si128(in + 1), pack);
+            const __m128i p2 = _mm_shuffle_epi8(_mm_loadu_si128(in + 2), pack);
+            const __m128i p3 = _mm_shuffle_epi8(_mm_loadu_si128(in + 3), pack);
+
+            __m128i* out = (__m128i*)(dest + x * 3);
+            _mm_storeu_si128(out, _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+            _mm_storeu_si128(out + 1, _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+            _mm_storeu_si128(out + 2, _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+        }
+
+        return x;
+    }
+#elif MFCAMERA_SIMD_NEON
+    uint32_t expandRowSimd(uint8_t* dest, const uint8_t* source, uint32_t width)
     {
-        RgbColor* pSrcPel = (RgbColor*)source;
-        uint32_t* pDestPel = (uint32_t*)destination;
-
-        for (uint32_t x = 0; x < width; x++) {
-            pDestPel[x] = D3DCOLOR_XRGB(
-                pSrcPel[x].red,
-                pSrcPel[x].green,
-                pSrcPel[x].blue
-            );
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16) {
+            const uint8x16x3_t in = vld3q_u8(source + x * 3);
+
+            uint8x16x4_t out;
+            out.val[0] = in.val[0];
+            out.val[1] = in.val[1];
+            out.val[2] = in.val[2];
+            out.val[3] = vdupq_n_u8(0xff);
+            vst4q_u8(dest + x * 4, out);
         }
 
+        return x;
+    }
+
+    uint32_t packRowSimd(uint8_t* dest, const uint8_t* source, uint32_t width)
+    {
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16) {
+            const uint8x16x4_t in = vld4q_u8(source + x * 4);
+
+            uint8x16x3_t out;
+            out.val[0] = in.val[0];
+            out.val[1] = in.val[1];
+            out.val[2] = in.val[2];
+            vst3q_u8(dest + x * 3, out);
+        }
+
+        return x;
+    }
+#else
+    uint32_t expandRowSimd(uint8_t*, const uint8_t*, uint32_t)
+    {
+        return 0;
+    }
+
+    uint32_t packRowSimd(uint8_t*, const uint8_t*, uint32_t)
+    {
+        return 0;
+    }
+#endif
+}
+
+FramePlanes FormatConvertorRGB24::planes(const uint8_t* buffer, int32_t stride, uint32_t width, uint32_t height, size_t /*bufferSize*/) const
+{
+    return PackedPlanes(buffer, stride, width, height, 3);
+}
+
+bool FormatConvertorRGB24::convertRegion(uint8_t* destination, uint32_t destStride, const FramePlanes& frame, uint32_t left, uint32_t top, uint32_t width, uint32_t height) const
+{
+    const bool simd = Simd::enabled();
+    const uint8_t* source = PackedRegion(frame, left, top, 3);
+    const int32_t srcStride = frame.planes[0].stride;
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const uint32_t done = simd ? expandRowSimd(destination, source, width) : 0;
+        expandRowScalar((uint32_t*)destination, (const RgbColor*)source, done, width);
+
         source += srcStride;
         destination += destStride;
     }
@@ -62,13 +340,42 @@ bool FormatConvertorRGB24::convert(uint8_t* destination, uint32_t destStride, co
     return true;
 }
 
-bool FormatConvertorRGB32::convert(uint8_t* destination, uint32_t destStride, const uint8_t* source, uint32_t srcStride, uint32_t width, uint32_t height) const
+bool FormatPackerRGB24::pack(uint8_t* destination, uint32_t destStride, const uint8_t* source, uint32_t srcStride, uint32_t width, uint32_t height) const
 {
-    return MFCopyImage(destination, destStride, source, srcStride, width * 4, height) == 0;
+    const bool simd = Simd::enabled();
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const uint32_t done = simd ? packRowSimd(destination, source, width) : 0;
+        packRowScalar((RgbColor*)destination, source, done, width);
+
+        source += srcStride;
+        destination += destStride;
+    }
+
+    return true;
 }
 
-bool FormatConvertorYUY2::convert(uint8_t* destination, uint32_t destStride, const uint8_t* source, uint32_t srcStride, uint32_t width, uint32_t height) const
+FramePlanes FormatConvertorRGB32::planes(const uint8_t* buffer, int32_t stride, uint32_t width, uint32_t height, size_t /*bufferSize*/) const
 {
+    return PackedPlanes(buffer, stride, width, height, 4);
+}
+
+bool FormatConvertorRGB32::convertRegion(uint8_t* destination, uint32_t destStride, const FramePlanes& source, uint32_t x, uint32_t y, uint32_t width, uint32_t height) const
+{
+    return MFCopyImage(destination, destStride, PackedRegion(source, x, y, 4), source.planes[0].stride, width * 4, height) == 0;
+}
+
+FramePlanes FormatConvertorYUY2::planes(const uint8_t* buffer, int32_t stride, uint32_t width, uint32_t height, size_t /*bufferSize*/) const
+{
+    return PackedPlanes(buffer, stride, width, height, 2);
+}
+
+bool FormatConvertorYUY2::convertRegion(uint8_t* destination, uint32_t destStride, const FramePlanes& frame, uint32_t left, uint32_t top, uint32_t width, uint32_t height) const
+{
+    const uint8_t* source = PackedRegion(frame, left, top, 2);
+    const int32_t srcStride = frame.planes[0].stride;
+
     for (uint32_t y = 0; y < height; y++) {
         RGBQUAD* pDestPel = (RGBQUAD*)destination;
         const uint16_t* pSrcPel = (const uint16_t*)source;
@@ -93,16 +400,59 @@ bool FormatConvertorYUY2::convert(uint8_t* destination, uint32_t destStride, con
     return true;
 }
 
-bool FormatConvertorNV12::convert(uint8_t* destination, uint32_t destStride, const uint8_t* source, uint32_t srcStride, uint32_t width, uint32_t height) const
+//-------------------------------------------------------------------
+// NV12 planes
+//
+// The UV plane follows the rows allocated for Y, which can be more
+// than the frame has. The buffer size tells: 1.5 allocated rows of
+// stride bytes per frame row. Only padding to a multiple of 16 rows is
+// believed, so that a buffer with a few spare bytes at the end is not
+// mistaken for a padded one.
+//-------------------------------------------------------------------
+
+FramePlanes FormatConvertorNV12::planes(const uint8_t* buffer, int32_t stride, uint32_t width, uint32_t height, size_t bufferSize) const
+{
+    uint32_t rows = height;
+
+    if (bufferSize && stride) {
+        const size_t allocated = bufferSize / size_t(std::abs(stride)) * 2 / 3;
+        if (allocated > height && allocated % 16 == 0 && allocated < size_t(height) + 16) {
+            rows = uint32_t(allocated);
+        }
+    }
+
+    FramePlanes frame;
+    frame.width = width;
+    frame.height = height;
+    frame.count = 2;
+    frame.planes[0] = { buffer, stride, width, height, 1 };
+    frame.planes[1] = { buffer + ptrdiff_t(rows) * stride, stride, width / 2, height / 2, 2, 1, 1 };
+
+    return frame;
+}
+
+bool FormatConvertorNV12::convertRegion(uint8_t* destination, uint32_t destStride, const FramePlanes& source, uint32_t x, uint32_t y, uint32_t width, uint32_t height) const
+{
+    const FramePlane& lumaPlane = source.planes[0];
+    const FramePlane& chromaPlane = source.planes[1];
+
+    // Each UV pair covers two pixels, so x is also the byte offset.
+    const uint8_t* luma = lumaPlane.data + ptrdiff_t(y) * lumaPlane.stride + x;
+    const uint8_t* chroma = chromaPlane.data + ptrdiff_t(y / 2) * chromaPlane.stride + x;
+
+    return convertPlanes(destination, destStride, luma, lumaPlane.stride, chroma, chromaPlane.stride, width, height);
+}
+
+bool FormatConvertorNV12::convertPlanes(uint8_t* destination, uint32_t destStride, const uint8_t* luma, int32_t lumaStride, const uint8_t* chroma, int32_t chromaStride, uint32_t width, uint32_t height) const
 {
-    const uint8_t* lpBitsY = source;
-    const uint8_t* lpBitsCb = lpBitsY + (height * srcStride);
+    const uint8_t* lpBitsY = luma;
+    const uint8_t* lpBitsCb = chroma;
     const uint8_t* lpBitsCr = lpBitsCb + 1;
 
     for (uint32_t y = 0; y < height; y += 2)
     {
         const uint8_t* lpLineY1 = lpBitsY;
-        const uint8_t* lpLineY2 = lpBitsY + srcStride;
+        const uint8_t* lpLineY2 = lpBitsY + lumaStride;
         const uint8_t* lpLineCr = lpBitsCr;
         const uint8_t* lpLineCb = lpBitsCb;
 
@@ -152,9 +502,9 @@ bool FormatConvertorNV12::convert(uint8_t* destination, uint32_t destStride, con
         }
 
         destination += (2 * destStride);
-        lpBitsY += (2 * srcStride);
-        lpBitsCr += srcStride;
-        lpBitsCb += srcStride;
+        lpBitsY += (2 * ptrdiff_t(lumaStride));
+        lpBitsCr += chromaStride;
+        lpBitsCb += chromaStride;
     }
 
     return true;
@@ -1,16 +1,95 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 #include <string>
 
+//-------------------------------------------------------------------
+// Orientation
+//
+// Mounting correction applied while converting: the source is flipped
+// first, then rotated clockwise.
+//-------------------------------------------------------------------
+
+struct Orientation
+{
+    enum class Rotation
+    {
+        None, Rotate90, Rotate180, Rotate270
+    };
+
+    Rotation rotation = Rotation::None;
+    bool flipHorizontal = false;
+    bool flipVertical = false;
+
+    bool isIdentity() const { return rotation == Rotation::None && !flipHorizontal && !flipVertical; }
+    bool swapsDimensions() const { return rotation == Rotation::Rotate90 || rotation == Rotation::Rotate270; }
+};
+
+//-------------------------------------------------------------------
+// FramePlanes
+//
+// Where the pixels of a source frame are. Packed formats have one
+// plane; NV12 has the Y plane and then the interleaved UV plane. Every
+// plane has its own pointer and stride, so buffers with padding rows
+// or separately allocated planes are converted in place. Bottom-up
+// frames point at their top row and have a negative stride, so row
+// offsets are signed.
+//-------------------------------------------------------------------
+
+struct FramePlane
+{
+    const uint8_t* data = nullptr;
+    int32_t stride = 0;     // Bytes from one row to the next.
+    uint32_t width = 0;     // Samples per row; a UV pair counts once.
+    uint32_t height = 0;
+    uint32_t sampleBytes = 1;
+    uint32_t shiftX = 0;    // Subsampling: pixel x >> shiftX is the sample.
+    uint32_t shiftY = 0;
+};
+
+struct FramePlanes
+{
+    static constexpr uint32_t MaxPlanes = 2;
+
+    FramePlane planes[MaxPlanes];
+    uint32_t count = 0;
+    uint32_t width = 0;     // Frame size in pixels.
+    uint32_t height = 0;
+
+    // The same frame limited to a rectangle, without copying. x and y
+    // must be even for subsampled formats.
+    FramePlanes crop(uint32_t x, uint32_t y, uint32_t cropWidth, uint32_t cropHeight) const;
+};
+
 class FormatConvertor
 {
 public:
     FormatConvertor() = default;
     virtual ~FormatConvertor() = default;
-    virtual bool convert(uint8_t* destination, uint32_t destStride, const uint8_t* source,
-        uint32_t srcStride, uint32_t width, uint32_t height) const = 0;
+
+    // Lays out a frame stored in one buffer, planes one after the
+    // other. Decoders may allocate more rows than the frame has, e.g.
+    // 1088 for 1080; bufferSize, if known, reveals that padding and
+    // moves the planes that follow the first. Pass 0 if unknown.
+    virtual FramePlanes planes(const uint8_t* buffer, int32_t stride, uint32_t width, uint32_t height,
+        size_t bufferSize) const = 0;
+
+    // Converts the region at (x, y) of the source frame. x, y and the
+    // region size must be even for subsampled formats.
+    virtual bool convertRegion(uint8_t* destination, uint32_t destStride, const FramePlanes& source,
+        uint32_t x, uint32_t y, uint32_t width, uint32_t height) const = 0;
+
+    // Converts and reorients in one pass. The destination is height x
+    // width for 90 and 270 degree rotations. The frame is converted in
+    // small tiles that are written out rotated while still in cache.
+    bool convert(uint8_t* destination, uint32_t destStride, const FramePlanes& source,
+        const Orientation& orientation = {}) const;
+
+    // Same for a frame without padding rows.
+    bool convert(uint8_t* destination, uint32_t destStride, const uint8_t* source,
+        int32_t srcStride, uint32_t width, uint32_t height, const Orientation& orientation = {}) const;
 
     virtual std::string type() const = 0;
 };
@@ -18,8 +97,11 @@ public:
 class FormatConvertorRGB24 : public FormatConvertor
 {
 public:
-    bool convert(uint8_t* destination, uint32_t destStride, const uint8_t* source,
-        uint32_t srcStride, uint32_t width, uint32_t height) const override;
+    FramePlanes planes(const uint8_t* buffer, int32_t stride, uint32_t width, uint32_t height,
+        size_t bufferSize) const override;
+
+    bool convertRegion(uint8_t* destination, uint32_t destStride, const FramePlanes& source,
+        uint32_t x, uint32_t y, uint32_t width, uint32_t height) const override;
 
     std::string type() const override { return "RGB24"; }
 };
@@ -27,8 +109,11 @@ public:
 class FormatConvertorRGB32 : public FormatConvertor
 {
 public:
-    bool convert(uint8_t* destination, uint32_t destStride, const uint8_t* source,
-        uint32_t srcStride, uint32_t width, uint32_t height) const override;
+    FramePlanes planes(const uint8_t* buffer, int32_t stride, uint32_t width, uint32_t height,
+        size_t bufferSize) const override;
+
+    bool convertRegion(uint8_t* destination, uint32_t destStride, const FramePlanes& source,
+        uint32_t x, uint32_t y, uint32_t width, uint32_t height) const override;
 
     std::string type() const override { return "RGB32"; }
 };
@@ -36,8 +121,11 @@ public:
 class FormatConvertorYUY2 : public FormatConvertor
 {
 public:
-    bool convert(uint8_t* destination, uint32_t destStride, const uint8_t* source,
-        uint32_t srcStride, uint32_t width, uint32_t height) const override;
+    FramePlanes planes(const uint8_t* buffer, int32_t stride, uint32_t width, uint32_t height,
+        size_t bufferSize) const override;
+
+    bool convertRegion(uint8_t* destination, uint32_t destStride, const FramePlanes& source,
+        uint32_t x, uint32_t y, uint32_t width, uint32_t height) const override;
 
     std::string type() const override { return "YUY2"; }
 };
@@ -45,8 +133,29 @@ public:
 class FormatConvertorNV12 : public FormatConvertor
 {
 public:
-    bool convert(uint8_t* destination, uint32_t destStride, const uint8_t* source,
-        uint32_t srcStride, uint32_t width, uint32_t height) const override;
+    FramePlanes planes(const uint8_t* buffer, int32_t stride, uint32_t width, uint32_t height,
+        size_t bufferSize) const override;
+
+    bool convertRegion(uint8_t* destination, uint32_t destStride, const FramePlanes& source,
+        uint32_t x, uint32_t y, uint32_t width, uint32_t height) const override;
 
     std::string type() const override { return "NV12"; }
+
+private:
+    bool convertPlanes(uint8_t* destination, uint32_t destStride, const uint8_t* luma, int32_t lumaStride,
+        const uint8_t* chroma, int32_t chromaStride, uint32_t width, uint32_t height) const;
+};
+
+//-------------------------------------------------------------------
+// FormatPackerRGB24
+//
+// The inverse of FormatConvertorRGB24: packs RGB32 frames into RGB24
+// for recording. The X byte is dropped.
+//-------------------------------------------------------------------
+
+class FormatPackerRGB24
+{
+public:
+    bool pack(uint8_t* destination, uint32_t destStride, const uint8_t* source,
+        uint32_t srcStride, uint32_t width, uint32_t height) const;
 };
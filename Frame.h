@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include <mfapi.h>
+#include <mfidl.h>
+
+#include "FrameArena.h"
+#include "FrameMetadata.h"
+
+class FramePool;
+
+// The metadata plus the format, which recordings keep once per file.
+struct FrameInfo : FrameMetadata
+{
+    GUID subtype = GUID_NULL;
+    uint32_t width = 0;
+    uint32_t height = 0;
+};
+
+struct FrameSlot
+{
+    IMFSample* sample = nullptr;
+    FrameInfo info;
+    FrameArena arena;
+    std::atomic<uint32_t> refs = 0;
+    uint32_t index = 0;
+};
+
+//-------------------------------------------------------------------
+// Frame
+//
+// Reference to a pooled frame. Copies share the slot; the slot goes
+// back to its pool when the last copy is released.
+//-------------------------------------------------------------------
+
+class Frame
+{
+public:
+    Frame() = default;
+    Frame(std::shared_ptr<FramePool> pool, FrameSlot* slot);
+    Frame(const Frame& other);
+    Frame(Frame&& other) noexcept;
+    ~Frame();
+
+    Frame& operator=(Frame other) noexcept;
+
+    void reset();
+
+    IMFSample* sample() const { return mSlot ? mSlot->sample : nullptr; }
+    const FrameInfo& info() const { return mSlot->info; }
+
+    // Transient per-frame data. Reset when the frame is recycled.
+    FrameArena& arena() const { return mSlot->arena; }
+
+    // Producers fill in the metadata before the frame is published.
+    void setInfo(const FrameInfo& info) { mSlot->info = info; }
+    void setStats(const FrameStats& stats) { mSlot->info.stats = stats; }
+
+    explicit operator bool() const { return mSlot != nullptr; }
+
+private:
+    std::shared_ptr<FramePool> mPool;
+    FrameSlot* mSlot = nullptr;
+};
@@ -0,0 +1,57 @@
+#include "FrameArena.h"
+
+#include <new>
+
+bool FrameArena::reserve(size_t capacity)
+{
+    mMemory.reset(new (std::nothrow) uint8_t[capacity]);
+    mCapacity = mMemory ? capacity : 0;
+    mOffset = 0;
+
+    return mMemory != nullptr || capacity == 0;
+}
+
+void* FrameArena::allocate(size_t size, size_t alignment)
+{
+    if (!mMemory) {
+        mOverflows.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    const uintptr_t base = uintptr_t(mMemory.get());
+    size_t current = mOffset.load(std::memory_order_relaxed);
+    size_t offset = 0;
+    size_t end = 0;
+
+    do {
+        const uintptr_t aligned = (base + current + alignment - 1) & ~uintptr_t(alignment - 1);
+        offset = size_t(aligned - base);
+
+        if (offset > mCapacity || size > mCapacity - offset) {
+            mOverflows.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        end = offset + size;
+    } while (!mOffset.compare_exchange_weak(current, end, std::memory_order_relaxed));
+
+    mAllocations.fetch_add(1, std::memory_order_relaxed);
+    mBytes.fetch_add(size, std::memory_order_relaxed);
+
+    size_t peak = mPeak.load(std::memory_order_relaxed);
+    while (end > peak && !mPeak.compare_exchange_weak(peak, end, std::memory_order_relaxed)) {
+    }
+
+    return mMemory.get() + offset;
+}
+
+FrameArena::Stats FrameArena::stats() const
+{
+    Stats stats;
+    stats.allocations = mAllocations.load(std::memory_order_relaxed);
+    stats.bytes = mBytes.load(std::memory_order_relaxed);
+    stats.overflows = mOverflows.load(std::memory_order_relaxed);
+    stats.peak = mPeak.load(std::memory_order_relaxed);
+
+    return stats;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+//-------------------------------------------------------------------
+// FrameArena
+//
+// Monotonic allocator for data that lives as long as one frame:
+// analysis results, histograms, scaled copies, metadata. Memory is
+// reserved once and handed out by bumping an offset; reset() makes
+// all of it available again when the frame goes back to its pool.
+// Allocation never falls back to the heap; running out of space
+// returns nullptr and is counted as an overflow.
+//
+// A published frame is shared by every subscriber, so allocate() may
+// be called from several threads at once; the offset is claimed with
+// a compare-exchange. reserve() and reset() are only called while the
+// slot is not in use.
+//-------------------------------------------------------------------
+
+class FrameArena
+{
+public:
+    struct Stats
+    {
+        uint64_t allocations = 0;
+        uint64_t bytes = 0;
+        uint64_t overflows = 0;
+        size_t peak = 0;
+    };
+
+    FrameArena() = default;
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    bool reserve(size_t capacity);
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    // Objects are never destroyed, only forgotten on reset.
+    template <class T>
+    T* allocate(size_t count = 1)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are not destroyed");
+
+        void* memory = allocate(sizeof(T) * count, alignof(T));
+        if (!memory) {
+            return nullptr;
+        }
+
+        T* objects = static_cast<T*>(memory);
+        for (size_t i = 0; i < count; i++) {
+            new (&objects[i]) T();
+        }
+
+        return objects;
+    }
+
+    void reset() { mOffset.store(0, std::memory_order_relaxed); }
+
+    size_t capacity() const { return mCapacity; }
+    size_t used() const { return mOffset.load(std::memory_order_relaxed); }
+    Stats stats() const;
+
+private:
+    std::unique_ptr<uint8_t[]> mMemory;
+    size_t mCapacity = 0;
+    std::atomic<size_t> mOffset = 0;
+
+    // Read from other threads while the frame is in use.
+    std::atomic<uint64_t> mAllocations = 0;
+    std::atomic<uint64_t> mBytes = 0;
+    std::atomic<uint64_t> mOverflows = 0;
+    std::atomic<size_t> mPeak = 0;
+};
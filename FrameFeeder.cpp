@@ -0,0 +1,77 @@
+#include "FrameFeeder.h"
+
+#include "FrameSource.h"
+#include "FrameStream.h"
+#include "SafeRelease.h"
+
+namespace {
+    const std::chrono::milliseconds FEED_TIMEOUT(100);
+}
+
+FrameFeeder::Bytes::Bytes(const Frame& frame)
+{
+    IMFSample* sample = frame.sample();
+
+    // Single-buffer samples, which is what cameras deliver, come back
+    // as is rather than copied.
+    if (!sample || FAILED(sample->ConvertToContiguousBuffer(&mBuffer))) {
+        return;
+    }
+
+    if (FAILED(mBuffer->Lock(&mData, nullptr, &mLength))) {
+        mData = nullptr;
+        mLength = 0;
+    }
+}
+
+FrameFeeder::Bytes::~Bytes()
+{
+    if (mData) {
+        mBuffer->Unlock();
+    }
+
+    SafeRelease(&mBuffer);
+}
+
+FrameFeeder::FrameFeeder(std::function<void(const Frame&)> consume) : mConsume(std::move(consume))
+{
+}
+
+FrameFeeder::~FrameFeeder()
+{
+    stop();
+}
+
+bool FrameFeeder::start(FrameSource& source, size_t capacity)
+{
+    if (mThread.joinable()) {
+        return false;
+    }
+
+    mStream = source.subscribe(capacity);
+    mThread = std::thread([this, stream = mStream] {
+        run(stream);
+    });
+
+    return true;
+}
+
+void FrameFeeder::stop()
+{
+    if (!mThread.joinable()) {
+        return;
+    }
+
+    mStream->close();
+    mThread.join();
+    mStream.reset();
+}
+
+void FrameFeeder::run(std::shared_ptr<FrameStream> stream)
+{
+    while (!stream->isClosed()) {
+        if (std::optional<Frame> frame = stream->pop(FEED_TIMEOUT)) {
+            mConsume(*frame);
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "Frame.h"
+
+class FrameSource;
+class FrameStream;
+
+//-------------------------------------------------------------------
+// FrameFeeder
+//
+// Feeds the frames of a source to a consumer on a thread of its own,
+// through a subscriber stream, so the capture thread never waits for
+// the consumer. Used by the sinks that copy frames out: the segment
+// recorder and the pre-event buffer.
+//-------------------------------------------------------------------
+
+class FrameFeeder
+{
+public:
+    // The payload of a frame, locked as one contiguous buffer for as
+    // long as the object lives.
+    class Bytes
+    {
+    public:
+        explicit Bytes(const Frame& frame);
+        ~Bytes();
+
+        Bytes(const Bytes&) = delete;
+        Bytes& operator=(const Bytes&) = delete;
+
+        const uint8_t* data() const { return mData; }
+        DWORD length() const { return mLength; }
+
+        explicit operator bool() const { return mData != nullptr; }
+
+    private:
+        IMFMediaBuffer* mBuffer = nullptr;
+        BYTE* mData = nullptr;
+        DWORD mLength = 0;
+    };
+
+    explicit FrameFeeder(std::function<void(const Frame&)> consume);
+    ~FrameFeeder();
+
+    FrameFeeder(const FrameFeeder&) = delete;
+    FrameFeeder& operator=(const FrameFeeder&) = delete;
+
+    // Subscribes with a queue of capacity frames. False if already
+    // feeding.
+    bool start(FrameSource& source, size_t capacity);
+
+    // Closes the stream and waits for the consumer to return.
+    void stop();
+
+    bool isRunning() const { return mThread.joinable(); }
+
+private:
+    void run(std::shared_ptr<FrameStream> stream);
+
+    std::function<void(const Frame&)> mConsume;
+    std::shared_ptr<FrameStream> mStream;
+    std::thread mThread;
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+//-------------------------------------------------------------------
+// FrameMetadata
+//
+// What is known about a frame besides its pixels. It lives in the
+// frame's pool slot, so every subscriber queue and sink sees it with
+// the frame, and it is written into recordings as is. It is plain
+// data of a fixed layout: copying it never allocates, and another
+// process can read it without knowing this one.
+//-------------------------------------------------------------------
+
+// FrameStats::valid bits.
+const uint32_t FRAME_STATS_MOTION = 0x1;
+const uint32_t FRAME_STATS_LUMA = 0x2;
+
+// Filled in by the analysis stages before the frame is published.
+struct FrameStats
+{
+    uint32_t valid = 0;         // FRAME_STATS_* of the fields that are set.
+    uint16_t motion = 0;        // Per mille of the picture that changed.
+    uint8_t meanLuma = 0;
+    uint8_t reserved = 0;
+};
+
+struct FrameMetadata
+{
+    uint64_t sequence = 0;
+    int64_t timestamp = 0;      // Sample time, 100ns units.
+    int64_t captureTime = 0;    // QueryPerformanceCounter ticks at arrival.
+    int64_t deviceTime = 0;     // Device clock at capture, 100ns units; 0 if unknown.
+    int64_t exposure = 0;       // Exposure time, 100ns units; 0 if unknown.
+    uint32_t sourceId = 0;      // FrameSource::sourceId() of the producer.
+    uint32_t streamFlags = 0;
+    FrameStats stats;
+};
+
+static_assert(std::is_trivially_copyable_v<FrameMetadata> && sizeof(FrameMetadata) == 56,
+    "FrameMetadata is stored and exchanged as raw bytes");
@@ -0,0 +1,230 @@
+#include "FramePlan.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "Resampler.h"
+
+namespace {
+
+    //-----------------------------------------------------------------------------
+    // GetDefaultStride
+    //
+    // Gets the default stride for a video frame, assuming no extra padding bytes.
+    //
+    //-----------------------------------------------------------------------------
+
+    HRESULT GetDefaultStride(IMFMediaType* pType, LONG* plStride)
+    {
+        LONG lStride = 0;
+
+        // Try to get the default stride from the media type.
+        HRESULT hr = pType->GetUINT32(MF_MT_DEFAULT_STRIDE, (UINT32*)&lStride);
+        if (FAILED(hr))
+        {
+            // Attribute not set. Try to calculate the default stride.
+            GUID subtype = GUID_NULL;
+
+            UINT32 width = 0;
+            UINT32 height = 0;
+
+            // Get the subtype and the image size.
+            hr = pType->GetGUID(MF_MT_SUBTYPE, &subtype);
+            if (SUCCEEDED(hr))
+            {
+                hr = MFGetAttributeSize(pType, MF_MT_FRAME_SIZE, &width, &height);
+            }
+            if (SUCCEEDED(hr))
+            {
+                hr = MFGetStrideForBitmapInfoHeader(subtype.Data1, width, &lStride);
+            }
+
+            // Set the attribute for later reference.
+            if (SUCCEEDED(hr))
+            {
+                (void)pType->SetUINT32(MF_MT_DEFAULT_STRIDE, UINT32(lStride));
+            }
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            *plStride = lStride;
+        }
+        return hr;
+    }
+
+    //-------------------------------------------------------------------
+    // GetVideoDisplayArea
+    //
+    // The visible part of the frame: the pan/scan aperture if pan/scan
+    // is on, else the minimum display aperture, else the geometric
+    // aperture, else the whole frame. Decoders that pad 1080 lines to
+    // 1088 describe the 1080 visible ones this way.
+    //-------------------------------------------------------------------
+
+    RECT GetVideoDisplayArea(IMFMediaType* pType, uint32_t width, uint32_t height)
+    {
+        MFVideoArea area = {};
+        HRESULT hr = E_FAIL;
+
+        if (MFGetAttributeUINT32(pType, MF_MT_PAN_SCAN_ENABLED, FALSE)) {
+            hr = pType->GetBlob(MF_MT_PAN_SCAN_APERTURE, (UINT8*)&area, sizeof(area), nullptr);
+        }
+
+        if (FAILED(hr)) {
+            hr = pType->GetBlob(MF_MT_MINIMUM_DISPLAY_APERTURE, (UINT8*)&area, sizeof(area), nullptr);
+        }
+
+        if (FAILED(hr)) {
+            hr = pType->GetBlob(MF_MT_GEOMETRIC_APERTURE, (UINT8*)&area, sizeof(area), nullptr);
+        }
+
+        RECT rc = { 0, 0, LONG(width), LONG(height) };
+        if (FAILED(hr)) {
+            return rc;
+        }
+
+        // Subsampled formats can only be cut at even pixels.
+        const LONG left = std::clamp<LONG>(area.OffsetX.value, 0, LONG(width)) & ~1L;
+        const LONG top = std::clamp<LONG>(area.OffsetY.value, 0, LONG(height)) & ~1L;
+        const LONG right = std::min<LONG>(left + area.Area.cx, LONG(width));
+        const LONG bottom = std::min<LONG>(top + area.Area.cy, LONG(height));
+
+        if (right - left < 2 || bottom - top < 2) {
+            return rc;
+        }
+
+        SetRect(&rc, left, top, left + ((right - left) & ~1L), top + ((bottom - top) & ~1L));
+        return rc;
+    }
+
+    // FNV-1a, one 32-bit word at a time.
+    void HashWord(uint64_t& hash, uint32_t word)
+    {
+        hash ^= word;
+        hash *= 1099511628211ull;
+    }
+}
+
+bool FramePlanKey::read(IMFMediaType* type)
+{
+    if (HRESULT hr = type->GetGUID(MF_MT_SUBTYPE, &subtype); FAILED(hr)) {
+        return false;
+    }
+
+    if (HRESULT hr = MFGetAttributeSize(type, MF_MT_FRAME_SIZE, &width, &height); FAILED(hr)) {
+        return false;
+    }
+
+    aperture = GetVideoDisplayArea(type, width, height);
+
+    // Default: assume progressive.
+    interlaceMode = (MFVideoInterlaceMode)MFGetAttributeUINT32(type, MF_MT_INTERLACE_MODE,
+        MFVideoInterlace_Progressive);
+
+    if (HRESULT hr = GetDefaultStride(type, &defaultStride); FAILED(hr)) {
+        return false;
+    }
+
+    // Default: assume square pixels (1:1).
+    if (FAILED(MFGetAttributeRatio(type, MF_MT_PIXEL_ASPECT_RATIO,
+        (UINT32*)&aspect.Numerator, (UINT32*)&aspect.Denominator)) || aspect.Denominator == 0) {
+        aspect.Numerator = aspect.Denominator = 1;
+    }
+
+    return true;
+}
+
+bool FramePlanKey::operator==(const FramePlanKey& other) const
+{
+    return subtype == other.subtype && width == other.width && height == other.height &&
+        EqualRect(&aperture, &other.aperture) &&
+        defaultStride == other.defaultStride &&
+        aspect.Numerator == other.aspect.Numerator && aspect.Denominator == other.aspect.Denominator &&
+        interlaceMode == other.interlaceMode &&
+        orientation.rotation == other.orientation.rotation &&
+        orientation.flipHorizontal == other.orientation.flipHorizontal &&
+        orientation.flipVertical == other.orientation.flipVertical &&
+        squarePixels == other.squarePixels && bands == other.bands;
+}
+
+size_t FramePlanKey::Hash::operator()(const FramePlanKey& key) const
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    HashWord(hash, key.subtype.Data1);
+    HashWord(hash, key.width);
+    HashWord(hash, key.height);
+    HashWord(hash, uint32_t(key.aperture.left) | uint32_t(key.aperture.top) << 16);
+    HashWord(hash, uint32_t(key.aperture.right) | uint32_t(key.aperture.bottom) << 16);
+    HashWord(hash, uint32_t(key.defaultStride));
+    HashWord(hash, key.aspect.Numerator);
+    HashWord(hash, key.aspect.Denominator);
+    HashWord(hash, uint32_t(key.interlaceMode));
+    HashWord(hash, uint32_t(key.orientation.rotation) | key.orientation.flipHorizontal << 2 |
+        key.orientation.flipVertical << 3 | key.squarePixels << 4);
+    HashWord(hash, key.bands);
+
+    return size_t(hash);
+}
+
+//-------------------------------------------------------------------
+// Create
+//
+// Works out the output geometry and builds the square-pixel resampler
+// if the key asks for one and the pixels are not square.
+//-------------------------------------------------------------------
+
+FramePlan FramePlan::create(const FramePlanKey& key, const FormatConvertor& converter)
+{
+    FramePlan plan;
+    plan.key = key;
+    plan.converter = &converter;
+
+    plan.outputWidth = uint32_t(key.aperture.right - key.aperture.left);
+    plan.outputHeight = uint32_t(key.aperture.bottom - key.aperture.top);
+    plan.outputAspect = key.aspect;
+
+    // Rotating by 90 degrees also turns wide pixels into tall ones.
+    if (key.orientation.swapsDimensions()) {
+        std::swap(plan.outputWidth, plan.outputHeight);
+        std::swap(plan.outputAspect.Numerator, plan.outputAspect.Denominator);
+    }
+
+    plan.headlessWidth = plan.outputWidth;
+    plan.headlessHeight = plan.outputHeight;
+
+    if (key.squarePixels && plan.outputAspect.Numerator != plan.outputAspect.Denominator) {
+        Resampler::squarePixelSize(plan.outputWidth, plan.outputHeight,
+            plan.outputAspect.Numerator, plan.outputAspect.Denominator, plan.headlessWidth, plan.headlessHeight);
+
+        plan.squarePixels = std::make_shared<Resampler>(plan.outputWidth, plan.outputHeight,
+            plan.headlessWidth, plan.headlessHeight, ResampleFilter::Lanczos3, Resampler::Layout::RGB32, key.bands);
+    }
+
+    return plan;
+}
+
+FramePlanes FramePlan::sourcePlanes(const uint8_t* scanLine, int32_t stride, size_t bufferSize) const
+{
+    const FramePlanes frame = converter->planes(scanLine, stride, key.width, key.height, bufferSize);
+
+    const RECT& rc = key.aperture;
+    return frame.crop(uint32_t(rc.left), uint32_t(rc.top), uint32_t(rc.right - rc.left), uint32_t(rc.bottom - rc.top));
+}
+
+const FramePlan* FramePlanCache::find(const FramePlanKey& key) const
+{
+    auto it = mPlans.find(key);
+    return it == mPlans.end() ? nullptr : &it->second;
+}
+
+const FramePlan& FramePlanCache::insert(FramePlan plan)
+{
+    if (mPlans.size() >= MaxPlans) {
+        mPlans.clear();
+    }
+
+    const FramePlanKey key = plan.key;
+    return mPlans.insert_or_assign(key, std::move(plan)).first->second;
+}
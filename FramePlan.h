@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+#include <mfapi.h>
+
+#include "FormatConvertor.h"
+
+class Resampler;
+
+//-------------------------------------------------------------------
+// FramePlanKey
+//
+// Everything about a negotiated media type and the renderer settings
+// that decides how its frames are converted.
+//-------------------------------------------------------------------
+
+struct FramePlanKey
+{
+    GUID subtype = GUID_NULL;
+    uint32_t width = 0;         // Allocated frame, MF_MT_FRAME_SIZE.
+    uint32_t height = 0;
+    RECT aperture = {};         // Visible part of the frame.
+    LONG defaultStride = 0;
+    MFRatio aspect = {1, 1};
+    MFVideoInterlaceMode interlaceMode = MFVideoInterlace_Progressive;
+    Orientation orientation;
+    bool squarePixels = false;
+    uint32_t bands = 1;
+
+    // Reads the media type attributes. The renderer settings are left
+    // as they are.
+    bool read(IMFMediaType* type);
+
+    bool operator==(const FramePlanKey& other) const;
+
+    struct Hash
+    {
+        size_t operator()(const FramePlanKey& key) const;
+    };
+};
+
+//-------------------------------------------------------------------
+// FramePlan
+//
+// Per-format decisions made once when a media type is negotiated, so
+// that drawing a frame does no lookups: the converter, the geometry
+// after rotation and the anamorphic rescale for headless output.
+//-------------------------------------------------------------------
+
+struct FramePlan
+{
+    FramePlanKey key;
+    const FormatConvertor* converter = nullptr;
+
+    // Converted frame: the aperture, after rotation.
+    uint32_t outputWidth = 0;
+    uint32_t outputHeight = 0;
+    MFRatio outputAspect = {1, 1};
+
+    // Headless frame; differs from the output size when it is rescaled
+    // to square pixels by squarePixels.
+    uint32_t headlessWidth = 0;
+    uint32_t headlessHeight = 0;
+    std::shared_ptr<Resampler> squarePixels;
+
+    static FramePlan create(const FramePlanKey& key, const FormatConvertor& converter);
+
+    // Planes of a locked buffer, limited to the aperture.
+    FramePlanes sourcePlanes(const uint8_t* scanLine, int32_t stride, size_t bufferSize) const;
+};
+
+//-------------------------------------------------------------------
+// FramePlanCache
+//
+// Plans by key. Reopening a device usually negotiates the same type
+// again, so the plan and its filter tables are reused.
+//-------------------------------------------------------------------
+
+class FramePlanCache
+{
+public:
+    const FramePlan* find(const FramePlanKey& key) const;
+    const FramePlan& insert(FramePlan plan);
+
+private:
+    // A handful of formats per device; beyond that start over.
+    static constexpr size_t MaxPlans = 16;
+
+    std::unordered_map<FramePlanKey, FramePlan, FramePlanKey::Hash> mPlans;
+};
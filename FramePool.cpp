@@ -0,0 +1,183 @@
+#include "FramePool.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "SafeRelease.h"
+
+FramePool::FramePool(size_t count, size_t arenaSize) : mSlots(std::make_unique<FrameSlot[]>(count)), mCount(count)
+{
+    mFree.reserve(count);
+
+    for (size_t i = 0; i < count; i++) {
+        mSlots[i].index = uint32_t(i);
+        (void)mSlots[i].arena.reserve(arenaSize);
+        mFree.push_back(uint32_t(i));
+    }
+}
+
+FramePool::~FramePool()
+{
+    for (size_t i = 0; i < mCount; i++) {
+        SafeRelease(&mSlots[i].sample);
+    }
+}
+
+bool FramePool::allocate(DWORD bufferSize)
+{
+    std::lock_guard lock(mMutex);
+
+    if (mFree.size() != mCount) {
+        // Frames are in flight.
+        return false;
+    }
+
+    for (size_t i = 0; i < mCount; i++) {
+        SafeRelease(&mSlots[i].sample);
+
+        IMFMediaBuffer* buffer = nullptr;
+        if (HRESULT hr = MFCreateMemoryBuffer(bufferSize, &buffer); FAILED(hr)) {
+            return false;
+        }
+
+        IMFSample* sample = nullptr;
+        HRESULT hr = MFCreateSample(&sample);
+        if (SUCCEEDED(hr)) {
+            hr = sample->AddBuffer(buffer);
+        }
+        buffer->Release();
+
+        if (FAILED(hr)) {
+            SafeRelease(&sample);
+            return false;
+        }
+
+        mSlots[i].sample = sample;
+    }
+
+    mOwnsSamples = true;
+    return true;
+}
+
+FrameSlot* FramePool::takeSlot()
+{
+    std::lock_guard lock(mMutex);
+
+    if (mFree.empty()) {
+        return nullptr;
+    }
+
+    FrameSlot* slot = &mSlots[mFree.back()];
+    mFree.pop_back();
+
+    return slot;
+}
+
+Frame FramePool::acquire()
+{
+    if (!mOwnsSamples) {
+        return {};
+    }
+
+    FrameSlot* slot = takeSlot();
+    if (!slot) {
+        return {};
+    }
+
+    slot->info = FrameInfo();
+
+    return Frame(shared_from_this(), slot);
+}
+
+Frame FramePool::wrap(IMFSample* sample, const FrameInfo& info)
+{
+    if (mOwnsSamples || !sample) {
+        return {};
+    }
+
+    FrameSlot* slot = takeSlot();
+    if (!slot) {
+        return {};
+    }
+
+    sample->AddRef();
+    slot->sample = sample;
+    slot->info = info;
+
+    return Frame(shared_from_this(), slot);
+}
+
+size_t FramePool::available() const
+{
+    std::lock_guard lock(mMutex);
+    return mFree.size();
+}
+
+FrameArena::Stats FramePool::arenaStats() const
+{
+    FrameArena::Stats total;
+
+    for (size_t i = 0; i < mCount; i++) {
+        const FrameArena::Stats stats = mSlots[i].arena.stats();
+        total.allocations += stats.allocations;
+        total.bytes += stats.bytes;
+        total.overflows += stats.overflows;
+        total.peak = std::max(total.peak, stats.peak);
+    }
+
+    return total;
+}
+
+void FramePool::recycle(FrameSlot* slot)
+{
+    if (!mOwnsSamples) {
+        SafeRelease(&slot->sample);
+    }
+
+    slot->arena.reset();
+
+    std::lock_guard lock(mMutex);
+    mFree.push_back(slot->index);
+}
+
+//-------------------------------------------------------------------
+// Frame
+//-------------------------------------------------------------------
+
+Frame::Frame(std::shared_ptr<FramePool> pool, FrameSlot* slot) : mPool(std::move(pool)), mSlot(slot)
+{
+    mSlot->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+Frame::Frame(const Frame& other) : mPool(other.mPool), mSlot(other.mSlot)
+{
+    if (mSlot) {
+        mSlot->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+Frame::Frame(Frame&& other) noexcept : mPool(std::move(other.mPool)), mSlot(std::exchange(other.mSlot, nullptr))
+{
+}
+
+Frame::~Frame()
+{
+    reset();
+}
+
+Frame& Frame::operator=(Frame other) noexcept
+{
+    std::swap(mPool, other.mPool);
+    std::swap(mSlot, other.mSlot);
+    return *this;
+}
+
+void Frame::reset()
+{
+    if (mSlot && mSlot->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        mPool->recycle(mSlot);
+    }
+
+    mSlot = nullptr;
+    mPool.reset();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Frame.h"
+
+//-------------------------------------------------------------------
+// FramePool
+//
+// Fixed set of frame slots. A pool either wraps samples owned by
+// somebody else (the source reader) or owns preallocated memory
+// samples that are reused from frame to frame. Every slot also owns
+// a FrameArena of arenaSize bytes.
+//-------------------------------------------------------------------
+
+class FramePool : public std::enable_shared_from_this<FramePool>
+{
+public:
+    explicit FramePool(size_t count, size_t arenaSize = 0);
+    ~FramePool();
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    // Preallocates one memory buffer of bufferSize bytes per slot.
+    bool allocate(DWORD bufferSize);
+
+    // Returns a frame with a preallocated sample, or an empty frame if
+    // every slot is in use.
+    Frame acquire();
+
+    // Returns a frame referencing an external sample, or an empty frame
+    // if every slot is in use.
+    Frame wrap(IMFSample* sample, const FrameInfo& info);
+
+    size_t available() const;
+    size_t size() const { return mCount; }
+
+    // Arena counters summed over all slots.
+    FrameArena::Stats arenaStats() const;
+
+private:
+    friend class Frame;
+
+    FrameSlot* takeSlot();
+    void recycle(FrameSlot* slot);
+
+    std::unique_ptr<FrameSlot[]> mSlots;
+    size_t mCount = 0;
+    std::vector<uint32_t> mFree;
+    bool mOwnsSamples = false;
+    mutable std::mutex mMutex;
+};
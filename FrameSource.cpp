@@ -0,0 +1,132 @@
+#include "FrameSource.h"
+
+#include <algorithm>
+
+namespace {
+    std::atomic<uint32_t> nextSourceId = 1;
+}
+
+FrameSource::FrameSource() :
+    mSourceId(nextSourceId.fetch_add(1, std::memory_order_relaxed))
+{
+}
+
+FrameSource::~FrameSource()
+{
+    closeStreams();
+}
+
+std::shared_ptr<FrameStream> FrameSource::subscribe(size_t capacity, FrameStream::OverflowPolicy policy)
+{
+    auto stream = std::make_shared<FrameStream>(capacity, policy);
+
+    std::lock_guard lock(mStreamsMutex);
+    mStreams.push_back(stream);
+
+    return stream;
+}
+
+//-------------------------------------------------------------------
+// DefaultStream
+//
+// The default stream is created on first use, so an application that
+// never pulls frames does not hold on to samples of the reader. Callers
+// get their own reference, since closeStreams() may drop the source's
+// one while they are still waiting on it.
+//-------------------------------------------------------------------
+
+std::shared_ptr<FrameStream> FrameSource::defaultStream()
+{
+    std::lock_guard lock(mStreamsMutex);
+
+    if (!mDefaultStream) {
+        mDefaultStream = std::make_shared<FrameStream>(1);
+        mStreams.push_back(mDefaultStream);
+    }
+
+    return mDefaultStream;
+}
+
+//-------------------------------------------------------------------
+// NextFrame
+//
+// Awaitable for the next frame on the default stream:
+//
+//     std::optional<Frame> frame = co_await camera.nextFrame();
+//
+// Resumes with an empty optional when the source is destroyed.
+//-------------------------------------------------------------------
+
+FrameStream::Awaiter FrameSource::nextFrame()
+{
+    return defaultStream()->next();
+}
+
+//-------------------------------------------------------------------
+// ReadFrame
+//
+// Blocks until the next frame on the default stream arrives or the
+// timeout expires.
+//-------------------------------------------------------------------
+
+bool FrameSource::readFrame(Frame& frame, std::chrono::milliseconds timeout)
+{
+    std::optional<Frame> next = defaultStream()->pop(timeout);
+    if (!next) {
+        return false;
+    }
+
+    frame = std::move(*next);
+    return true;
+}
+
+void FrameSource::publish(const Frame& frame)
+{
+    std::lock_guard lock(mStreamsMutex);
+
+    auto closed = std::remove_if(mStreams.begin(), mStreams.end(),
+        [](const std::shared_ptr<FrameStream>& stream) {
+            return stream->isClosed();
+        });
+    mStreams.erase(closed, mStreams.end());
+
+    size_t depth = 0;
+    for (const std::shared_ptr<FrameStream>& stream : mStreams) {
+        stream->push(frame);
+        depth = std::max(depth, stream->size());
+    }
+
+    mQueueDepth.store(depth, std::memory_order_relaxed);
+}
+
+bool FrameSource::waitForConsumers(std::chrono::milliseconds timeout)
+{
+    // Wait outside the lock so consumers can still subscribe.
+    {
+        std::lock_guard lock(mStreamsMutex);
+        mWaitList.assign(mStreams.begin(), mStreams.end());
+    }
+
+    bool ready = true;
+    for (const std::shared_ptr<FrameStream>& stream : mWaitList) {
+        if (!stream->isClosed() && !stream->waitForSpace(timeout)) {
+            ready = false;
+            break;
+        }
+    }
+
+    mWaitList.clear();
+    return ready;
+}
+
+void FrameSource::closeStreams()
+{
+    std::lock_guard lock(mStreamsMutex);
+
+    for (const std::shared_ptr<FrameStream>& stream : mStreams) {
+        stream->close();
+    }
+
+    mStreams.clear();
+    mDefaultStream.reset();
+}
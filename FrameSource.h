@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "FrameStream.h"
+
+//-------------------------------------------------------------------
+// FrameSource
+//
+// Common consumer interface of everything that produces frames: the
+// capture device and the synthetic source. Frames can be received
+// with a coroutine (nextFrame), pulled synchronously (readFrame), or
+// through a dedicated stream (subscribe).
+//-------------------------------------------------------------------
+
+class FrameSource
+{
+public:
+    FrameSource();
+    virtual ~FrameSource();
+
+    FrameSource(const FrameSource&) = delete;
+    FrameSource& operator=(const FrameSource&) = delete;
+
+    // Each subscriber gets its own bounded stream; closing the stream
+    // unsubscribes it.
+    std::shared_ptr<FrameStream> subscribe(size_t capacity = 4,
+        FrameStream::OverflowPolicy policy = FrameStream::OverflowPolicy::DropOldest);
+
+    FrameStream::Awaiter nextFrame();
+    bool readFrame(Frame& frame, std::chrono::milliseconds timeout);
+
+    // Process-wide unique, starting at 1; producers stamp it into the
+    // metadata of their frames.
+    uint32_t sourceId() const { return mSourceId; }
+
+    // Frames lost because every pool slot was held by consumers.
+    uint64_t droppedFrames() const { return mDropped.load(std::memory_order_relaxed); }
+
+    // Deepest subscriber queue right after the last published frame.
+    size_t queueDepth() const { return mQueueDepth.load(std::memory_order_relaxed); }
+
+    // Per-frame arena usage of the source's frame pool.
+    virtual FrameArena::Stats arenaStats() const = 0;
+
+protected:
+    void publish(const Frame& frame);
+    void countDroppedFrame() { mDropped.fetch_add(1, std::memory_order_relaxed); }
+    void closeStreams();
+
+    // Blocks until every subscriber can take one more frame.
+    bool waitForConsumers(std::chrono::milliseconds timeout);
+
+private:
+    std::shared_ptr<FrameStream> defaultStream();
+
+    std::shared_ptr<FrameStream> mDefaultStream;
+    std::vector<std::shared_ptr<FrameStream>> mStreams;
+    std::vector<std::shared_ptr<FrameStream>> mWaitList;    // Producer thread only.
+    const uint32_t mSourceId;
+    std::atomic<uint64_t> mDropped = 0;
+    std::atomic<size_t> mQueueDepth = 0;
+    std::mutex mStreamsMutex;
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+#include "FrameArena.h"
+#include "FrameMetadata.h"
+
+//-------------------------------------------------------------------
+// FrameStage
+//
+// Step run on every converted RGB32 frame, after FormatConvertor and
+// before the frame is presented or handed on. Stages run in the order
+// they were added, on the render thread. Analysis stages record their
+// results in stats, which go out with the frame's metadata. Scratch
+// memory that is only needed for this frame comes from arena, never
+// from the heap.
+//-------------------------------------------------------------------
+
+class FrameStage
+{
+public:
+    virtual ~FrameStage() = default;
+
+    virtual void process(uint8_t* frame, uint32_t stride, uint32_t width, uint32_t height, FrameStats& stats,
+        FrameArena& arena) = 0;
+};
@@ -0,0 +1,194 @@
+#include "FrameStream.h"
+
+#include <utility>
+
+#include <windows.h>
+
+namespace {
+    void CALLBACK ResumeCoroutine(PTP_CALLBACK_INSTANCE, void* context)
+    {
+        std::coroutine_handle<>::from_address(context).resume();
+    }
+}
+
+FrameStream::FrameStream(size_t capacity, OverflowPolicy policy)
+    : mFrames(capacity ? capacity : 1), mPolicy(policy)
+{
+}
+
+FrameStream::~FrameStream()
+{
+    close();
+}
+
+bool FrameStream::push(const Frame& frame)
+{
+    Awaiter* waiter = nullptr;
+
+    {
+        std::lock_guard lock(mMutex);
+
+        if (mClosed) {
+            return false;
+        }
+
+        // A suspended consumer gets the frame directly, so that no
+        // other consumer can take it before the coroutine runs.
+        if (!mWaiters.empty()) {
+            waiter = mWaiters.front();
+            mWaiters.pop_front();
+            waiter->mFrame = frame;
+        }
+        else {
+            if (mCount == mFrames.size()) {
+                mDropped.fetch_add(1, std::memory_order_relaxed);
+
+                if (mPolicy == OverflowPolicy::DropNewest) {
+                    return false;
+                }
+
+                mFrames[mHead].reset();
+                mHead = (mHead + 1) % mFrames.size();
+                --mCount;
+            }
+
+            mFrames[(mHead + mCount) % mFrames.size()] = frame;
+            ++mCount;
+        }
+    }
+
+    if (waiter) {
+        resume(waiter->mHandle);
+    }
+    else {
+        mCondition.notify_all();
+    }
+
+    return true;
+}
+
+std::optional<Frame> FrameStream::tryPop()
+{
+    std::lock_guard lock(mMutex);
+    return popLocked();
+}
+
+std::optional<Frame> FrameStream::pop(std::chrono::milliseconds timeout)
+{
+    std::unique_lock lock(mMutex);
+
+    mCondition.wait_for(lock, timeout, [this] {
+        return mCount > 0 || mClosed;
+    });
+
+    return popLocked();
+}
+
+bool FrameStream::waitForSpace(std::chrono::milliseconds timeout)
+{
+    std::unique_lock lock(mMutex);
+
+    return mCondition.wait_for(lock, timeout, [this] {
+        return mCount < mFrames.size() || mClosed;
+    }) && !mClosed;
+}
+
+std::optional<Frame> FrameStream::popLocked()
+{
+    if (mCount == 0) {
+        return std::nullopt;
+    }
+
+    Frame frame = std::move(mFrames[mHead]);
+    mHead = (mHead + 1) % mFrames.size();
+    --mCount;
+
+    mCondition.notify_all();
+
+    return frame;
+}
+
+void FrameStream::close()
+{
+    std::deque<Awaiter*> waiters;
+
+    {
+        std::lock_guard lock(mMutex);
+
+        if (mClosed) {
+            return;
+        }
+
+        mClosed = true;
+        waiters.swap(mWaiters);
+
+        while (mCount > 0) {
+            popLocked();
+        }
+    }
+
+    mCondition.notify_all();
+
+    for (Awaiter* waiter : waiters) {
+        resume(waiter->mHandle);
+    }
+}
+
+bool FrameStream::isClosed() const
+{
+    std::lock_guard lock(mMutex);
+    return mClosed;
+}
+
+size_t FrameStream::size() const
+{
+    std::lock_guard lock(mMutex);
+    return mCount;
+}
+
+void FrameStream::resume(std::coroutine_handle<> handle)
+{
+    // Never run consumer code on the producer thread.
+    if (!TrySubmitThreadpoolCallback(ResumeCoroutine, handle.address(), nullptr)) {
+        handle.resume();
+    }
+}
+
+//-------------------------------------------------------------------
+// Awaiter
+//
+// A queued frame is taken while the lock is held, in await_ready or
+// await_suspend, rather than in await_resume: between the two another
+// consumer could empty the queue.
+//-------------------------------------------------------------------
+
+bool FrameStream::Awaiter::await_ready()
+{
+    std::lock_guard lock(mStream->mMutex);
+    return takeLocked();
+}
+
+bool FrameStream::Awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    std::lock_guard lock(mStream->mMutex);
+
+    // A frame may have arrived since await_ready.
+    if (takeLocked()) {
+        return false;
+    }
+
+    mHandle = handle;
+    mStream->mWaiters.push_back(this);
+    return true;
+}
+
+std::optional<Frame> FrameStream::Awaiter::await_resume()
+{
+    return std::move(mFrame);
+}
+
+bool FrameStream::Awaiter::takeLocked()
+{
+    mFrame = mStream->popLocked();
+    return mFrame.has_value() || mStream->mClosed;
+}
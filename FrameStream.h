@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "Frame.h"
+
+//-------------------------------------------------------------------
+// FrameStream
+//
+// Bounded frame channel between the capture callback and one consumer.
+// The producer never waits: when the consumer falls behind, the
+// overflow policy decides which frame is dropped.
+//
+// Consumers pull frames from a coroutine:
+//
+//     CaptureTask consume(std::shared_ptr<FrameStream> stream)
+//     {
+//         while (std::optional<Frame> frame = co_await stream->next()) {
+//             ...
+//         }
+//     }
+//
+// or block with a timeout:
+//
+//     std::optional<Frame> frame = stream->pop(std::chrono::milliseconds(100));
+//
+// Suspended consumers are resumed on the system thread pool, so the
+// capture thread is never blocked by consumer code. Several coroutines
+// may wait on one stream; each frame is handed to the one that has
+// waited longest, so an empty result always means the stream is closed. Streams are always
+// owned by a shared_ptr; a pending co_await holds a reference, so the
+// stream outlives the consumer it resumes even if the source has
+// already let go of it.
+//-------------------------------------------------------------------
+
+class FrameStream : public std::enable_shared_from_this<FrameStream>
+{
+public:
+    enum class OverflowPolicy
+    {
+        DropOldest, DropNewest
+    };
+
+    class Awaiter
+    {
+    public:
+        explicit Awaiter(std::shared_ptr<FrameStream> stream) : mStream(std::move(stream)) {}
+
+        bool await_ready();
+        bool await_suspend(std::coroutine_handle<> handle);
+        std::optional<Frame> await_resume();
+
+    private:
+        friend class FrameStream;
+
+        bool takeLocked();
+
+        std::shared_ptr<FrameStream> mStream;
+        std::coroutine_handle<> mHandle;
+        std::optional<Frame> mFrame;    // Taken or handed over; empty once closed.
+    };
+
+    explicit FrameStream(size_t capacity, OverflowPolicy policy = OverflowPolicy::DropOldest);
+    ~FrameStream();
+
+    FrameStream(const FrameStream&) = delete;
+    FrameStream& operator=(const FrameStream&) = delete;
+
+    // Producer side. Returns false if the frame was not queued.
+    bool push(const Frame& frame);
+
+    // Consumer side.
+    Awaiter next() { return Awaiter(shared_from_this()); }
+    std::optional<Frame> tryPop();
+    std::optional<Frame> pop(std::chrono::milliseconds timeout);
+
+    // Lets producers that are not paced by a device wait for the consumer.
+    bool waitForSpace(std::chrono::milliseconds timeout);
+
+    // Cancels the stream. Suspended consumers are resumed with an empty frame.
+    void close();
+    bool isClosed() const;
+
+    size_t size() const;
+    size_t capacity() const { return mFrames.size(); }
+    uint64_t droppedFrames() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+    std::optional<Frame> popLocked();
+    void resume(std::coroutine_handle<> handle);
+
+    std::vector<Frame> mFrames;
+    size_t mHead = 0;
+    size_t mCount = 0;
+    OverflowPolicy mPolicy = OverflowPolicy::DropOldest;
+    bool mClosed = false;
+    std::deque<Awaiter*> mWaiters;  // Only while the queue is empty.
+    std::atomic<uint64_t> mDropped = 0;
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+};
+
+//-------------------------------------------------------------------
+// CaptureTask
+//
+// Fire-and-forget coroutine type for frame consumers.
+//-------------------------------------------------------------------
+
+struct CaptureTask
+{
+    struct promise_type
+    {
+        CaptureTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
@@ -0,0 +1,367 @@
+#include "GlyphAtlas.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "Simd.h"
+
+namespace {
+    const uint32_t GLYPH_COUNT = GlyphAtlas::LAST_GLYPH - GlyphAtlas::FIRST_GLYPH + 1;
+
+    // (dst * (255 - c) + src * c) / 255, rounded.
+    inline uint8_t mix(uint32_t dst, uint32_t src, uint32_t c)
+    {
+        const uint32_t t = dst * (255 - c) + src * c + 128;
+        return uint8_t((t + (t >> 8)) >> 8);
+    }
+
+    void blendRGB32Scalar(uint8_t* dest, const uint8_t* coverage, uint32_t begin, uint32_t count, uint32_t color)
+    {
+        const uint32_t b = color & 0xff;
+        const uint32_t g = (color >> 8) & 0xff;
+        const uint32_t r = (color >> 16) & 0xff;
+
+        for (uint32_t x = begin; x < count; x++) {
+            const uint32_t c = coverage[x];
+            if (c == 0) {
+                continue;
+            }
+
+            uint8_t* pixel = dest + x * 4;
+            pixel[0] = mix(pixel[0], b, c);
+            pixel[1] = mix(pixel[1], g, c);
+            pixel[2] = mix(pixel[2], r, c);
+            pixel[3] = mix(pixel[3], 0xff, c);
+        }
+    }
+
+    void blendLumaScalar(uint8_t* dest, const uint8_t* coverage, uint32_t begin, uint32_t count, uint8_t luma)
+    {
+        for (uint32_t x = begin; x < count; x++) {
+            if (coverage[x] != 0) {
+                dest[x] = mix(dest[x], luma, coverage[x]);
+            }
+        }
+    }
+
+#if MFCAMERA_SIMD_SSSE3
+    inline __m128i mix16(__m128i dst, __m128i src, __m128i c, __m128i inverse)
+    {
+        __m128i t = _mm_add_epi16(_mm_mullo_epi16(dst, inverse), _mm_mullo_epi16(src, c));
+        t = _mm_add_epi16(t, _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    }
+
+    uint32_t blendRGB32Simd(uint8_t* dest, const uint8_t* coverage, uint32_t count, uint32_t color)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i ones = _mm_set1_epi8(-1);
+        const __m128i spread = _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3);
+        const __m128i src = _mm_unpacklo_epi8(_mm_set1_epi32(int(color | 0xff000000)), zero);
+
+        uint32_t x = 0;
+        for (; x + 4 <= count; x += 4) {
+            int packed = 0;
+            memcpy(&packed, coverage + x, 4);
+            if (packed == 0) {
+                continue;
+            }
+
+            const __m128i c = _mm_shuffle_epi8(_mm_cvtsi32_si128(packed), spread);
+            const __m128i inverse = _mm_xor_si128(c, ones);
+            const __m128i dst = _mm_loadu_si128((const __m128i*)(dest + x * 4));
+
+            const __m128i lo = mix16(_mm_unpacklo_epi8(dst, zero), src,
+                _mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(inverse, zero));
+            const __m128i hi = mix16(_mm_unpackhi_epi8(dst, zero), src,
+                _mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(inverse, zero));
+
+            _mm_storeu_si128((__m128i*)(dest + x * 4), _mm_packus_epi16(lo, hi));
+        }
+
+        return x;
+    }
+
+    uint32_t blendLumaSimd(uint8_t* dest, const uint8_t* coverage, uint32_t count, uint8_t luma)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i full = _mm_set1_epi16(255);
+        const __m128i src = _mm_set1_epi16(luma);
+
+        uint32_t x = 0;
+        for (; x + 8 <= count; x += 8) {
+            const __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(coverage + x)), zero);
+            const __m128i dst = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(dest + x)), zero);
+
+            const __m128i result = mix16(dst, src, c, _mm_sub_epi16(full, c));
+            _mm_storel_epi64((__m128i*)(dest + x), _mm_packus_epi16(result, result));
+        }
+
+        return x;
+    }
+#elif MFCAMERA_SIMD_NEON
+    inline uint8x8_t mix8(uint8x8_t dst, uint8x8_t src, uint8x8_t c)
+    {
+        uint16x8_t t = vmull_u8(dst, vmvn_u8(c));
+        t = vmlal_u8(t, src, c);
+        return vraddhn_u16(t, vrshrq_n_u16(t, 8));
+    }
+
+    uint32_t blendRGB32Simd(uint8_t* dest, const uint8_t* coverage, uint32_t count, uint32_t color)
+    {
+        const uint8x8_t src[4] = {
+            vdup_n_u8(uint8_t(color)), vdup_n_u8(uint8_t(color >> 8)),
+            vdup_n_u8(uint8_t(color >> 16)), vdup_n_u8(0xff)
+        };
+
+        uint32_t x = 0;
+        for (; x + 8 <= count; x += 8) {
+            const uint8x8_t c = vld1_u8(coverage + x);
+            if (vmaxv_u8(c) == 0) {
+                continue;
+            }
+
+            uint8x8x4_t dst = vld4_u8(dest + x * 4);
+            for (int i = 0; i < 4; i++) {
+                dst.val[i] = mix8(dst.val[i], src[i], c);
+            }
+            vst4_u8(dest + x * 4, dst);
+        }
+
+        return x;
+    }
+
+    uint32_t blendLumaSimd(uint8_t* dest, const uint8_t* coverage, uint32_t count, uint8_t luma)
+    {
+        const uint8x8_t src = vdup_n_u8(luma);
+
+        uint32_t x = 0;
+        for (; x + 8 <= count; x += 8) {
+            vst1_u8(dest + x, mix8(vld1_u8(dest + x), src, vld1_u8(coverage + x)));
+        }
+
+        return x;
+    }
+#else
+    uint32_t blendRGB32Simd(uint8_t*, const uint8_t*, uint32_t, uint32_t)
+    {
+        return 0;
+    }
+
+    uint32_t blendLumaSimd(uint8_t*, const uint8_t*, uint32_t, uint8_t)
+    {
+        return 0;
+    }
+#endif
+}
+
+GlyphAtlas::GlyphAtlas(uint32_t cellWidth, uint32_t cellHeight) :
+    mCellWidth(cellWidth), mCellHeight(cellHeight), mStride(cellWidth * GLYPH_COUNT),
+    mCoverage(size_t(mStride) * cellHeight)
+{
+}
+
+//-------------------------------------------------------------------
+// Create
+//
+// Draws every glyph white on black into a DIB section with grayscale
+// antialiasing and keeps one channel as coverage.
+//-------------------------------------------------------------------
+
+std::shared_ptr<GlyphAtlas> GlyphAtlas::create(const wchar_t* face, uint32_t pixelHeight)
+{
+    HDC dc = CreateCompatibleDC(nullptr);
+    if (!dc) {
+        return nullptr;
+    }
+
+    HFONT font = CreateFontW(-int(pixelHeight), 0, 0, 0, FW_BOLD, FALSE, FALSE, FALSE, DEFAULT_CHARSET,
+        OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, ANTIALIASED_QUALITY, FIXED_PITCH | FF_MODERN, face);
+    if (!font) {
+        DeleteDC(dc);
+        return nullptr;
+    }
+
+    HGDIOBJ previousFont = SelectObject(dc, font);
+
+    TEXTMETRICW metrics = {};
+    GetTextMetricsW(dc, &metrics);
+
+    std::shared_ptr<GlyphAtlas> atlas;
+
+    if (metrics.tmAveCharWidth > 0 && metrics.tmHeight > 0) {
+        atlas.reset(new GlyphAtlas(uint32_t(metrics.tmAveCharWidth), uint32_t(metrics.tmHeight)));
+
+        BITMAPINFO info = {};
+        info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        info.bmiHeader.biWidth = LONG(atlas->mStride);
+        info.bmiHeader.biHeight = -LONG(atlas->mCellHeight);   // Top-down.
+        info.bmiHeader.biPlanes = 1;
+        info.bmiHeader.biBitCount = 32;
+        info.bmiHeader.biCompression = BI_RGB;
+
+        void* bits = nullptr;
+        HBITMAP bitmap = CreateDIBSection(dc, &info, DIB_RGB_COLORS, &bits, nullptr, 0);
+
+        if (bitmap && bits) {
+            HGDIOBJ previousBitmap = SelectObject(dc, bitmap);
+
+            memset(bits, 0, atlas->mCoverage.size() * 4);
+            SetTextColor(dc, RGB(255, 255, 255));
+            SetBkMode(dc, TRANSPARENT);
+
+            for (uint32_t i = 0; i < GLYPH_COUNT; i++) {
+                const wchar_t glyph = wchar_t(FIRST_GLYPH + i);
+                TextOutW(dc, int(i * atlas->mCellWidth), 0, &glyph, 1);
+            }
+
+            GdiFlush();
+
+            const uint8_t* pixels = static_cast<const uint8_t*>(bits);
+            for (size_t i = 0; i < atlas->mCoverage.size(); i++) {
+                atlas->mCoverage[i] = pixels[i * 4 + 1];
+            }
+
+            SelectObject(dc, previousBitmap);
+        }
+        else {
+            atlas.reset();
+        }
+
+        if (bitmap) {
+            DeleteObject(bitmap);
+        }
+    }
+
+    SelectObject(dc, previousFont);
+    DeleteObject(font);
+    DeleteDC(dc);
+
+    return atlas;
+}
+
+const uint8_t* GlyphAtlas::glyphRow(char c, uint32_t y) const
+{
+    if (c < FIRST_GLYPH || c > LAST_GLYPH) {
+        c = '?';
+    }
+
+    return mCoverage.data() + size_t(y) * mStride + size_t(c - FIRST_GLYPH) * mCellWidth;
+}
+
+TextRenderer::TextRenderer(std::shared_ptr<const GlyphAtlas> atlas, size_t maxChars) :
+    mAtlas(std::move(atlas)), mMaxChars(maxChars), mScanline(maxChars * mAtlas->cellWidth())
+{
+}
+
+bool TextRenderer::clip(uint32_t width, uint32_t height, int x, int y, size_t length,
+    uint32_t& left, uint32_t& top, uint32_t& skipX, uint32_t& skipY, uint32_t& columns, uint32_t& rows) const
+{
+    const int64_t right = std::min<int64_t>(int64_t(x) + int64_t(length * mAtlas->cellWidth()), width);
+    const int64_t bottom = std::min<int64_t>(int64_t(y) + mAtlas->cellHeight(), height);
+
+    left = uint32_t(std::max(x, 0));
+    top = uint32_t(std::max(y, 0));
+
+    if (right <= int64_t(left) || bottom <= int64_t(top)) {
+        return false;
+    }
+
+    skipX = uint32_t(int64_t(left) - x);
+    skipY = uint32_t(int64_t(top) - y);
+    columns = uint32_t(right - left);
+    rows = uint32_t(bottom - top);
+
+    return true;
+}
+
+void TextRenderer::gatherRow(const char* text, size_t length, uint32_t glyphY)
+{
+    const uint32_t cellWidth = mAtlas->cellWidth();
+
+    for (size_t i = 0; i < length; i++) {
+        memcpy(mScanline.data() + i * cellWidth, mAtlas->glyphRow(text[i], glyphY), cellWidth);
+    }
+}
+
+void TextRenderer::drawRGB32(uint8_t* frame, uint32_t stride, uint32_t width, uint32_t height,
+    int x, int y, const char* text, uint32_t color)
+{
+    const size_t length = std::min(strlen(text), mMaxChars);
+
+    uint32_t left, top, skipX, skipY, columns, rows;
+    if (!clip(width, height, x, y, length, left, top, skipX, skipY, columns, rows)) {
+        return;
+    }
+
+    const bool simd = Simd::enabled();
+
+    for (uint32_t row = 0; row < rows; row++) {
+        gatherRow(text, length, skipY + row);
+
+        uint8_t* dest = frame + size_t(top + row) * stride + size_t(left) * 4;
+        const uint8_t* coverage = mScanline.data() + skipX;
+
+        const uint32_t done = simd ? blendRGB32Simd(dest, coverage, columns, color) : 0;
+        blendRGB32Scalar(dest, coverage, done, columns, color);
+    }
+}
+
+void TextRenderer::drawLuma(uint8_t* plane, uint32_t stride, uint32_t width, uint32_t height,
+    int x, int y, const char* text, uint8_t luma)
+{
+    const size_t length = std::min(strlen(text), mMaxChars);
+
+    uint32_t left, top, skipX, skipY, columns, rows;
+    if (!clip(width, height, x, y, length, left, top, skipX, skipY, columns, rows)) {
+        return;
+    }
+
+    const bool simd = Simd::enabled();
+
+    for (uint32_t row = 0; row < rows; row++) {
+        gatherRow(text, length, skipY + row);
+
+        uint8_t* dest = plane + size_t(top + row) * stride + left;
+        const uint8_t* coverage = mScanline.data() + skipX;
+
+        const uint32_t done = simd ? blendLumaSimd(dest, coverage, columns, luma) : 0;
+        blendLumaScalar(dest, coverage, done, columns, luma);
+    }
+}
+
+TextStage::TextStage(std::shared_ptr<const GlyphAtlas> atlas, POINT position, uint32_t color) :
+    mRenderer(std::move(atlas), MAX_TEXT), mPosition(position), mColor(color)
+{
+}
+
+void TextStage::setText(const char* text)
+{
+    std::lock_guard lock(mMutex);
+    strncpy_s(mText, text, _TRUNCATE);
+}
+
+void TextStage::setClock(bool enabled)
+{
+    std::lock_guard lock(mMutex);
+    mClock = enabled;
+}
+
+void TextStage::process(uint8_t* frame, uint32_t stride, uint32_t width, uint32_t height, FrameStats&, FrameArena&)
+{
+    std::lock_guard lock(mMutex);
+
+    const char* text = mText;
+
+    char clock[16];
+    if (mClock) {
+        SYSTEMTIME time = {};
+        GetLocalTime(&time);
+        snprintf(clock, sizeof(clock), "%02u:%02u:%02u.%03u",
+            time.wHour, time.wMinute, time.wSecond, time.wMilliseconds);
+        text = clock;
+    }
+
+    mRenderer.drawRGB32(frame, stride, width, height, mPosition.x, mPosition.y, text, mColor);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <windows.h>
+
+#include "FrameStage.h"
+
+//-------------------------------------------------------------------
+// GlyphAtlas
+//
+// Printable ASCII (32..126) of a monospaced font, rendered once with
+// GDI into 8-bit coverage cells. All glyphs share one cell size, so a
+// line of text is a row of equally wide cells.
+//-------------------------------------------------------------------
+
+class GlyphAtlas
+{
+public:
+    static const char FIRST_GLYPH = ' ';
+    static const char LAST_GLYPH = '~';
+
+    // Returns nullptr if the font cannot be rendered.
+    static std::shared_ptr<GlyphAtlas> create(const wchar_t* face, uint32_t pixelHeight);
+
+    uint32_t cellWidth() const { return mCellWidth; }
+    uint32_t cellHeight() const { return mCellHeight; }
+
+    // Coverage of one glyph row; characters outside the atlas map to '?'.
+    const uint8_t* glyphRow(char c, uint32_t y) const;
+
+private:
+    GlyphAtlas(uint32_t cellWidth, uint32_t cellHeight);
+
+    uint32_t mCellWidth = 0;
+    uint32_t mCellHeight = 0;
+    uint32_t mStride = 0;
+    std::vector<uint8_t> mCoverage;
+};
+
+//-------------------------------------------------------------------
+// TextRenderer
+//
+// Blends a line of text into an RGB32 frame or into the Y plane of an
+// NV12 frame. Each text row is gathered from the atlas into a scratch
+// scanline and blended in one vector pass; drawing does not allocate.
+// Text longer than maxChars is cut off.
+//-------------------------------------------------------------------
+
+class TextRenderer
+{
+public:
+    TextRenderer(std::shared_ptr<const GlyphAtlas> atlas, size_t maxChars = 64);
+
+    // color is 0xRRGGBB.
+    void drawRGB32(uint8_t* frame, uint32_t stride, uint32_t width, uint32_t height,
+        int x, int y, const char* text, uint32_t color);
+
+    void drawLuma(uint8_t* plane, uint32_t stride, uint32_t width, uint32_t height,
+        int x, int y, const char* text, uint8_t luma);
+
+    const GlyphAtlas& atlas() const { return *mAtlas; }
+
+private:
+    // Clips the text box to the frame. Returns false if nothing is visible.
+    bool clip(uint32_t width, uint32_t height, int x, int y, size_t length,
+        uint32_t& left, uint32_t& top, uint32_t& skipX, uint32_t& skipY, uint32_t& columns, uint32_t& rows) const;
+    void gatherRow(const char* text, size_t length, uint32_t glyphY);
+
+    std::shared_ptr<const GlyphAtlas> mAtlas;
+    size_t mMaxChars = 0;
+    std::vector<uint8_t> mScanline;
+};
+
+//-------------------------------------------------------------------
+// TextStage
+//
+// Burns a line of text, or the local wall-clock time as a timecode,
+// into every frame.
+//-------------------------------------------------------------------
+
+class TextStage : public FrameStage
+{
+public:
+    TextStage(std::shared_ptr<const GlyphAtlas> atlas, POINT position, uint32_t color);
+
+    void setText(const char* text);
+
+    // Replaces the text with hh:mm:ss.mmm of each frame.
+    void setClock(bool enabled);
+
+    void process(uint8_t* frame, uint32_t stride, uint32_t width, uint32_t height, FrameStats& stats,
+        FrameArena& arena) override;
+
+private:
+    static const size_t MAX_TEXT = 64;
+
+    TextRenderer mRenderer;
+    POINT mPosition = {};
+    uint32_t mColor = 0;
+    char mText[MAX_TEXT + 1] = {};
+    bool mClock = false;
+    std::mutex mMutex;
+};
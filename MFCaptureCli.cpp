@@ -0,0 +1,925 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// MFCaptureCli.cpp : Headless capture and benchmark tool
+//
+// Runs a capture session without a desktop window and reports
+// throughput, latency percentiles, drops and CPU usage:
+//
+//     MFCaptureCli [options]
+//
+//     --source device|synthetic|file
+//                                 frame source (default: device)
+//     --file <path>               file source: a recorded segment or a
+//                                 .y4m file; the session ends with it
+//     --loop                      file source starts over at the end
+//     --config <path>             session configuration file
+//     --device <name>             device friendly name or symbolic link
+//     --size <w>x<h>              frame size (default: from config)
+//     --fps <n>                   frame rate (default: from config)
+//     --format NV12|YUY2|RGB32    synthetic source format (default: NV12)
+//     --sink null|convert         what to do with each frame (default: convert);
+//                                 the device source converts in the camera
+//     --duration <seconds>        run time (default: 10)
+//     --unpaced                   synthetic or file source runs as fast
+//                                 as consumed
+//     --metrics-port <port>       serve Prometheus metrics on localhost
+//     --record <directory>        also record every frame in segments, as
+//                                 configured in [recording]
+//     --record-format raw|y4m     container of recorded segments; y4m with
+//                                 --source file --unpaced converts a file
+//     --bench-convert             time the scalar and SIMD RGB24 paths at
+//                                 --size instead of capturing
+//     --bench-denoise             time the temporal denoiser on NV12 frames
+//                                 at --size, e.g. 1920x1080
+//     --bench-batch               time the batch convertor on NV12 frames
+//                                 at --size with 1, 2, 4... worker threads
+//     --inspect <segment>         describe a recorded segment and time
+//                                 seeks and thumbnails on it
+//     --reprocess <segment>       convert every frame of a recorded segment
+//                                 to RGB32 in batches on the worker pool;
+//                                 with --record, record the result
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mfapi.h>
+
+#include "BatchConvertor.h"
+#include "Camera.h"
+#include "DrawDevice.h"
+#include "FileReplaySource.h"
+#include "FormatConvertor.h"
+#include "Metrics.h"
+#include "MetricsServer.h"
+#include "RecordingReader.h"
+#include "SafeRelease.h"
+#include "SessionConfig.h"
+#include "SegmentRecorder.h"
+#include "Simd.h"
+#include "SyntheticSource.h"
+#include "TemporalDenoiser.h"
+#include "WorkerPool.h"
+
+namespace {
+    struct Options
+    {
+        std::wstring source = L"device";
+        std::wstring format = L"NV12";
+        std::wstring file;
+        bool loop = false;
+        std::wstring sink = L"convert";
+        uint32_t duration = 10;
+        bool unpaced = false;
+        bool benchConvert = false;
+        bool benchDenoise = false;
+        bool benchBatch = false;
+        std::wstring inspect;
+        std::wstring reprocess;
+        SessionConfig config;
+    };
+
+    void printUsage()
+    {
+        printf("usage: MFCaptureCli [--source device|synthetic|file] [--config path] [--device name]\n"
+               "                    [--file path] [--loop]\n"
+               "                    [--size WxH] [--fps n] [--format NV12|YUY2|RGB32]\n"
+               "                    [--sink null|convert] [--duration seconds] [--unpaced]\n"
+               "                    [--metrics-port port] [--record directory] [--record-format raw|y4m]\n"
+               "                    [--bench-convert] [--bench-denoise] [--bench-batch]\n"
+               "                    [--inspect segment] [--reprocess segment]\n");
+    }
+
+    bool parseOptions(int argc, wchar_t** argv, Options& options)
+    {
+        // The config file comes first so that other options override it.
+        for (int i = 1; i + 1 < argc; i++) {
+            if (wcscmp(argv[i], L"--config") == 0 && !options.config.load(argv[i + 1])) {
+                fwprintf(stderr, L"Cannot load %s\n", argv[i + 1]);
+                return false;
+            }
+        }
+
+        for (int i = 1; i < argc; i++) {
+            const std::wstring option = argv[i];
+            const wchar_t* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+            if (option == L"--unpaced") {
+                options.unpaced = true;
+                continue;
+            }
+
+            if (option == L"--loop") {
+                options.loop = true;
+                continue;
+            }
+
+            if (option == L"--bench-convert") {
+                options.benchConvert = true;
+                continue;
+            }
+
+            if (option == L"--bench-denoise") {
+                options.benchDenoise = true;
+                continue;
+            }
+
+            if (option == L"--bench-batch") {
+                options.benchBatch = true;
+                continue;
+            }
+
+            if (!value) {
+                return false;
+            }
+
+            ++i;
+
+            if (option == L"--source") {
+                options.source = value;
+            }
+            else if (option == L"--config") {
+                // Loaded above, before everything it could override.
+            }
+            else if (option == L"--file") {
+                options.file = value;
+            }
+            else if (option == L"--device") {
+                options.config.device = value;
+            }
+            else if (option == L"--size") {
+                if (swscanf_s(value, L"%ux%u", &options.config.width, &options.config.height) != 2) {
+                    return false;
+                }
+            }
+            else if (option == L"--fps") {
+                options.config.fps = wcstoul(value, nullptr, 10);
+            }
+            else if (option == L"--format") {
+                options.format = value;
+            }
+            else if (option == L"--sink") {
+                options.sink = value;
+            }
+            else if (option == L"--duration") {
+                options.duration = wcstoul(value, nullptr, 10);
+            }
+            else if (option == L"--metrics-port") {
+                const unsigned long port = wcstoul(value, nullptr, 10);
+                if (port > UINT16_MAX) {
+                    return false;
+                }
+                options.config.metricsPort = uint16_t(port);
+            }
+            else if (option == L"--inspect") {
+                options.inspect = value;
+            }
+            else if (option == L"--reprocess") {
+                options.reprocess = value;
+            }
+            else if (option == L"--record") {
+                options.config.recordingDirectory = value;
+                if (!options.config.hasSink("record")) {
+                    options.config.sinks.push_back("record");
+                }
+            }
+            else if (option == L"--record-format") {
+                if (_wcsicmp(value, L"raw") != 0 && _wcsicmp(value, L"y4m") != 0) {
+                    return false;
+                }
+                options.config.recordingFormat = _wcsicmp(value, L"y4m") == 0 ?
+                    RecordingContainer::Y4m : RecordingContainer::Raw;
+            }
+            else {
+                return false;
+            }
+        }
+
+        return options.config.fps > 0 && options.duration > 0 &&
+            (options.source == L"device" || options.source == L"synthetic" ||
+                (options.source == L"file" && !options.file.empty())) &&
+            (options.sink == L"null" || options.sink == L"convert");
+    }
+
+    GUID parseFormat(const std::wstring& name)
+    {
+        if (_wcsicmp(name.c_str(), L"YUY2") == 0) {
+            return MFVideoFormat_YUY2;
+        }
+
+        if (_wcsicmp(name.c_str(), L"RGB32") == 0) {
+            return MFVideoFormat_RGB32;
+        }
+
+        return MFVideoFormat_NV12;
+    }
+
+    uint64_t fileTimeToTicks(const FILETIME& time)
+    {
+        return (uint64_t(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    }
+
+    // Kernel plus user time of the process, 100ns units.
+    uint64_t processCpuTime()
+    {
+        FILETIME creation, exit, kernel, user;
+        if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+            return 0;
+        }
+
+        return fileTimeToTicks(kernel) + fileTimeToTicks(user);
+    }
+
+    //-------------------------------------------------------------------
+    // ConvertSink
+    //
+    // Converts every frame to RGB32 in memory, like the preview would.
+    //-------------------------------------------------------------------
+
+    class ConvertSink
+    {
+    public:
+        bool process(const Frame& frame)
+        {
+            const FrameInfo& info = frame.info();
+
+            if (info.subtype != mSubtype || info.width != mWidth || info.height != mHeight) {
+                if (!configure(info)) {
+                    return false;
+                }
+            }
+
+            IMFMediaBuffer* buffer = nullptr;
+            if (FAILED(frame.sample()->GetBufferByIndex(0, &buffer))) {
+                return false;
+            }
+
+            const bool ok = mDrawDevice.DrawFrame(buffer, nullptr, &frame.arena());
+            buffer->Release();
+
+            return ok;
+        }
+
+    private:
+        bool configure(const FrameInfo& info)
+        {
+            IMFMediaType* type = nullptr;
+            if (FAILED(MFCreateMediaType(&type))) {
+                return false;
+            }
+
+            HRESULT hr = type->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+            if (SUCCEEDED(hr)) {
+                hr = type->SetGUID(MF_MT_SUBTYPE, info.subtype);
+            }
+            if (SUCCEEDED(hr)) {
+                hr = MFSetAttributeSize(type, MF_MT_FRAME_SIZE, info.width, info.height);
+            }
+
+            const bool ok = SUCCEEDED(hr) && mDrawDevice.createHeadless() && mDrawDevice.setVideoType(type);
+            type->Release();
+
+            if (ok) {
+                mSubtype = info.subtype;
+                mWidth = info.width;
+                mHeight = info.height;
+            }
+
+            return ok;
+        }
+
+        DrawDevice mDrawDevice;
+        GUID mSubtype = GUID_NULL;
+        uint32_t mWidth = 0;
+        uint32_t mHeight = 0;
+    };
+
+    double percentile(const std::vector<double>& sorted, double p)
+    {
+        if (sorted.empty()) {
+            return 0.0;
+        }
+
+        const size_t index = std::min(sorted.size() - 1, size_t(p * double(sorted.size() - 1) + 0.5));
+        return sorted[index];
+    }
+
+    //-------------------------------------------------------------------
+    // RunConvertBenchmark
+    //
+    // Times RGB24 -> RGB32 expansion and RGB32 -> RGB24 packing with the
+    // scalar and the SIMD paths on the same random frame.
+    //-------------------------------------------------------------------
+
+    const uint32_t BENCH_ITERATIONS = 200;
+
+    template <typename Fn>
+    double timeKernel(bool simd, Fn fn, uint32_t iterations = BENCH_ITERATIONS)
+    {
+        Simd::setEnabled(simd);
+        fn();   // Warm up the caches.
+
+        const auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < iterations; i++) {
+            fn();
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+    }
+
+    int runConvertBenchmark(const Options& options)
+    {
+        const uint32_t width = options.config.width;
+        const uint32_t height = options.config.height;
+        const uint32_t stride24 = (width * 3 + 3) & ~3u;
+        const uint32_t stride32 = width * 4;
+
+        std::vector<uint8_t> rgb24(size_t(stride24) * height);
+        std::vector<uint8_t> rgb32(size_t(stride32) * height);
+        std::vector<uint8_t> packed(rgb24.size());
+
+        uint32_t seed = 1;
+        for (uint8_t& value : rgb24) {
+            seed = seed * 1664525 + 1013904223;
+            value = uint8_t(seed >> 24);
+        }
+
+        FormatConvertorRGB24 converter;
+        FormatPackerRGB24 packer;
+
+        auto expand = [&] { converter.convert(rgb32.data(), stride32, rgb24.data(), stride24, width, height); };
+        auto pack = [&] { packer.pack(packed.data(), stride24, rgb32.data(), stride32, width, height); };
+
+        const bool simdSupported = Simd::supported();
+        const double megapixels = double(width) * height / 1e6;
+
+        printf("RGB24 kernels at %ux%u, %u iterations, SIMD %s\n", width, height, BENCH_ITERATIONS,
+            simdSupported ? "available" : "not available");
+
+        struct Kernel { const char* name; std::function<void()> run; };
+        const Kernel kernels[] = { { "rgb24 -> rgb32", expand }, { "rgb32 -> rgb24", pack } };
+
+        for (const Kernel& kernel : kernels) {
+            const double scalar = timeKernel(false, kernel.run);
+            const double simd = simdSupported ? timeKernel(true, kernel.run) : scalar;
+
+            printf("%s  scalar %.3f ms (%.0f MP/s)  simd %.3f ms (%.0f MP/s)  x%.2f\n", kernel.name,
+                scalar, megapixels * 1000.0 / scalar, simd, megapixels * 1000.0 / simd, scalar / simd);
+        }
+
+        Simd::setEnabled(true);
+
+        // The round trip must give back the source frame.
+        expand();
+        pack();
+        for (uint32_t y = 0; y < height; y++) {
+            if (memcmp(packed.data() + size_t(y) * stride24, rgb24.data() + size_t(y) * stride24, width * 3) != 0) {
+                fprintf(stderr, "RGB24 round trip mismatch in row %u\n", y);
+                return 2;
+            }
+        }
+
+        return 0;
+    }
+
+    //-------------------------------------------------------------------
+    // RunDenoiseBenchmark
+    //
+    // Times the temporal denoiser on NV12 frames: scalar and SIMD on one
+    // thread, then SIMD in bands on the worker pool. Two noisy frames
+    // alternate so that every sample is blended.
+    //-------------------------------------------------------------------
+
+    int runDenoiseBenchmark(const Options& options)
+    {
+        const uint32_t width = options.config.width & ~1u;
+        const uint32_t height = options.config.height & ~1u;
+        const uint32_t strength = options.config.denoiseStrength ? options.config.denoiseStrength : 60;
+        const uint32_t threshold = options.config.denoiseThreshold;
+
+        FormatConvertorNV12 converter;
+        std::vector<uint8_t> frames[2];
+
+        uint32_t seed = 1;
+        for (std::vector<uint8_t>& frame : frames) {
+            frame.resize(size_t(width) * height * 3 / 2);
+
+            for (uint8_t& value : frame) {
+                seed = seed * 1664525 + 1013904223;
+                value = uint8_t(112 + (seed >> 27));    // Mid grey with noise.
+            }
+        }
+
+        WorkerPool pool(options.config.workerThreads, options.config.affinityMask);
+
+        printf("Temporal denoiser at %ux%u NV12, strength %u, threshold %u, %u iterations, SIMD %s\n",
+            width, height, strength, threshold, BENCH_ITERATIONS, Simd::supported() ? "available" : "not available");
+
+        struct Variant { const char* name; bool simd; uint32_t bands; WorkerPool* pool; };
+        const Variant variants[] = {
+            { "scalar, 1 thread ", false, 1, nullptr },
+            { "simd, 1 thread   ", true, 1, nullptr },
+            { "simd, worker pool", true, pool.concurrency() * 2, &pool },
+        };
+
+        for (const Variant& variant : variants) {
+            TemporalDenoiser denoiser(strength, threshold, variant.bands);
+            uint32_t index = 0;
+
+            const double ms = timeKernel(variant.simd, [&] {
+                const std::vector<uint8_t>& frame = frames[index++ & 1];
+                denoiser.process(converter.planes(frame.data(), width, width, height, frame.size()), variant.pool);
+            });
+
+            printf("%s  %.3f ms per frame (%.0f fps)\n", variant.name, ms, 1000.0 / ms);
+        }
+
+        Simd::setEnabled(true);
+        return 0;
+    }
+
+    //-------------------------------------------------------------------
+    // RunBatchBenchmark
+    //
+    // Times the batch convertor on a batch of NV12 frames with 1, 2,
+    // 4... threads up to the configured worker count, and reports how
+    // the throughput scales against one thread.
+    //-------------------------------------------------------------------
+
+    const uint32_t BENCH_BATCH_FRAMES = 32;
+    const uint32_t BENCH_BATCH_ITERATIONS = 10;
+
+    int runBatchBenchmark(const Options& options)
+    {
+        const uint32_t width = options.config.width & ~1u;
+        const uint32_t height = options.config.height & ~1u;
+        const uint32_t stride = width * 4;
+
+        // Every job reads the same source frame and writes its own.
+        FormatConvertorNV12 converter;
+        std::vector<uint8_t> source(size_t(width) * height * 3 / 2);
+        std::vector<uint8_t> destination(size_t(stride) * height * BENCH_BATCH_FRAMES);
+
+        uint32_t seed = 1;
+        for (uint8_t& value : source) {
+            seed = seed * 1664525 + 1013904223;
+            value = uint8_t(seed >> 24);
+        }
+
+        const FramePlanes planes = converter.planes(source.data(), width, width, height, source.size());
+        std::vector<ConversionJob> jobs(BENCH_BATCH_FRAMES);
+
+        const uint32_t maxThreads = options.config.workerThreads ? options.config.workerThreads :
+            std::max(std::thread::hardware_concurrency(), 1u);
+
+        std::vector<uint32_t> threadCounts;
+        for (uint32_t threads = 1; threads < maxThreads; threads *= 2) {
+            threadCounts.push_back(threads);
+        }
+        threadCounts.push_back(maxThreads);
+
+        printf("Batch convertor at %ux%u NV12, %u frames per batch, %u iterations, up to %u threads\n",
+            width, height, BENCH_BATCH_FRAMES, BENCH_BATCH_ITERATIONS, maxThreads);
+
+        double baseline = 0.0;
+        bool converted = true;
+
+        for (uint32_t threads : threadCounts) {
+            WorkerPool pool(threads, options.config.affinityMask);
+            BatchConvertor batch(pool);
+
+            const double ms = timeKernel(true, [&] {
+                for (uint32_t i = 0; i < BENCH_BATCH_FRAMES; i++) {
+                    jobs[i] = { destination.data() + size_t(stride) * height * i, stride, planes };
+                }
+                converted &= batch.convert(converter, jobs) == jobs.size();
+            }, BENCH_BATCH_ITERATIONS);
+
+            const double fps = BENCH_BATCH_FRAMES * 1000.0 / ms;
+            if (threads == 1) {
+                baseline = fps;
+            }
+
+            printf("%3u threads  %.3f ms per batch (%.0f fps)  x%.2f  efficiency %.0f%%\n", pool.concurrency(), ms,
+                fps, fps / baseline, 100.0 * fps / baseline / pool.concurrency());
+        }
+
+        if (!converted) {
+            fprintf(stderr, "Batch conversion failed\n");
+            return 2;
+        }
+
+        return 0;
+    }
+
+    int runInspect(const Options& options)
+    {
+        const uint32_t THUMBNAIL_WIDTH = 160;
+
+        RecordingReader reader;
+
+        const auto start = std::chrono::steady_clock::now();
+        if (!reader.open(options.inspect)) {
+            fwprintf(stderr, L"Cannot open %s\n", options.inspect.c_str());
+            return 1;
+        }
+        const double openMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        const RecordingFileHeader& header = reader.header();
+        const int64_t first = reader.entry(0).timestamp;
+        const int64_t last = reader.entry(reader.frameCount() - 1).timestamp;
+
+        printf("%ux%u %.4s, %zu frames over %.2f s, index from %s, opened in %.3f ms\n",
+            header.width, header.height, reinterpret_cast<const char*>(&header.subtype.Data1),
+            reader.frameCount(), double(last - first) / 1e7, reader.hasSidecar() ? "sidecar" : "scan", openMs);
+
+        uint32_t seed = 1;
+        auto randomTime = [&] {
+            seed = seed * 1664525 + 1013904223;
+            return first + int64_t(uint64_t(seed) * uint64_t(last - first + 1) >> 32);
+        };
+
+        // Kept so that the seeks are not optimized away.
+        volatile size_t found = 0;
+        const double seekMs = timeKernel(true, [&] {
+            found = reader.seek(randomTime());
+        });
+
+        const uint32_t thumbnailHeight = std::max(header.height * THUMBNAIL_WIDTH / std::max(header.width, 1u), 1u);
+        std::vector<uint8_t> pixels;
+        bool thumbnails = true;
+
+        const double thumbnailMs = timeKernel(true, [&] {
+            thumbnails &= reader.thumbnail(reader.seek(randomTime()), THUMBNAIL_WIDTH, thumbnailHeight, pixels);
+        });
+
+        printf("seek          %.3f us\n", seekMs * 1000.0);
+        printf("thumbnail     %.3f ms at %ux%u%s\n", thumbnailMs, THUMBNAIL_WIDTH, thumbnailHeight,
+            thumbnails ? "" : " (failed)");
+
+        return thumbnails ? 0 : 2;
+    }
+
+    //-------------------------------------------------------------------
+    // RunReprocess
+    //
+    // Converts every frame of a recorded segment to RGB32, a batch of
+    // whole frames per dispatch of the worker pool. The converted frames
+    // keep the recorded metadata and are recorded if --record is given.
+    //-------------------------------------------------------------------
+
+    const uint32_t REPROCESS_FRAMES_PER_THREAD = 8;
+
+    int runReprocess(const Options& options)
+    {
+        RecordingReader reader;
+        if (!reader.open(options.reprocess)) {
+            fwprintf(stderr, L"Cannot open %s\n", options.reprocess.c_str());
+            return 1;
+        }
+
+        const RecordingFileHeader& header = reader.header();
+        const FormatConvertor* converter = DrawDevice::findConversionFunction(header.subtype);
+        if (!converter) {
+            fprintf(stderr, "Cannot convert %.4s frames\n", reinterpret_cast<const char*>(&header.subtype.Data1));
+            return 1;
+        }
+
+        // The recorder is fed directly, not started on a source.
+        std::unique_ptr<SegmentRecorder> recorder;
+        if (options.config.hasSink("record")) {
+            if (options.config.recordingFormat != RecordingContainer::Raw) {
+                fprintf(stderr, "RGB32 frames can only be recorded as raw segments\n");
+                return 1;
+            }
+
+            recorder = std::make_unique<SegmentRecorder>(SegmentRecorder::configure(options.config));
+        }
+
+        WorkerPool pool(options.config.workerThreads, options.config.affinityMask);
+        BatchConvertor batch(pool);
+
+        const uint32_t stride = header.width * 4;
+        const DWORD frameBytes = DWORD(stride) * header.height;
+        const size_t batchSize = size_t(pool.concurrency()) * REPROCESS_FRAMES_PER_THREAD;
+
+        auto framePool = std::make_shared<FramePool>(batchSize);
+        if (!framePool->allocate(frameBytes)) {
+            fprintf(stderr, "Cannot allocate %zu frames of %ux%u\n", batchSize, header.width, header.height);
+            return 1;
+        }
+
+        struct Output
+        {
+            size_t frame = 0;   // Index in the segment.
+            Frame converted;
+            IMFMediaBuffer* buffer = nullptr;
+        };
+
+        std::vector<Output> outputs;
+        std::vector<ConversionJob> jobs;
+        outputs.reserve(batchSize);
+        jobs.reserve(batchSize);
+
+        uint64_t converted = 0;
+        uint64_t failures = 0;
+
+        const auto start = std::chrono::steady_clock::now();
+
+        for (size_t first = 0; first < reader.frameCount(); first += batchSize) {
+            const size_t last = std::min(first + batchSize, reader.frameCount());
+
+            // Every slot is free again once the previous batch is gone.
+            outputs.clear();
+            jobs.clear();
+
+            for (size_t frame = first; frame < last; frame++) {
+                Output output;
+                output.frame = frame;
+                output.converted = framePool->acquire();
+
+                FramePlanes planes;
+                BYTE* destination = nullptr;
+
+                if (!reader.framePlanes(frame, *converter, planes) || !output.converted ||
+                    FAILED(output.converted.sample()->GetBufferByIndex(0, &output.buffer)) ||
+                    FAILED(output.buffer->Lock(&destination, nullptr, nullptr))) {
+                    SafeRelease(&output.buffer);
+                    ++failures;
+                    continue;
+                }
+
+                jobs.push_back({ destination, stride, planes });
+                outputs.push_back(std::move(output));
+            }
+
+            batch.convert(*converter, jobs);
+
+            for (size_t i = 0; i < outputs.size(); i++) {
+                Output& output = outputs[i];
+                output.buffer->Unlock();
+
+                if (jobs[i].converted && SUCCEEDED(output.buffer->SetCurrentLength(frameBytes))) {
+                    FrameInfo info;
+                    static_cast<FrameMetadata&>(info) = reader.metadata(output.frame);
+                    info.subtype = MFVideoFormat_RGB32;
+                    info.width = header.width;
+                    info.height = header.height;
+                    output.converted.setInfo(info);
+
+                    if (!recorder || recorder->push(output.converted)) {
+                        ++converted;
+                    }
+                    else {
+                        ++failures;
+                    }
+                }
+                else {
+                    ++failures;
+                }
+
+                SafeRelease(&output.buffer);
+            }
+        }
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (recorder) {
+            recorder->stop();
+        }
+
+        printf("frames        %llu of %zu in %.2f s (%.1f fps) on %u threads\n", converted, reader.frameCount(),
+            seconds, double(converted) / seconds, pool.concurrency());
+        printf("failures      %llu\n", failures);
+        if (recorder) {
+            printf("recorded      %u segments\n", recorder->segments());
+        }
+
+        return failures == 0 && converted > 0 ? 0 : 2;
+    }
+
+    int runSession(const Options& options)
+    {
+        std::unique_ptr<FrameSource> source;
+        FileReplaySource* replay = nullptr;
+        Camera* camera = nullptr;
+
+        if (options.source == L"file") {
+            auto file = std::make_unique<FileReplaySource>(options.file, !options.unpaced, options.loop);
+
+            if (!file->start()) {
+                fwprintf(stderr, L"Cannot replay %s\n", options.file.c_str());
+                return 1;
+            }
+
+            replay = file.get();
+            source = std::move(file);
+        }
+        else if (options.source == L"synthetic") {
+            auto synthetic = std::make_unique<SyntheticSource>(parseFormat(options.format),
+                options.config.width, options.config.height, options.config.fps, !options.unpaced);
+
+            if (!synthetic->start()) {
+                fprintf(stderr, "Cannot start the synthetic source\n");
+                return 1;
+            }
+
+            source = std::move(synthetic);
+        }
+        else {
+            // Headless camera; it converts to RGB32 itself.
+            auto device = std::make_unique<Camera>(nullptr, nullptr, options.config);
+            if (!device->init()) {
+                fprintf(stderr, "Cannot open a capture device\n");
+                return 1;
+            }
+
+            camera = device.get();
+            source = std::move(device);
+        }
+
+        // The headless camera already converts every frame to RGB32. The
+        // convert sink takes those frames instead of converting again,
+        // and the camera's own conversion time is reported.
+        const bool cameraConverts = camera && options.sink == L"convert";
+        FrameSource& consumed = cameraConverts ? camera->convertedFrames() : *source;
+
+        std::shared_ptr<FrameStream> stream = consumed.subscribe(options.config.streamCapacity);
+
+        // The recorder takes its own copy of the stream; with square
+        // pixels, of the camera's converted frames, unless Y4M needs YUV.
+        std::unique_ptr<SegmentRecorder> recorder;
+        if (options.config.hasSink("record")) {
+            const bool squareFrames = camera && options.config.squarePixels &&
+                options.config.recordingFormat == RecordingContainer::Raw;
+
+            recorder = std::make_unique<SegmentRecorder>(SegmentRecorder::configure(options.config));
+            if (!recorder->start(squareFrames ? camera->convertedFrames() : *source)) {
+                fprintf(stderr, "Cannot start recording\n");
+                return 1;
+            }
+        }
+
+        const bool convert = options.sink == L"convert" && !cameraConverts;
+        ConvertSink sink;
+
+        MetricHistogram& conversionTime = Metrics::instance().histogram("mfcamera_conversion_seconds",
+            "Time to convert one frame to RGB32.");
+        const uint64_t conversionsStart = conversionTime.count();
+        const uint64_t conversionMicrosStart = conversionTime.sum();
+
+        LARGE_INTEGER frequency = {};
+        QueryPerformanceFrequency(&frequency);
+
+        std::vector<double> latencies;
+        latencies.reserve(size_t(options.duration) * options.config.fps * 2);
+
+        uint64_t frames = 0;
+        uint64_t failures = 0;
+        uint64_t sequenceGaps = 0;
+        uint64_t lastSequence = 0;
+
+        const uint64_t cpuStart = processCpuTime();
+        const auto start = std::chrono::steady_clock::now();
+        const auto end = start + std::chrono::seconds(options.duration);
+
+        while (std::chrono::steady_clock::now() < end) {
+            std::optional<Frame> frame = stream->pop(std::chrono::milliseconds(500));
+            if (!frame) {
+                // A replayed file has ended once its last frame is taken.
+                if (replay && replay->finished() && stream->size() == 0) {
+                    break;
+                }
+
+                continue;
+            }
+
+            if (convert && !sink.process(*frame)) {
+                ++failures;
+            }
+
+            LARGE_INTEGER now = {};
+            QueryPerformanceCounter(&now);
+
+            const FrameInfo& info = frame->info();
+            latencies.push_back(double(now.QuadPart - info.captureTime) * 1000.0 / double(frequency.QuadPart));
+
+            if (frames > 0 && info.sequence > lastSequence + 1) {
+                sequenceGaps += info.sequence - lastSequence - 1;
+            }
+            lastSequence = info.sequence;
+            ++frames;
+        }
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const double cpuSeconds = double(processCpuTime() - cpuStart) / 1e7;
+
+        const uint64_t queueDrops = stream->droppedFrames();
+        const uint64_t sourceDrops = source->droppedFrames() + (cameraConverts ? consumed.droppedFrames() : 0);
+        const uint64_t conversions = conversionTime.count() - conversionsStart;
+        const uint64_t conversionMicros = conversionTime.sum() - conversionMicrosStart;
+
+        stream->close();
+
+        if (recorder) {
+            recorder->stop();
+        }
+
+        source.reset();
+
+        std::sort(latencies.begin(), latencies.end());
+
+        SYSTEM_INFO system = {};
+        GetSystemInfo(&system);
+
+        printf("frames        %llu in %.2f s (%.2f fps)\n", frames, seconds, double(frames) / seconds);
+        printf("latency ms    p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+            percentile(latencies, 0.50), percentile(latencies, 0.90),
+            percentile(latencies, 0.99), latencies.empty() ? 0.0 : latencies.back());
+        // Sequence gaps cover every loss between capture and this consumer.
+        printf("dropped       %llu (queue %llu, frame pool %llu)\n", sequenceGaps, queueDrops, sourceDrops);
+        printf("sink failures %llu\n", failures);
+        if (cameraConverts && conversions > 0) {
+            printf("conversion    %.3f ms mean over %llu frames, in the camera\n",
+                double(conversionMicros) / 1000.0 / double(conversions), conversions);
+        }
+        if (recorder) {
+            printf("recorded      %u segments, %llu frames not written\n", recorder->segments(),
+                recorder->droppedFrames());
+        }
+        printf("cpu           %.1f%% of one core, %.1f%% of %u cores\n",
+            100.0 * cpuSeconds / seconds, 100.0 * cpuSeconds / seconds / system.dwNumberOfProcessors,
+            system.dwNumberOfProcessors);
+
+        return failures == 0 && frames > 0 ? 0 : 2;
+    }
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    if (options.benchConvert) {
+        return runConvertBenchmark(options);
+    }
+
+    if (options.benchDenoise) {
+        return runDenoiseBenchmark(options);
+    }
+
+    if (options.benchBatch) {
+        return runBatchBenchmark(options);
+    }
+
+    if (!options.inspect.empty()) {
+        return runInspect(options);
+    }
+
+    if (FAILED(CoInitializeEx(nullptr, COINIT_MULTITHREADED))) {
+        return 1;
+    }
+
+    if (FAILED(MFStartup(MF_VERSION))) {
+        CoUninitialize();
+        return 1;
+    }
+
+    // Reprocessing allocates its frames from Media Foundation.
+    if (!options.reprocess.empty()) {
+        const int result = runReprocess(options);
+
+        MFShutdown();
+        CoUninitialize();
+
+        return result;
+    }
+
+    MetricsServer metricsServer;
+    if (options.config.metricsPort != 0 && !metricsServer.start(options.config.metricsPort)) {
+        fprintf(stderr, "Cannot serve metrics on port %u\n", options.config.metricsPort);
+    }
+
+    const int result = runSession(options);
+
+    metricsServer.stop();
+
+    MFShutdown();
+    CoUninitialize();
+
+    return result;
+}
@@ -0,0 +1,151 @@
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <windows.h>
+
+void MetricHistogram::observe(uint64_t microseconds)
+{
+    for (size_t i = 0; i < BUCKETS; i++) {
+        if (microseconds <= bound(i)) {
+            mBuckets[i].fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+    }
+
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    mSum.fetch_add(microseconds, std::memory_order_relaxed);
+}
+
+Metrics& Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::Entry& Metrics::find(const std::string& name, const std::string& help, Type type)
+{
+    std::lock_guard lock(mMutex);
+
+    auto it = std::find_if(mEntries.begin(), mEntries.end(), [&](const std::unique_ptr<Entry>& entry) {
+        return entry->name == name;
+    });
+
+    if (it != mEntries.end()) {
+        return **it;
+    }
+
+    auto entry = std::make_unique<Entry>();
+    entry->name = name;
+    entry->help = help;
+    entry->type = type;
+
+    switch (type) {
+    case Type::Counter:
+    case Type::SecondsCounter:
+        entry->counter = std::make_unique<MetricCounter>();
+        break;
+    case Type::Gauge:
+        entry->gauge = std::make_unique<MetricGauge>();
+        break;
+    case Type::Histogram:
+        entry->histogram = std::make_unique<MetricHistogram>();
+        break;
+    }
+
+    mEntries.push_back(std::move(entry));
+    return *mEntries.back();
+}
+
+MetricCounter& Metrics::counter(const std::string& name, const std::string& help)
+{
+    return *find(name, help, Type::Counter).counter;
+}
+
+MetricCounter& Metrics::secondsCounter(const std::string& name, const std::string& help)
+{
+    return *find(name, help, Type::SecondsCounter).counter;
+}
+
+MetricGauge& Metrics::gauge(const std::string& name, const std::string& help)
+{
+    return *find(name, help, Type::Gauge).gauge;
+}
+
+MetricHistogram& Metrics::histogram(const std::string& name, const std::string& help)
+{
+    return *find(name, help, Type::Histogram).histogram;
+}
+
+//-------------------------------------------------------------------
+// Render
+//
+// Prometheus text exposition format, version 0.0.4. Histograms and
+// seconds counters are exported in seconds.
+//-------------------------------------------------------------------
+
+std::string Metrics::render() const
+{
+    std::lock_guard lock(mMutex);
+
+    std::string text;
+    char line[256];
+
+    for (const std::unique_ptr<Entry>& entry : mEntries) {
+        const char* name = entry->name.c_str();
+
+        text += "# HELP " + entry->name + " " + entry->help + "\n";
+
+        switch (entry->type) {
+        case Type::Counter:
+            snprintf(line, sizeof(line), "# TYPE %s counter\n%s %llu\n", name, name, entry->counter->value());
+            text += line;
+            break;
+
+        case Type::SecondsCounter:
+            snprintf(line, sizeof(line), "# TYPE %s counter\n%s %g\n", name, name,
+                double(entry->counter->value()) / 1e6);
+            text += line;
+            break;
+
+        case Type::Gauge:
+            snprintf(line, sizeof(line), "# TYPE %s gauge\n%s %lld\n", name, name, entry->gauge->value());
+            text += line;
+            break;
+
+        case Type::Histogram: {
+            const MetricHistogram& histogram = *entry->histogram;
+
+            snprintf(line, sizeof(line), "# TYPE %s histogram\n", name);
+            text += line;
+
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i < MetricHistogram::BUCKETS; i++) {
+                cumulative += histogram.bucketCount(i);
+                snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %llu\n",
+                    name, double(MetricHistogram::bound(i)) / 1e6, cumulative);
+                text += line;
+            }
+
+            snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %g\n%s_count %llu\n",
+                name, histogram.count(), name, double(histogram.sum()) / 1e6, name, histogram.count());
+            text += line;
+            break;
+        }
+        }
+    }
+
+    return text;
+}
+
+uint64_t ElapsedMicroseconds(int64_t start, int64_t end)
+{
+    static const int64_t frequency = [] {
+        LARGE_INTEGER value = {};
+        QueryPerformanceFrequency(&value);
+        return value.QuadPart;
+    }();
+
+    return end > start ? uint64_t((end - start) * 1000000 / frequency) : 0;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//-------------------------------------------------------------------
+// Metrics
+//
+// Process-wide registry of counters, gauges and histograms that the
+// capture pipeline updates lock-free on the hot path. Metrics are
+// registered once at startup; the references returned stay valid
+// for the lifetime of the process.
+//
+// render() produces the Prometheus text exposition format.
+//-------------------------------------------------------------------
+
+class MetricCounter
+{
+public:
+    void add(uint64_t value = 1) { mValue.fetch_add(value, std::memory_order_relaxed); }
+    uint64_t value() const { return mValue.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> mValue = 0;
+};
+
+class MetricGauge
+{
+public:
+    void set(int64_t value) { mValue.store(value, std::memory_order_relaxed); }
+    int64_t value() const { return mValue.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> mValue = 0;
+};
+
+// Fixed exponential buckets: 0.1 ms .. ~1.6 s in microseconds.
+class MetricHistogram
+{
+public:
+    static constexpr size_t BUCKETS = 15;
+
+    void observe(uint64_t microseconds);
+
+    static uint64_t bound(size_t bucket) { return uint64_t(100) << bucket; }
+    uint64_t bucketCount(size_t bucket) const { return mBuckets[bucket].load(std::memory_order_relaxed); }
+    uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return mSum.load(std::memory_order_relaxed); }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> mBuckets = {};
+    std::atomic<uint64_t> mCount = 0;
+    std::atomic<uint64_t> mSum = 0;
+};
+
+class Metrics
+{
+public:
+    static Metrics& instance();
+
+    MetricCounter& counter(const std::string& name, const std::string& help);
+    // A counter of microseconds, exported in seconds like histograms.
+    MetricCounter& secondsCounter(const std::string& name, const std::string& help);
+    MetricGauge& gauge(const std::string& name, const std::string& help);
+    MetricHistogram& histogram(const std::string& name, const std::string& help);
+
+    std::string render() const;
+
+private:
+    enum class Type
+    {
+        Counter, SecondsCounter, Gauge, Histogram
+    };
+
+    struct Entry
+    {
+        std::string name;
+        std::string help;
+        Type type = Type::Counter;
+        std::unique_ptr<MetricCounter> counter;
+        std::unique_ptr<MetricGauge> gauge;
+        std::unique_ptr<MetricHistogram> histogram;
+    };
+
+    Entry& find(const std::string& name, const std::string& help, Type type);
+
+    std::vector<std::unique_ptr<Entry>> mEntries;
+    mutable std::mutex mMutex;
+};
+
+// Microseconds between two QueryPerformanceCounter readings.
+uint64_t ElapsedMicroseconds(int64_t start, int64_t end);
@@ -0,0 +1,206 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "MetricsServer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include "Metrics.h"
+#include "Debug.h"
+
+#pragma comment(lib, "ws2_32.lib")
+
+namespace {
+    const size_t MAX_REQUEST_SIZE = 4096;
+    const DWORD RECEIVE_TIMEOUT_MS = 2000;
+    const DWORD ACCEPT_BACKOFF_MIN_MS = 10;
+    const DWORD ACCEPT_BACKOFF_MAX_MS = 500;
+
+    // accept errors that can clear up by themselves: a client that gave
+    // up, or sockets and buffers running short for a while.
+    bool isTransientAcceptError(int error)
+    {
+        switch (error) {
+        case WSAEINTR:
+        case WSAEWOULDBLOCK:
+        case WSAECONNRESET:
+        case WSAEMFILE:
+        case WSAENOBUFS:
+        case WSAENETDOWN:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    void sendAll(SOCKET client, const std::string& data)
+    {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            const int result = send(client, data.data() + sent, int(data.size() - sent), 0);
+            if (result == SOCKET_ERROR) {
+                return;
+            }
+
+            sent += size_t(result);
+        }
+    }
+
+    void sendResponse(SOCKET client, const char* status, const char* contentType, const std::string& body)
+    {
+        char header[256];
+        snprintf(header, sizeof(header),
+            "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+            status, contentType, body.size());
+
+        sendAll(client, header + body);
+    }
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+bool MetricsServer::start(uint16_t port)
+{
+    if (mStarted) {
+        return false;
+    }
+
+    WSADATA data = {};
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+        Error("Metrics: WSAStartup failed\n");
+        return false;
+    }
+
+    const SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET) {
+        WSACleanup();
+        return false;
+    }
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR ||
+        listen(listener, SOMAXCONN) == SOCKET_ERROR) {
+        Error("Metrics: cannot listen on port %u (%d)\n", port, WSAGetLastError());
+        closesocket(listener);
+        WSACleanup();
+        return false;
+    }
+
+    mListener = listener;
+
+    mStopping = false;
+    mStarted = true;
+    mThread = std::thread(&MetricsServer::run, this, mListener);
+
+    Info("Metrics: serving http://127.0.0.1:%u/metrics\n", port);
+    return true;
+}
+
+void MetricsServer::stop()
+{
+    if (!mStarted) {
+        return;
+    }
+
+    // Closing the listener makes accept return.
+    mStopping = true;
+    closesocket(SOCKET(mListener));
+    mListener = INVALID_SOCKET;
+
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+
+    WSACleanup();
+    mStarted = false;
+}
+
+//-------------------------------------------------------------------
+// Run
+//
+// Transient accept errors are retried with a growing delay instead of
+// at once, so that a listener that keeps failing does not spin a
+// core; any other error ends the server.
+//-------------------------------------------------------------------
+
+void MetricsServer::run(uintptr_t listener)
+{
+    DWORD backoff = 0;
+
+    while (!mStopping) {
+        const SOCKET client = accept(SOCKET(listener), nullptr, nullptr);
+        if (client == INVALID_SOCKET) {
+            const int error = WSAGetLastError();
+            if (mStopping) {
+                break;
+            }
+
+            if (!isTransientAcceptError(error)) {
+                Error("Metrics: accept failed (%d), no longer serving\n", error);
+                break;
+            }
+
+            backoff = std::min(backoff ? backoff * 2 : ACCEPT_BACKOFF_MIN_MS, ACCEPT_BACKOFF_MAX_MS);
+            Sleep(backoff);
+            continue;
+        }
+
+        backoff = 0;
+
+        serve(client);
+        closesocket(client);
+    }
+}
+
+//-------------------------------------------------------------------
+// Serve
+//
+// Reads the request head and answers it. Only the request line is
+// looked at; headers and bodies are ignored.
+//-------------------------------------------------------------------
+
+void MetricsServer::serve(uintptr_t handle)
+{
+    const SOCKET client = SOCKET(handle);
+
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO,
+        reinterpret_cast<const char*>(&RECEIVE_TIMEOUT_MS), sizeof(RECEIVE_TIMEOUT_MS));
+
+    std::string request;
+    char chunk[512];
+
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < MAX_REQUEST_SIZE) {
+        const int received = recv(client, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            return;
+        }
+
+        request.append(chunk, size_t(received));
+    }
+
+    const std::string line = request.substr(0, request.find("\r\n"));
+
+    if (line.rfind("GET ", 0) != 0) {
+        sendResponse(client, "405 Method Not Allowed", "text/plain", "Method not allowed\n");
+        return;
+    }
+
+    const size_t pathEnd = line.find(' ', 4);
+    const std::string path = line.substr(4, pathEnd == std::string::npos ? std::string::npos : pathEnd - 4);
+
+    if (path != "/metrics") {
+        sendResponse(client, "404 Not Found", "text/plain", "Not found\n");
+        return;
+    }
+
+    sendResponse(client, "200 OK", "text/plain; version=0.0.4; charset=utf-8", Metrics::instance().render());
+}
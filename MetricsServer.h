@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+//-------------------------------------------------------------------
+// MetricsServer
+//
+// Minimal HTTP endpoint for Prometheus scrapes. Listens on the
+// loopback interface only and answers GET /metrics with the text
+// exposition of the process-wide Metrics registry:
+//
+//     curl http://127.0.0.1:9464/metrics
+//
+// Requests are served one at a time on a dedicated thread; a scrape
+// never touches the capture path beyond reading atomics.
+//-------------------------------------------------------------------
+
+class MetricsServer
+{
+public:
+    MetricsServer() = default;
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    bool start(uint16_t port);
+    void stop();
+
+private:
+    void run(uintptr_t listener);
+    void serve(uintptr_t client);
+
+    // A SOCKET; kept opaque so that this header does not pull in
+    // winsock2.h ahead of windows.h in the including file.
+    uintptr_t mListener = ~uintptr_t(0);
+    std::atomic<bool> mStopping = false;
+    bool mStarted = false;
+    std::thread mThread;
+};
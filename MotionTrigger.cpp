@@ -0,0 +1,105 @@
+#include "MotionTrigger.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include <windows.h>
+
+namespace {
+    // BT.601 luma of a BGRA pixel, integer weights summing to 256.
+    inline uint8_t luma(const uint8_t* pixel)
+    {
+        return uint8_t((pixel[0] * 29 + pixel[1] * 150 + pixel[2] * 77) >> 8);
+    }
+}
+
+MotionTrigger::MotionTrigger(std::function<void()> handler, uint32_t threshold, uint32_t area,
+    uint32_t cooldownMs)
+    : mHandler(std::move(handler))
+    , mThreshold(threshold)
+    , mArea(area)
+    , mCooldownMs(cooldownMs)
+{
+}
+
+//-------------------------------------------------------------------
+// Process
+//
+// The first frame, and the first after a change of size, only fills
+// the grid; it has no motion stat. The grid of this frame is sampled
+// into the frame's arena and kept for the next frame afterwards; a
+// frame whose arena is full is not analysed.
+//-------------------------------------------------------------------
+
+void MotionTrigger::process(uint8_t* frame, uint32_t stride, uint32_t width, uint32_t height, FrameStats& stats,
+    FrameArena& arena)
+{
+    const uint32_t columns = width / GRID_STEP;
+    const uint32_t rows = height / GRID_STEP;
+    if (columns == 0 || rows == 0) {
+        return;
+    }
+
+    const uint32_t points = columns * rows;
+
+    uint8_t* grid = arena.allocate<uint8_t>(points);
+    if (!grid) {
+        return;
+    }
+
+    const bool primed = width == mWidth && height == mHeight;
+    if (!primed) {
+        mPrevious.resize(points);
+        mWidth = width;
+        mHeight = height;
+    }
+
+    uint32_t changed = 0;
+    uint64_t sum = 0;
+    const uint8_t* previous = mPrevious.data();
+    uint8_t* current = grid;
+
+    for (uint32_t row = 0; row < rows; row++) {
+        const uint8_t* line = frame + size_t(row * GRID_STEP + GRID_STEP / 2) * stride;
+
+        for (uint32_t column = 0; column < columns; column++) {
+            const uint8_t value = luma(line + size_t(column * GRID_STEP + GRID_STEP / 2) * 4);
+
+            if (uint32_t(std::abs(int(value) - int(*previous++))) > mThreshold) {
+                changed++;
+            }
+
+            sum += value;
+            *current++ = value;
+        }
+    }
+
+    memcpy(mPrevious.data(), grid, points);
+
+    stats.meanLuma = uint8_t(sum / points);
+    stats.valid |= FRAME_STATS_LUMA;
+
+    if (!primed) {
+        return;
+    }
+
+    stats.motion = uint16_t(uint64_t(changed) * 1000 / points);
+    stats.valid |= FRAME_STATS_MOTION;
+
+    if (uint64_t(changed) * 1000 <= uint64_t(mArea) * points) {
+        return;
+    }
+
+    const uint64_t now = GetTickCount64();
+    if (mTriggered && now - mLastTrigger < mCooldownMs) {
+        return;
+    }
+
+    mTriggered = true;
+    mLastTrigger = now;
+
+    if (mHandler) {
+        mHandler();
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "FrameStage.h"
+
+//-------------------------------------------------------------------
+// MotionTrigger
+//
+// Calls a handler when the picture changes. Every frame is sampled on
+// a coarse grid of luma values and compared with the previous frame;
+// if more than the given share of grid points changed by more than the
+// threshold, the handler is called, at most once per cooldown.
+//
+// The stage only reads the frame. The grid of each frame is sampled
+// into the frame's arena; the changed share and the mean of the grid
+// go into the frame's stats. The handler runs on the render
+// thread and should hand off anything slow.
+//-------------------------------------------------------------------
+
+class MotionTrigger : public FrameStage
+{
+public:
+    // threshold: luma difference in code values that counts as change.
+    // area: changed grid points in 1/1000 of the grid.
+    MotionTrigger(std::function<void()> handler, uint32_t threshold = 24, uint32_t area = 20,
+        uint32_t cooldownMs = 10000);
+
+    MotionTrigger(const MotionTrigger&) = delete;
+    MotionTrigger& operator=(const MotionTrigger&) = delete;
+
+    void process(uint8_t* frame, uint32_t stride, uint32_t width, uint32_t height, FrameStats& stats,
+        FrameArena& arena) override;
+
+private:
+    static const uint32_t GRID_STEP = 8;
+
+    std::function<void()> mHandler;
+    const uint32_t mThreshold;
+    const uint32_t mArea;
+    const uint64_t mCooldownMs;
+
+    std::vector<uint8_t> mPrevious;
+    uint32_t mWidth = 0;
+    uint32_t mHeight = 0;
+    uint64_t mLastTrigger = 0;
+    bool mTriggered = false;
+};
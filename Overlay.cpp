@@ -0,0 +1,309 @@
+#include "Overlay.h"
+
+#include <algorithm>
+
+#include "Simd.h"
+
+namespace {
+    // x * y / 255, rounded, for x, y in [0, 255].
+    inline uint32_t mulDiv255(uint32_t x, uint32_t y)
+    {
+        const uint32_t t = x * y + 128;
+        return (t + (t >> 8)) >> 8;
+    }
+
+    uint32_t premultiply(uint32_t argb)
+    {
+        const uint32_t a = argb >> 24;
+        const uint32_t r = mulDiv255((argb >> 16) & 0xff, a);
+        const uint32_t g = mulDiv255((argb >> 8) & 0xff, a);
+        const uint32_t b = mulDiv255(argb & 0xff, a);
+
+        return (a << 24) | (r << 16) | (g << 8) | b;
+    }
+
+    // Premultiplied "over": src + dst * (1 - src alpha), per channel.
+    inline uint32_t over(uint32_t src, uint32_t dst)
+    {
+        const uint32_t inverse = 255 - (src >> 24);
+
+        uint32_t result = 0;
+        for (uint32_t shift = 0; shift < 32; shift += 8) {
+            const uint32_t channel = ((src >> shift) & 0xff) + mulDiv255((dst >> shift) & 0xff, inverse);
+            result |= std::min(channel, 255u) << shift;
+        }
+
+        return result;
+    }
+
+    void blendRowScalar(uint32_t* dest, const uint32_t* overlay, uint32_t begin, uint32_t count)
+    {
+        for (uint32_t x = begin; x < count; x++) {
+            if (overlay[x] != 0) {
+                dest[x] = over(overlay[x], dest[x]);
+            }
+        }
+    }
+
+#if MFCAMERA_SIMD_SSSE3
+    uint32_t blendRowSimd(uint32_t* dest, const uint32_t* overlay, uint32_t count)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i bias = _mm_set1_epi16(128);
+        const __m128i alphaMask = _mm_setr_epi8(3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+        const __m128i ones = _mm_set1_epi8(-1);
+
+        uint32_t x = 0;
+        for (; x + 4 <= count; x += 4) {
+            const __m128i src = _mm_loadu_si128((const __m128i*)(overlay + x));
+
+            // Fully transparent pixels leave the frame untouched.
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(src, zero)) == 0xffff) {
+                continue;
+            }
+
+            const __m128i dst = _mm_loadu_si128((const __m128i*)(dest + x));
+            const __m128i inverse = _mm_xor_si128(_mm_shuffle_epi8(src, alphaMask), ones);
+
+            __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), _mm_unpacklo_epi8(inverse, zero)), bias);
+            __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), _mm_unpackhi_epi8(inverse, zero)), bias);
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+            _mm_storeu_si128((__m128i*)(dest + x), _mm_adds_epu8(src, _mm_packus_epi16(lo, hi)));
+        }
+
+        return x;
+    }
+#elif MFCAMERA_SIMD_NEON
+    uint32_t blendRowSimd(uint32_t* dest, const uint32_t* overlay, uint32_t count)
+    {
+        uint32_t x = 0;
+        for (; x + 8 <= count; x += 8) {
+            const uint8x8x4_t src = vld4_u8((const uint8_t*)(overlay + x));
+            if (vmaxv_u8(src.val[3]) == 0) {
+                continue;
+            }
+
+            uint8x8x4_t dst = vld4_u8((const uint8_t*)(dest + x));
+            const uint8x8_t inverse = vmvn_u8(src.val[3]);
+
+            for (int c = 0; c < 4; c++) {
+                const uint16x8_t t = vmull_u8(dst.val[c], inverse);
+                dst.val[c] = vqadd_u8(src.val[c], vraddhn_u16(t, vrshrq_n_u16(t, 8)));
+            }
+
+            vst4_u8((uint8_t*)(dest + x), dst);
+        }
+
+        return x;
+    }
+#else
+    uint32_t blendRowSimd(uint32_t*, const uint32_t*, uint32_t)
+    {
+        return 0;
+    }
+#endif
+}
+
+bool OverlayElement::operator==(const OverlayElement& other) const
+{
+    return kind == other.kind && EqualRect(&rect, &other.rect) && color == other.color &&
+        thickness == other.thickness && pixels == other.pixels;
+}
+
+Overlay::Overlay(uint32_t width, uint32_t height) :
+    mWidth(width), mHeight(height),
+    mTilesX((width + TILE_SIZE - 1) / TILE_SIZE), mTilesY((height + TILE_SIZE - 1) / TILE_SIZE),
+    mSurface(size_t(width) * height), mTiles(size_t(mTilesX) * mTilesY)
+{
+}
+
+void Overlay::set(uint32_t id, const OverlayElement& element)
+{
+    std::lock_guard lock(mMutex);
+
+    auto it = mElements.find(id);
+    if (it != mElements.end() && it->second == element) {
+        return;
+    }
+
+    mElements[id] = element;
+    mDirty = true;
+}
+
+void Overlay::remove(uint32_t id)
+{
+    std::lock_guard lock(mMutex);
+
+    if (mElements.erase(id) > 0) {
+        mDirty = true;
+    }
+}
+
+void Overlay::clear()
+{
+    std::lock_guard lock(mMutex);
+
+    if (!mElements.empty()) {
+        mElements.clear();
+        mDirty = true;
+    }
+}
+
+//-------------------------------------------------------------------
+// Process
+//
+// Blends the cached surface over the frame, region by region. The
+// regions are disjoint, so no pixel is blended twice.
+//-------------------------------------------------------------------
+
+void Overlay::process(uint8_t* frame, uint32_t stride, uint32_t width, uint32_t height, FrameStats&, FrameArena&)
+{
+    std::lock_guard lock(mMutex);
+
+    if (mDirty) {
+        rebuild();
+    }
+
+    const bool simd = Simd::enabled();
+
+    for (const RECT& region : mRegions) {
+        const uint32_t left = uint32_t(region.left);
+        const uint32_t right = std::min(uint32_t(region.right), width);
+        const uint32_t bottom = std::min(uint32_t(region.bottom), height);
+
+        if (left >= right) {
+            continue;
+        }
+
+        for (uint32_t y = uint32_t(region.top); y < bottom; y++) {
+            uint32_t* dest = (uint32_t*)(frame + size_t(y) * stride) + left;
+            const uint32_t* overlay = mSurface.data() + size_t(y) * mWidth + left;
+            const uint32_t count = right - left;
+
+            const uint32_t done = simd ? blendRowSimd(dest, overlay, count) : 0;
+            blendRowScalar(dest, overlay, done, count);
+        }
+    }
+}
+
+//-------------------------------------------------------------------
+// Rebuild
+//
+// Flattens the elements into the surface in id order and collects
+// the tiles they cover.
+//-------------------------------------------------------------------
+
+void Overlay::rebuild()
+{
+    std::fill(mSurface.begin(), mSurface.end(), 0);
+    std::fill(mTiles.begin(), mTiles.end(), uint8_t(0));
+
+    for (const auto& [id, element] : mElements) {
+        draw(element);
+    }
+
+    mRegions.clear();
+
+    for (uint32_t ty = 0; ty < mTilesY; ty++) {
+        uint32_t tx = 0;
+        while (tx < mTilesX) {
+            if (!mTiles[ty * mTilesX + tx]) {
+                ++tx;
+                continue;
+            }
+
+            const uint32_t first = tx;
+            while (tx < mTilesX && mTiles[ty * mTilesX + tx]) {
+                ++tx;
+            }
+
+            RECT region;
+            region.left = LONG(first * TILE_SIZE);
+            region.top = LONG(ty * TILE_SIZE);
+            region.right = LONG(std::min(tx * TILE_SIZE, mWidth));
+            region.bottom = LONG(std::min((ty + 1) * TILE_SIZE, mHeight));
+            mRegions.push_back(region);
+        }
+    }
+
+    mDirty = false;
+}
+
+void Overlay::draw(const OverlayElement& element)
+{
+    const RECT& r = element.rect;
+
+    auto fill = [this](LONG left, LONG top, LONG right, LONG bottom, uint32_t color) {
+        left = std::max(left, 0L);
+        top = std::max(top, 0L);
+        right = std::min(right, LONG(mWidth));
+        bottom = std::min(bottom, LONG(mHeight));
+
+        for (LONG y = top; y < bottom; y++) {
+            for (LONG x = left; x < right; x++) {
+                blendPixel(uint32_t(x), uint32_t(y), color);
+            }
+        }
+
+        markTiles(left, top, right, bottom);
+    };
+
+    switch (element.kind) {
+    case OverlayElement::Kind::Fill:
+        fill(r.left, r.top, r.right, r.bottom, premultiply(element.color));
+        break;
+
+    case OverlayElement::Kind::Outline: {
+        // Only the edges are marked, so the inside of a box costs nothing.
+        const LONG t = LONG(element.thickness);
+        const uint32_t color = premultiply(element.color);
+
+        fill(r.left, r.top, r.right, std::min(r.top + t, r.bottom), color);
+        fill(r.left, std::max(r.bottom - t, r.top + t), r.right, r.bottom, color);
+        fill(r.left, r.top + t, std::min(r.left + t, r.right), r.bottom - t, color);
+        fill(std::max(r.right - t, r.left + t), r.top + t, r.right, r.bottom - t, color);
+        break;
+    }
+
+    case OverlayElement::Kind::Image: {
+        const LONG width = r.right - r.left;
+        const LONG height = r.bottom - r.top;
+
+        if (width <= 0 || height <= 0 || element.pixels.size() != size_t(width) * size_t(height)) {
+            break;
+        }
+
+        for (LONG y = std::max(r.top, 0L); y < std::min(r.bottom, LONG(mHeight)); y++) {
+            for (LONG x = std::max(r.left, 0L); x < std::min(r.right, LONG(mWidth)); x++) {
+                const uint32_t pixel = element.pixels[size_t(y - r.top) * width + size_t(x - r.left)];
+                blendPixel(uint32_t(x), uint32_t(y), premultiply(pixel));
+            }
+        }
+
+        markTiles(std::max(r.left, 0L), std::max(r.top, 0L),
+            std::min(r.right, LONG(mWidth)), std::min(r.bottom, LONG(mHeight)));
+        break;
+    }
+    }
+}
+
+void Overlay::blendPixel(uint32_t x, uint32_t y, uint32_t premultiplied)
+{
+    uint32_t& pixel = mSurface[size_t(y) * mWidth + x];
+    pixel = over(premultiplied, pixel);
+}
+
+void Overlay::markTiles(LONG left, LONG top, LONG right, LONG bottom)
+{
+    if (left >= right || top >= bottom) {
+        return;
+    }
+
+    for (uint32_t ty = uint32_t(top) / TILE_SIZE; ty <= uint32_t(bottom - 1) / TILE_SIZE; ty++) {
+        for (uint32_t tx = uint32_t(left) / TILE_SIZE; tx <= uint32_t(right - 1) / TILE_SIZE; tx++) {
+            mTiles[ty * mTilesX + tx] = 1;
+        }
+    }
+}
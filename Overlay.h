@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <windows.h>
+
+#include "FrameStage.h"
+
+//-------------------------------------------------------------------
+// OverlayElement
+//
+// One item burned into the preview. Colours are 0xAARRGGBB with
+// straight (not premultiplied) alpha; image pixels use the same
+// layout, row by row without padding.
+//-------------------------------------------------------------------
+
+struct OverlayElement
+{
+    enum class Kind
+    {
+        Fill, Outline, Image
+    };
+
+    Kind kind = Kind::Fill;
+    RECT rect = {};                 // Image: position and size of the image.
+    uint32_t color = 0;
+    uint32_t thickness = 1;         // Outline only.
+    std::vector<uint32_t> pixels;   // Image only.
+
+    bool operator==(const OverlayElement& other) const;
+};
+
+//-------------------------------------------------------------------
+// Overlay
+//
+// Composites boxes, labels and logos onto converted RGB32 frames.
+//
+// The elements are flattened into a cached premultiplied BGRA surface
+// that is only rebuilt when an element changes. Each frame blends the
+// surface over the tiles that contain overlay pixels, so a few boxes
+// on a large frame cost a few blended tiles rather than a full-frame
+// pass.
+//
+// Elements can be changed from any thread; process() runs on the
+// render thread.
+//-------------------------------------------------------------------
+
+class Overlay : public FrameStage
+{
+public:
+    Overlay(uint32_t width, uint32_t height);
+
+    Overlay(const Overlay&) = delete;
+    Overlay& operator=(const Overlay&) = delete;
+
+    // Adds or replaces the element with this id. Setting an element to
+    // its current value does not trigger a rebuild.
+    void set(uint32_t id, const OverlayElement& element);
+    void remove(uint32_t id);
+    void clear();
+
+    uint32_t width() const { return mWidth; }
+    uint32_t height() const { return mHeight; }
+
+    // Blends the overlay onto an RGB32 frame. Overlay pixels outside
+    // the frame are ignored.
+    void process(uint8_t* frame, uint32_t stride, uint32_t width, uint32_t height, FrameStats& stats,
+        FrameArena& arena) override;
+
+private:
+    static const uint32_t TILE_SIZE = 16;
+
+    void rebuild();
+    void draw(const OverlayElement& element);
+    void blendPixel(uint32_t x, uint32_t y, uint32_t premultiplied);
+    void markTiles(LONG left, LONG top, LONG right, LONG bottom);
+
+    const uint32_t mWidth;
+    const uint32_t mHeight;
+    const uint32_t mTilesX;
+    const uint32_t mTilesY;
+
+    std::map<uint32_t, OverlayElement> mElements;
+    std::vector<uint32_t> mSurface;     // Premultiplied BGRA.
+    std::vector<uint8_t> mTiles;        // Tiles with overlay pixels.
+    std::vector<RECT> mRegions;         // Runs of those tiles, disjoint.
+    bool mDirty = false;
+    std::mutex mMutex;
+};
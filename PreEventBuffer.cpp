@@ -0,0 +1,332 @@
+#include "PreEventBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Debug.h"
+#include "Metrics.h"
+#include "RecordingFormat.h"
+
+namespace {
+    struct PreEventMetrics
+    {
+        MetricCounter& dropped = Metrics::instance().counter("mfcamera_pre_event_dropped_total",
+            "Frames the pre-event buffer could not keep because a flush still needed the space.");
+        MetricCounter& flushes = Metrics::instance().counter("mfcamera_pre_event_flushes_total",
+            "Pre-event buffers saved to disk.");
+        MetricGauge& frames = Metrics::instance().gauge("mfcamera_pre_event_frames",
+            "Frames held in the pre-event buffer.");
+    };
+
+    PreEventMetrics& preEventMetrics()
+    {
+        static PreEventMetrics metrics;
+        return metrics;
+    }
+
+    bool writeAll(HANDLE file, const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+        while (size > 0) {
+            DWORD written = 0;
+            const DWORD chunk = DWORD(std::min<size_t>(size, 1u << 30));
+
+            if (!WriteFile(file, bytes, chunk, &written, nullptr) || written == 0) {
+                return false;
+            }
+
+            bytes += written;
+            size -= written;
+        }
+
+        return true;
+    }
+
+    bool sameFormat(const FrameInfo& a, const RecordingFileHeader& header)
+    {
+        return a.subtype == header.subtype && a.width == header.width && a.height == header.height;
+    }
+}
+
+PreEventBuffer::PreEventBuffer(size_t capacityBytes, std::chrono::milliseconds window, size_t maxFrames)
+    : mData(std::make_unique<uint8_t[]>(capacityBytes))
+    , mCapacity(capacityBytes)
+    , mEntries(std::max<size_t>(maxFrames, 2))
+    , mFeeder([this](const Frame& frame) { push(frame); })
+{
+    LARGE_INTEGER frequency = {};
+    QueryPerformanceFrequency(&frequency);
+    mWindowTicks = frequency.QuadPart * window.count() / 1000;
+
+    mWriter = std::thread([this] {
+        writerLoop();
+    });
+}
+
+PreEventBuffer::~PreEventBuffer()
+{
+    stop();
+
+    {
+        std::lock_guard lock(mMutex);
+        mStopping = true;
+    }
+
+    mWake.notify_all();
+    mWriter.join();
+}
+
+bool PreEventBuffer::start(FrameSource& source, size_t streamCapacity)
+{
+    return mFeeder.start(source, streamCapacity);
+}
+
+void PreEventBuffer::stop()
+{
+    mFeeder.stop();
+}
+
+//-------------------------------------------------------------------
+// Push
+//
+// The copy is made outside the lock: the reserved bytes belong to no
+// entry yet, so neither trigger() nor the writer looks at them. Only
+// one thread may push at a time.
+//-------------------------------------------------------------------
+
+bool PreEventBuffer::push(const Frame& frame)
+{
+    const FrameFeeder::Bytes bytes(frame);
+    if (!bytes) {
+        return false;
+    }
+
+    const DWORD length = bytes.length();
+    PreEventMetrics& metrics = preEventMetrics();
+    const FrameInfo& info = frame.info();
+    size_t offset = 0;
+    bool reserved = false;
+
+    if (length > 0 && length <= mCapacity) {
+        std::lock_guard lock(mMutex);
+        reserved = reserve(length, info.captureTime, offset);
+    }
+
+    if (reserved) {
+        memcpy(mData.get() + offset, bytes.data(), length);
+
+        std::lock_guard lock(mMutex);
+        Entry& added = entry(mEnd++);
+        added.offset = offset;
+        added.size = length;
+        added.info = info;
+
+        metrics.frames.set(int64_t(mEnd - mFirst));
+    }
+    else {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        metrics.dropped.add();
+    }
+
+    return reserved;
+}
+
+//-------------------------------------------------------------------
+// Reserve
+//
+// Frames are laid out in arrival order and wrap at most once, so the
+// free space is either [write, oldest) or [write, end) plus
+// [0, oldest). The oldest frames are evicted until size bytes fit in
+// one piece; the tail of the block that is too short for the frame is
+// left unused until the ring comes round again.
+//
+// Fails without evicting a pinned frame.
+//-------------------------------------------------------------------
+
+bool PreEventBuffer::reserve(uint32_t size, LONGLONG captureTime, size_t& offset)
+{
+    if (captureTime != 0) {
+        while (mFirst < mEnd && captureTime - entry(mFirst).info.captureTime > mWindowTicks && evictOldest()) {
+        }
+    }
+
+    if (mEnd - mFirst == mEntries.size() && !evictOldest()) {
+        return false;
+    }
+
+    for (;;) {
+        if (mFirst == mEnd) {
+            mWrite = 0;
+            break;
+        }
+
+        const size_t oldest = entry(mFirst).offset;
+
+        if (oldest >= mWrite) {
+            if (mWrite + size <= oldest) {
+                break;
+            }
+        }
+        else {
+            if (mWrite + size <= mCapacity) {
+                break;
+            }
+
+            if (size <= oldest) {
+                mWrite = 0;
+                break;
+            }
+        }
+
+        if (!evictOldest()) {
+            return false;
+        }
+    }
+
+    offset = mWrite;
+    mWrite += size;
+    return true;
+}
+
+bool PreEventBuffer::evictOldest()
+{
+    if (mFirst == mEnd) {
+        return false;
+    }
+
+    // Flushes write in order, so everything before mFlushNext is done.
+    if (mFirst >= mFlushNext && mFirst < mFlushEnd) {
+        return false;
+    }
+
+    mFirst++;
+    return true;
+}
+
+bool PreEventBuffer::trigger(const std::wstring& path)
+{
+    {
+        std::lock_guard lock(mMutex);
+
+        if (mFlushNext < mFlushEnd || mFirst == mEnd) {
+            return false;
+        }
+
+        mFlushNext = mFirst;
+        mFlushEnd = mEnd;
+        mFlushPath = path;
+    }
+
+    mWake.notify_all();
+    return true;
+}
+
+bool PreEventBuffer::isFlushing() const
+{
+    std::lock_guard lock(mMutex);
+    return mFlushNext < mFlushEnd;
+}
+
+size_t PreEventBuffer::frameCount() const
+{
+    std::lock_guard lock(mMutex);
+    return size_t(mEnd - mFirst);
+}
+
+//-------------------------------------------------------------------
+// WriterLoop
+//
+// A flush that is under way when the buffer is destroyed is finished
+// first; the frames are what the trigger asked for.
+//-------------------------------------------------------------------
+
+void PreEventBuffer::writerLoop()
+{
+    std::unique_lock lock(mMutex);
+
+    for (;;) {
+        mWake.wait(lock, [this] {
+            return mStopping || mFlushNext < mFlushEnd;
+        });
+
+        if (mFlushNext < mFlushEnd) {
+            const std::wstring path = mFlushPath;
+            const uint64_t first = mFlushNext;
+            const uint64_t end = mFlushEnd;
+
+            lock.unlock();
+            const bool written = flush(path, first, end);
+            lock.lock();
+
+            // Release whatever a failed flush still pinned.
+            mFlushNext = mFlushEnd;
+
+            if (written) {
+                preEventMetrics().flushes.add();
+            }
+            else {
+                Error("PreEventBuffer: cannot write %S\n", path.c_str());
+            }
+        }
+        else if (mStopping) {
+            return;
+        }
+    }
+}
+
+//-------------------------------------------------------------------
+// Flush
+//
+// Writes entries [first, end) straight out of the ring. Each entry is
+// released as soon as it is on disk, so capture can reuse its space
+// while the rest is still being written. Frames in a different format
+// than the first one, from a format change, are left out.
+//-------------------------------------------------------------------
+
+bool PreEventBuffer::flush(const std::wstring& path, uint64_t first, uint64_t end)
+{
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    Entry current;
+    {
+        std::lock_guard lock(mMutex);
+        current = entry(first);
+    }
+
+    RecordingFileHeader header;
+    header.subtype = current.info.subtype;
+    header.width = current.info.width;
+    header.height = current.info.height;
+
+    LONG stride = 0;
+    if (SUCCEEDED(MFGetStrideForBitmapInfoHeader(header.subtype.Data1, header.width, &stride))) {
+        header.stride = stride;
+    }
+
+    bool ok = writeAll(file, &header, sizeof(header));
+
+    for (uint64_t id = first; ok && id < end; id++) {
+        {
+            std::lock_guard lock(mMutex);
+            current = entry(id);
+        }
+
+        if (sameFormat(current.info, header)) {
+            const RecordingFrameHeader frameHeader = RecordingFrameHeaderFor(current.info, current.size);
+
+            ok = writeAll(file, &frameHeader, sizeof(frameHeader)) &&
+                writeAll(file, mData.get() + current.offset, current.size);
+        }
+
+        std::lock_guard lock(mMutex);
+        mFlushNext = id + 1;
+    }
+
+    CloseHandle(file);
+    return ok;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Frame.h"
+#include "FrameFeeder.h"
+
+class FrameSource;
+
+//-------------------------------------------------------------------
+// PreEventBuffer
+//
+// Keeps the last seconds of raw frames so that an incident can be
+// saved together with what led up to it. Frame data is copied into one
+// block of memory allocated up front and used as a ring: new frames
+// overwrite the oldest ones, and frames older than the window are
+// dropped, so memory use never grows.
+//
+// The buffer feeds itself from a subscriber stream of the source on
+// its own thread; the capture thread never waits for it. trigger()
+// hands the buffered frames to a writer thread, which saves them in
+// the recording format while new frames keep arriving. Frames that
+// have not been written yet are not overwritten; while the writer is
+// behind, incoming frames are dropped instead.
+//-------------------------------------------------------------------
+
+class PreEventBuffer
+{
+public:
+    PreEventBuffer(size_t capacityBytes, std::chrono::milliseconds window, size_t maxFrames = 1024);
+    ~PreEventBuffer();
+
+    PreEventBuffer(const PreEventBuffer&) = delete;
+    PreEventBuffer& operator=(const PreEventBuffer&) = delete;
+
+    // Starts copying the frames of source, through a queue of
+    // streamCapacity frames. Call stop() before the source goes away.
+    bool start(FrameSource& source, size_t streamCapacity);
+    void stop();
+
+    // Copies one frame into the ring. Called by the feeding thread; can
+    // be called directly if the buffer is not started.
+    bool push(const Frame& frame);
+
+    // Saves the frames buffered right now to path in the background.
+    // Returns false if the previous flush is still running.
+    bool trigger(const std::wstring& path);
+
+    bool isFlushing() const;
+    size_t frameCount() const;
+    uint64_t droppedFrames() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+    struct Entry
+    {
+        size_t offset = 0;
+        uint32_t size = 0;
+        FrameInfo info;
+    };
+
+    Entry& entry(uint64_t id) { return mEntries[id % mEntries.size()]; }
+    bool reserve(uint32_t size, LONGLONG captureTime, size_t& offset);
+    bool evictOldest();
+    void writerLoop();
+    bool flush(const std::wstring& path, uint64_t first, uint64_t end);
+
+    std::unique_ptr<uint8_t[]> mData;
+    size_t mCapacity = 0;
+    size_t mWrite = 0;
+    LONGLONG mWindowTicks = 0;
+
+    // Entries are numbered in arrival order; [mFirst, mEnd) are held.
+    std::vector<Entry> mEntries;
+    uint64_t mFirst = 0;
+    uint64_t mEnd = 0;
+
+    // [mFlushNext, mFlushEnd) still have to be written and are pinned.
+    uint64_t mFlushNext = 0;
+    uint64_t mFlushEnd = 0;
+    std::wstring mFlushPath;
+
+    std::atomic<uint64_t> mDropped = 0;
+    bool mStopping = false;
+    FrameFeeder mFeeder;
+    std::thread mWriter;
+    mutable std::mutex mMutex;
+    std::condition_variable mWake;
+};
@@ -0,0 +1,263 @@
+#include "ReconnectCheck.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mfapi.h>
+
+#include "ReconnectSupervisor.h"
+#include "Metrics.h"
+#include "Debug.h"
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+    using std::chrono::milliseconds;
+
+    const wchar_t SIMULATED_LINK[] = L"\\\\?\\simulated#camera#0";
+
+    const milliseconds INITIAL_BACKOFF(20);
+    const milliseconds MAXIMUM_BACKOFF(160);
+    const milliseconds ABSENCE(700);
+    const milliseconds ARRIVAL_BACKOFF(5000);
+    const milliseconds ARRIVAL_ABSENCE(100);
+    const milliseconds RECONNECT_TIMEOUT(2000);
+
+    // Waits return a little early on coarse system timers.
+    const milliseconds TIMER_SLACK(16);
+
+    bool sameFormat(const ReconnectSupervisor::DeviceFormat& a, const ReconnectSupervisor::DeviceFormat& b)
+    {
+        return a.subtype == b.subtype && a.width == b.width && a.height == b.height;
+    }
+
+    //-------------------------------------------------------------------
+    // SimulatedDevice
+    //
+    // A capture device that goes away and comes back on cue. Like the
+    // camera, it remembers the format it was last opened in. After it
+    // comes back it lists that format last, so a reopen in the old
+    // format shows that the supervisor asked for it.
+    //-------------------------------------------------------------------
+
+    class SimulatedDevice : public ReconnectSupervisor::Device
+    {
+    public:
+        using DeviceFormat = ReconnectSupervisor::DeviceFormat;
+
+        SimulatedDevice()
+        {
+            mFormats.push_back({ MFVideoFormat_YUY2, 640, 480 });
+            mFormats.push_back({ MFVideoFormat_NV12, 1280, 720 });
+        }
+
+        DeviceFormat format() const override
+        {
+            std::lock_guard lock(mMutex);
+            return mFormat;
+        }
+
+        void close() override
+        {
+            std::lock_guard lock(mMutex);
+            mCloses++;
+        }
+
+        bool open(const std::wstring& identity, const DeviceFormat& format) override
+        {
+            std::lock_guard lock(mMutex);
+            mAttempts.push_back(Clock::now());
+
+            if (!mPresent || identity != SIMULATED_LINK) {
+                return false;
+            }
+
+            // Without a format to keep, the device's first choice.
+            auto match = std::find_if(mFormats.begin(), mFormats.end(), [&](const DeviceFormat& candidate) {
+                return sameFormat(candidate, format);
+            });
+
+            mFormat = match != mFormats.end() ? *match : mFormats.front();
+            return true;
+        }
+
+        void disappear()
+        {
+            std::lock_guard lock(mMutex);
+            mPresent = false;
+            mAttempts.clear();
+        }
+
+        // Comes back preferring any format but the one it was open in.
+        void reappear()
+        {
+            std::lock_guard lock(mMutex);
+            std::stable_partition(mFormats.begin(), mFormats.end(), [this](const DeviceFormat& format) {
+                return !sameFormat(format, mFormat);
+            });
+            mPresent = true;
+        }
+
+        std::vector<Clock::time_point> attempts() const
+        {
+            std::lock_guard lock(mMutex);
+            return mAttempts;
+        }
+
+        uint32_t closes() const
+        {
+            std::lock_guard lock(mMutex);
+            return mCloses;
+        }
+
+    private:
+        std::vector<DeviceFormat> mFormats;
+        DeviceFormat mFormat;
+        bool mPresent = true;
+        uint32_t mCloses = 0;
+        std::vector<Clock::time_point> mAttempts;
+        mutable std::mutex mMutex;
+    };
+
+    bool waitForReconnect(const ReconnectSupervisor& supervisor, milliseconds timeout)
+    {
+        const Clock::time_point deadline = Clock::now() + timeout;
+
+        while (!supervisor.stats().connected) {
+            if (Clock::now() > deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(milliseconds(5));
+        }
+
+        return true;
+    }
+
+    //-------------------------------------------------------------------
+    // CheckBackoff
+    //
+    // The wait before each retry doubles from the initial backoff and
+    // stops growing at the maximum.
+    //-------------------------------------------------------------------
+
+    bool checkBackoff(const std::vector<Clock::time_point>& attempts)
+    {
+        if (attempts.size() < 4) {
+            Error("Reconnect check: only %zu attempts while the device was gone\n", attempts.size());
+            return false;
+        }
+
+        milliseconds expected = INITIAL_BACKOFF;
+
+        for (size_t i = 1; i < attempts.size(); i++) {
+            const auto gap = std::chrono::duration_cast<milliseconds>(attempts[i] - attempts[i - 1]);
+
+            if (gap + TIMER_SLACK < expected || gap > expected * 2 + TIMER_SLACK * 4) {
+                Error("Reconnect check: retry %zu after %lld ms, expected %lld ms\n", i,
+                    (long long)gap.count(), (long long)expected.count());
+                return false;
+            }
+
+            expected = std::min(expected * 2, MAXIMUM_BACKOFF);
+        }
+
+        return true;
+    }
+}
+
+//-------------------------------------------------------------------
+// Run
+//
+// Two outages: one the supervisor has to find out about by retrying,
+// and one that ends with a device arrival long before the next retry
+// is due.
+//-------------------------------------------------------------------
+
+bool ReconnectCheck::run()
+{
+    const ReconnectSupervisor::DeviceFormat initial = { MFVideoFormat_YUY2, 640, 480 };
+
+    SimulatedDevice device;
+    if (!device.open(SIMULATED_LINK, initial)) {
+        return false;
+    }
+
+    MetricCounter& downtimeMetric = Metrics::instance().secondsCounter("mfcamera_device_downtime_seconds_total",
+        "Time between device losses and their reconnects.");
+    const uint64_t downtimeBefore = downtimeMetric.value();
+
+    ReconnectSupervisor supervisor(device);
+    supervisor.setBackoff(INITIAL_BACKOFF, MAXIMUM_BACKOFF);
+
+    // Outage found by retrying.
+    device.disappear();
+    supervisor.onDeviceLost(SIMULATED_LINK);
+
+    std::this_thread::sleep_for(ABSENCE);
+    const std::vector<Clock::time_point> attempts = device.attempts();
+    device.reappear();
+
+    if (!waitForReconnect(supervisor, RECONNECT_TIMEOUT)) {
+        Error("Reconnect check: device did not come back\n");
+        return false;
+    }
+
+    const ReconnectSupervisor::Stats first = supervisor.stats();
+    bool ok = checkBackoff(attempts);
+
+    if (device.closes() != 1) {
+        Error("Reconnect check: lost device closed %u times\n", device.closes());
+        ok = false;
+    }
+
+    if (!sameFormat(device.format(), initial)) {
+        Error("Reconnect check: device reopened in another format\n");
+        ok = false;
+    }
+
+    if (first.losses != 1 || first.reconnects != 1 || first.lastDowntime < ABSENCE - TIMER_SLACK ||
+        first.totalDowntime != first.lastDowntime) {
+        Error("Reconnect check: %u losses, %u reconnects, downtime %lld ms\n", first.losses, first.reconnects,
+            (long long)first.lastDowntime.count());
+        ok = false;
+    }
+
+    // Outage ended by an arrival notification.
+    supervisor.setBackoff(ARRIVAL_BACKOFF, ARRIVAL_BACKOFF);
+    device.disappear();
+    supervisor.onDeviceLost(SIMULATED_LINK);
+
+    std::this_thread::sleep_for(ARRIVAL_ABSENCE);
+    device.reappear();
+    supervisor.onDeviceArrived();
+
+    if (!waitForReconnect(supervisor, ARRIVAL_BACKOFF / 2)) {
+        Error("Reconnect check: device arrival did not cut the backoff short\n");
+        return false;
+    }
+
+    const ReconnectSupervisor::Stats second = supervisor.stats();
+    // The metric counts microseconds.
+    const uint64_t downtimeReported = (downtimeMetric.value() - downtimeBefore) / 1000;
+
+    if (second.losses != 2 || second.reconnects != 2 ||
+        second.totalDowntime != first.lastDowntime + second.lastDowntime ||
+        downtimeReported != uint64_t(second.totalDowntime.count())) {
+        Error("Reconnect check: downtime %lld ms in stats, %llu ms in metrics\n",
+            (long long)second.totalDowntime.count(), (unsigned long long)downtimeReported);
+        ok = false;
+    }
+
+    if (!sameFormat(device.format(), initial)) {
+        Error("Reconnect check: device reopened in another format after arrival\n");
+        ok = false;
+    }
+
+    Info("Reconnect check: %u attempts, downtime %lld ms and %lld ms\n", second.attempts,
+        (long long)first.lastDowntime.count(), (long long)second.lastDowntime.count());
+
+    return ok;
+}
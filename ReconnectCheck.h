@@ -0,0 +1,20 @@
+#pragma once
+
+//-------------------------------------------------------------------
+// Reconnect check
+//
+// Runs ReconnectSupervisor against a scripted device that disappears
+// and comes back, and fails unless the supervisor
+//
+//  - backs off exponentially, up to the maximum, while it is gone,
+//  - reopens it in the format it delivered before the loss, although
+//    the device prefers another one when it returns,
+//  - reports the downtime in its stats and metrics, and
+//  - retries at once when a device arrival is signalled.
+//
+// No capture hardware is involved; the check takes a few seconds.
+//-------------------------------------------------------------------
+
+namespace ReconnectCheck {
+    bool run();
+}
@@ -0,0 +1,239 @@
+#include "ReconnectSupervisor.h"
+
+#include <algorithm>
+
+#include <mfapi.h>
+
+#include "Camera.h"
+#include "Debug.h"
+#include "Metrics.h"
+
+namespace {
+    struct SupervisorMetrics
+    {
+        MetricCounter& losses = Metrics::instance().counter("mfcamera_device_losses_total",
+            "Capture device losses.");
+        MetricCounter& reconnects = Metrics::instance().counter("mfcamera_device_reconnects_total",
+            "Successful reconnects after a device loss.");
+        MetricGauge& recovering = Metrics::instance().gauge("mfcamera_device_recovering",
+            "1 while the supervisor is trying to reopen a lost device.");
+        MetricCounter& downtime = Metrics::instance().secondsCounter("mfcamera_device_downtime_seconds_total",
+            "Time between device losses and their reconnects.");
+    };
+
+    SupervisorMetrics& supervisorMetrics()
+    {
+        static SupervisorMetrics metrics;
+        return metrics;
+    }
+
+    //-------------------------------------------------------------------
+    // CameraDevice
+    //
+    // A Camera as seen by the supervisor. The camera keeps the subtype
+    // and size it negotiated across closeDevice() and asks a reopened
+    // reader for them first, so it already reopens in the lost format.
+    //-------------------------------------------------------------------
+
+    class CameraDevice : public ReconnectSupervisor::Device
+    {
+    public:
+        CameraDevice(Camera& camera, ReconnectSupervisor::DeviceFinder finder) :
+            mCamera(camera), mFinder(std::move(finder))
+        {
+        }
+
+        ReconnectSupervisor::DeviceFormat format() const override
+        {
+            ReconnectSupervisor::DeviceFormat format;
+            mCamera.format(format.subtype, format.width, format.height);
+            return format;
+        }
+
+        void close() override
+        {
+            mCamera.closeDevice();
+        }
+
+        bool open(const std::wstring& identity, const ReconnectSupervisor::DeviceFormat&) override
+        {
+            IMFActivate* device = mFinder(identity);
+            if (!device) {
+                return false;
+            }
+
+            const bool ok = mCamera.setDevice(device);
+            device->Release();
+
+            return ok;
+        }
+
+    private:
+        Camera& mCamera;
+        ReconnectSupervisor::DeviceFinder mFinder;
+    };
+}
+
+ReconnectSupervisor::ReconnectSupervisor(Camera& camera, DeviceFinder finder) :
+    mCameraDevice(std::make_unique<CameraDevice>(camera,
+        finder ? std::move(finder) : DeviceFinder(&Camera::findDevice))),
+    mDevice(*mCameraDevice)
+{
+    start();
+}
+
+ReconnectSupervisor::ReconnectSupervisor(Device& device) : mDevice(device)
+{
+    start();
+}
+
+void ReconnectSupervisor::start()
+{
+    mThread = std::thread(&ReconnectSupervisor::run, this);
+}
+
+ReconnectSupervisor::~ReconnectSupervisor()
+{
+    {
+        std::lock_guard lock(mMutex);
+        mStopping = true;
+    }
+
+    mCondition.notify_all();
+    mThread.join();
+}
+
+void ReconnectSupervisor::setIdentity(const std::wstring& identity)
+{
+    std::lock_guard lock(mMutex);
+    mIdentity = identity;
+}
+
+void ReconnectSupervisor::setBackoff(std::chrono::milliseconds initial, std::chrono::milliseconds maximum)
+{
+    std::lock_guard lock(mMutex);
+    mInitialBackoff = initial;
+    mMaximumBackoff = std::max(initial, maximum);
+}
+
+//-------------------------------------------------------------------
+// OnDeviceLost
+//
+// Safe to call from any thread, and more than once for the same loss
+// (device notification and reader error both report it).
+//-------------------------------------------------------------------
+
+void ReconnectSupervisor::onDeviceLost(const std::wstring& symbolicLink)
+{
+    const DeviceFormat format = mDevice.format();
+
+    {
+        std::lock_guard lock(mMutex);
+
+        if (mRecovering) {
+            return;
+        }
+
+        mRecovering = true;
+        mLostLink = symbolicLink;
+        mLostFormat = format;
+        mLostAt = std::chrono::steady_clock::now();
+        mStats.losses++;
+        mStats.connected = false;
+    }
+
+    supervisorMetrics().losses.add();
+    supervisorMetrics().recovering.set(1);
+
+    Warn("Capture device lost, reconnecting\n");
+    mCondition.notify_all();
+}
+
+void ReconnectSupervisor::onDeviceArrived()
+{
+    {
+        std::lock_guard lock(mMutex);
+        mArrived = true;
+    }
+
+    mCondition.notify_all();
+}
+
+ReconnectSupervisor::Stats ReconnectSupervisor::stats() const
+{
+    std::lock_guard lock(mMutex);
+
+    Stats stats = mStats;
+    if (mRecovering) {
+        // Include the outage in progress.
+        stats.lastDowntime = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - mLostAt);
+    }
+
+    return stats;
+}
+
+void ReconnectSupervisor::run()
+{
+    if (FAILED(CoInitializeEx(nullptr, COINIT_MULTITHREADED))) {
+        Error("ReconnectSupervisor: CoInitializeEx failed\n");
+        return;
+    }
+
+    std::unique_lock lock(mMutex);
+
+    while (!mStopping) {
+        mCondition.wait(lock, [this] {
+            return mStopping || mRecovering;
+        });
+
+        if (mStopping) {
+            break;
+        }
+
+        std::chrono::milliseconds backoff = mInitialBackoff;
+
+        // Release the dead reader before looking for the device again.
+        lock.unlock();
+        mDevice.close();
+        lock.lock();
+
+        while (!mStopping) {
+            const std::wstring identity = mIdentity.empty() ? mLostLink : mIdentity;
+            const DeviceFormat format = mLostFormat;
+            mStats.attempts++;
+
+            lock.unlock();
+            const bool reconnected = mDevice.open(identity, format);
+            lock.lock();
+
+            if (reconnected) {
+                const auto downtime = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - mLostAt);
+
+                mStats.reconnects++;
+                mStats.connected = true;
+                mStats.lastDowntime = downtime;
+                mStats.totalDowntime += downtime;
+                mRecovering = false;
+
+                supervisorMetrics().reconnects.add();
+                supervisorMetrics().recovering.set(0);
+                supervisorMetrics().downtime.add(uint64_t(std::chrono::microseconds(downtime).count()));
+
+                Info("Capture device reconnected after %lld ms\n", (long long)downtime.count());
+                break;
+            }
+
+            mArrived = false;
+            mCondition.wait_for(lock, backoff, [this] {
+                return mStopping || mArrived;
+            });
+
+            backoff = std::min(backoff * 2, mMaximumBackoff);
+        }
+    }
+
+    lock.unlock();
+    CoUninitialize();
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <mfapi.h>
+#include <mfidl.h>
+
+class Camera;
+
+//-------------------------------------------------------------------
+// ReconnectSupervisor
+//
+// Brings a lost capture device back without user interaction. After
+// a loss the supervisor looks for a device with the same symbolic
+// link (or the configured identity) and reopens it with the format
+// it delivered before, retrying with exponential backoff.
+//
+// The supervisor works on a Device. For a Camera, devices are looked
+// up through a DeviceFinder, which defaults to Media Foundation
+// enumeration. ReconnectCheck runs it against a scripted device that
+// disappears and comes back.
+//-------------------------------------------------------------------
+
+class ReconnectSupervisor
+{
+public:
+    // What a device delivered before it was lost.
+    struct DeviceFormat
+    {
+        GUID subtype = GUID_NULL;
+        uint32_t width = 0;
+        uint32_t height = 0;
+    };
+
+    class Device
+    {
+    public:
+        virtual ~Device() = default;
+
+        // Format of the device that is open now.
+        virtual DeviceFormat format() const = 0;
+
+        // Releases the lost device.
+        virtual void close() = 0;
+
+        // Opens the device with the given identity in format. False if
+        // it is not present or cannot be opened.
+        virtual bool open(const std::wstring& identity, const DeviceFormat& format) = 0;
+    };
+
+    // Returns an activation object for the device, or nullptr if it is
+    // not present. identity is a symbolic link or a friendly name.
+    using DeviceFinder = std::function<IMFActivate*(const std::wstring& identity)>;
+
+    struct Stats
+    {
+        uint32_t losses = 0;
+        uint32_t reconnects = 0;
+        uint32_t attempts = 0;
+        bool connected = true;
+        std::chrono::milliseconds lastDowntime = {};
+        std::chrono::milliseconds totalDowntime = {};
+    };
+
+    explicit ReconnectSupervisor(Camera& camera, DeviceFinder finder = DeviceFinder());
+    explicit ReconnectSupervisor(Device& device);
+    ~ReconnectSupervisor();
+
+    ReconnectSupervisor(const ReconnectSupervisor&) = delete;
+    ReconnectSupervisor& operator=(const ReconnectSupervisor&) = delete;
+
+    // Device to look for instead of the symbolic link of the lost one.
+    void setIdentity(const std::wstring& identity);
+    void setBackoff(std::chrono::milliseconds initial, std::chrono::milliseconds maximum);
+
+    // Takes note of the format the device delivered, to reopen it with.
+    void onDeviceLost(const std::wstring& symbolicLink);
+
+    // Device arrival notifications cut the current backoff short.
+    void onDeviceArrived();
+
+    Stats stats() const;
+
+private:
+    void start();
+    void run();
+
+    std::unique_ptr<Device> mCameraDevice;  // Set when supervising a Camera.
+    Device& mDevice;
+    std::wstring mIdentity;
+    std::wstring mLostLink;
+    DeviceFormat mLostFormat;
+    std::chrono::milliseconds mInitialBackoff = std::chrono::milliseconds(100);
+    std::chrono::milliseconds mMaximumBackoff = std::chrono::milliseconds(10000);
+    std::chrono::steady_clock::time_point mLostAt;
+    bool mRecovering = false;
+    bool mArrived = false;
+    bool mStopping = false;
+    Stats mStats;
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::thread mThread;
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <windows.h>
+
+#include "FrameMetadata.h"
+
+//-------------------------------------------------------------------
+// Recording file format
+//
+// Raw frames exactly as the source delivered them:
+//
+//     RecordingFileHeader
+//     RecordingFrameHeader, payload      (repeated)
+//
+// The payload is the contiguous form of the sample buffer, i.e. the
+// planes one after the other at the default stride. All fields are
+// little-endian.
+//
+// Version 2 extends the frame header with the rest of the frame's
+// metadata. Version 1 files have the shorter header and are still
+// read; the added fields are zero for them.
+//
+// A segment can have a sidecar index next to it, with the extension
+// .mfci, written while recording:
+//
+//     RecordingIndexHeader
+//     RecordingIndexEntry                (one per frame, in file order)
+//
+// The entry count follows from the file size, so an index cut short
+// by a crash is still valid up to its last whole entry.
+//-------------------------------------------------------------------
+
+const uint32_t RECORDING_FILE_MAGIC = 0x5243464D;     // "MFCR"
+const uint32_t RECORDING_FRAME_MAGIC = 0x4D415246;    // "FRAM"
+const uint32_t RECORDING_INDEX_MAGIC = 0x4943464D;    // "MFCI"
+const uint32_t RECORDING_VERSION = 2;
+
+// RecordingFrameHeader::flags. Raw frames decode on their own, so
+// every one of them is a keyframe.
+const uint32_t RECORDING_FRAME_KEYFRAME = 0x1;
+
+struct RecordingFileHeader
+{
+    uint32_t magic = RECORDING_FILE_MAGIC;
+    uint32_t version = RECORDING_VERSION;
+    GUID subtype = {};
+    uint32_t width = 0;
+    uint32_t height = 0;
+    int32_t stride = 0;         // Default stride; negative for bottom-up frames.
+    uint32_t reserved = 0;
+};
+
+struct RecordingFrameHeader
+{
+    uint32_t magic = RECORDING_FRAME_MAGIC;
+    uint32_t size = 0;          // Payload bytes.
+    uint64_t sequence = 0;
+    int64_t timestamp = 0;      // Sample time, 100ns units.
+    uint32_t streamFlags = 0;
+    uint32_t flags = RECORDING_FRAME_KEYFRAME;
+
+    // Version 2.
+    int64_t captureTime = 0;
+    int64_t deviceTime = 0;
+    int64_t exposure = 0;
+    uint32_t sourceId = 0;
+    uint32_t reserved = 0;
+    FrameStats stats;
+};
+
+struct RecordingIndexHeader
+{
+    uint32_t magic = RECORDING_INDEX_MAGIC;
+    uint32_t version = RECORDING_VERSION;
+    uint32_t entrySize = 0;
+    uint32_t reserved = 0;
+};
+
+struct RecordingIndexEntry
+{
+    int64_t timestamp = 0;      // As in the frame header.
+    uint64_t offset = 0;        // Of the frame header in the segment.
+    uint64_t sequence = 0;
+    uint32_t size = 0;          // Payload bytes.
+    uint32_t flags = 0;
+};
+
+static_assert(sizeof(RecordingFileHeader) == 40, "RecordingFileHeader is part of the file format");
+static_assert(sizeof(RecordingFrameHeader) == 72, "RecordingFrameHeader is part of the file format");
+static_assert(sizeof(RecordingIndexHeader) == 16, "RecordingIndexHeader is part of the file format");
+static_assert(sizeof(RecordingIndexEntry) == 32, "RecordingIndexEntry is part of the file format");
+
+// Bytes of a frame header in a file of the given version.
+inline size_t RecordingFrameHeaderSize(uint32_t version)
+{
+    return version < 2 ? 32 : sizeof(RecordingFrameHeader);
+}
+
+inline RecordingFrameHeader RecordingFrameHeaderFor(const FrameMetadata& metadata, uint32_t size)
+{
+    RecordingFrameHeader header;
+    header.size = size;
+    header.sequence = metadata.sequence;
+    header.timestamp = metadata.timestamp;
+    header.streamFlags = metadata.streamFlags;
+    header.captureTime = metadata.captureTime;
+    header.deviceTime = metadata.deviceTime;
+    header.exposure = metadata.exposure;
+    header.sourceId = metadata.sourceId;
+    header.stats = metadata.stats;
+
+    return header;
+}
+
+inline FrameMetadata RecordingFrameMetadata(const RecordingFrameHeader& header)
+{
+    FrameMetadata metadata;
+    metadata.sequence = header.sequence;
+    metadata.timestamp = header.timestamp;
+    metadata.streamFlags = header.streamFlags;
+    metadata.captureTime = header.captureTime;
+    metadata.deviceTime = header.deviceTime;
+    metadata.exposure = header.exposure;
+    metadata.sourceId = header.sourceId;
+    metadata.stats = header.stats;
+
+    return metadata;
+}
+
+// The sidecar index of a segment.
+inline std::wstring RecordingIndexPath(const std::wstring& segment)
+{
+    const size_t dot = segment.find_last_of(L'.');
+    const size_t separator = segment.find_last_of(L"\\/");
+
+    if (dot == std::wstring::npos || (separator != std::wstring::npos && dot < separator)) {
+        return segment + L".mfci";
+    }
+
+    return segment.substr(0, dot) + L".mfci";
+}
@@ -0,0 +1,296 @@
+#include "RecordingReader.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "Debug.h"
+#include "DrawDevice.h"
+#include "FormatConvertor.h"
+#include "Resampler.h"
+
+bool RecordingReader::Mapping::open(const std::wstring& path)
+{
+    file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER length = {};
+    if (!GetFileSizeEx(file, &length) || length.QuadPart == 0) {
+        close();
+        return false;
+    }
+
+    size = uint64_t(length.QuadPart);
+
+    section = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (section) {
+        view = static_cast<const uint8_t*>(MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0));
+    }
+
+    if (!view) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void RecordingReader::Mapping::close()
+{
+    if (view) {
+        UnmapViewOfFile(view);
+        view = nullptr;
+    }
+
+    if (section) {
+        CloseHandle(section);
+        section = nullptr;
+    }
+
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+    }
+
+    size = 0;
+}
+
+RecordingReader::RecordingReader() = default;
+
+RecordingReader::~RecordingReader()
+{
+    close();
+}
+
+bool RecordingReader::open(const std::wstring& path)
+{
+    close();
+
+    if (!mSegment.open(path)) {
+        Error("RecordingReader: cannot open %S\n", path.c_str());
+        return false;
+    }
+
+    if (mSegment.size < sizeof(RecordingFileHeader)) {
+        close();
+        return false;
+    }
+
+    memcpy(&mHeader, mSegment.view, sizeof(mHeader));
+    if (mHeader.magic != RECORDING_FILE_MAGIC || mHeader.version == 0 || mHeader.version > RECORDING_VERSION) {
+        Error("RecordingReader: %S is not a recording\n", path.c_str());
+        close();
+        return false;
+    }
+
+    mFrameHeaderSize = RecordingFrameHeaderSize(mHeader.version);
+
+    if (!useSidecar(path) && !scan()) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void RecordingReader::close()
+{
+    mIndex.close();
+    mSegment.close();
+
+    mHeader = RecordingFileHeader();
+    mFrameHeaderSize = 0;
+    mEntries = nullptr;
+    mCount = 0;
+    mScanned.clear();
+}
+
+//-------------------------------------------------------------------
+// UseSidecar
+//
+// The sidecar is only taken if it covers the whole segment: its last
+// entry must end exactly where the segment does. An index that lags
+// behind, because recording stopped before its last batch was written,
+// is replaced by a scan.
+//-------------------------------------------------------------------
+
+bool RecordingReader::useSidecar(const std::wstring& path)
+{
+    if (!mIndex.open(RecordingIndexPath(path))) {
+        return false;
+    }
+
+    RecordingIndexHeader header;
+    if (mIndex.size >= sizeof(header)) {
+        memcpy(&header, mIndex.view, sizeof(header));
+    }
+
+    const size_t count = size_t((mIndex.size - sizeof(header)) / sizeof(RecordingIndexEntry));
+
+    if (mIndex.size < sizeof(header) || header.magic != RECORDING_INDEX_MAGIC ||
+        header.entrySize != sizeof(RecordingIndexEntry) || count == 0) {
+        mIndex.close();
+        return false;
+    }
+
+    const RecordingIndexEntry* entries = reinterpret_cast<const RecordingIndexEntry*>(mIndex.view + sizeof(header));
+    const RecordingIndexEntry& last = entries[count - 1];
+
+    if (last.offset + mFrameHeaderSize + last.size != mSegment.size) {
+        mIndex.close();
+        return false;
+    }
+
+    mEntries = entries;
+    mCount = count;
+    return true;
+}
+
+//-------------------------------------------------------------------
+// Scan
+//
+// Walks the frame headers from the start. A frame cut off by the end
+// of the file ends the scan.
+//-------------------------------------------------------------------
+
+bool RecordingReader::scan()
+{
+    uint64_t offset = sizeof(RecordingFileHeader);
+
+    while (offset + mFrameHeaderSize <= mSegment.size) {
+        const RecordingFrameHeader header = frameHeader(offset);
+
+        if (header.magic != RECORDING_FRAME_MAGIC ||
+            offset + mFrameHeaderSize + header.size > mSegment.size) {
+            break;
+        }
+
+        RecordingIndexEntry entry;
+        entry.timestamp = header.timestamp;
+        entry.offset = offset;
+        entry.sequence = header.sequence;
+        entry.size = header.size;
+        entry.flags = header.flags;
+        mScanned.push_back(entry);
+
+        offset += mFrameHeaderSize + header.size;
+    }
+
+    mEntries = mScanned.data();
+    mCount = mScanned.size();
+
+    return mCount > 0;
+}
+
+size_t RecordingReader::seek(int64_t timestamp, bool keyframe) const
+{
+    if (mCount == 0) {
+        return 0;
+    }
+
+    const RecordingIndexEntry* end = mEntries + mCount;
+    const RecordingIndexEntry* after = std::upper_bound(mEntries, end, timestamp,
+        [](int64_t value, const RecordingIndexEntry& entry) {
+            return value < entry.timestamp;
+        });
+
+    size_t frame = after == mEntries ? 0 : size_t(after - mEntries) - 1;
+
+    while (keyframe && frame > 0 && !(mEntries[frame].flags & RECORDING_FRAME_KEYFRAME)) {
+        frame--;
+    }
+
+    return frame;
+}
+
+// Headers of older versions are shorter; the rest stays zero.
+RecordingFrameHeader RecordingReader::frameHeader(uint64_t offset) const
+{
+    RecordingFrameHeader header;
+    memcpy(&header, mSegment.view + offset, mFrameHeaderSize);
+
+    return header;
+}
+
+const uint8_t* RecordingReader::frameData(size_t frame) const
+{
+    if (frame >= mCount) {
+        return nullptr;
+    }
+
+    const RecordingIndexEntry& indexed = mEntries[frame];
+    if (indexed.offset + mFrameHeaderSize + indexed.size > mSegment.size) {
+        return nullptr;
+    }
+
+    // Trust the index only as far as the segment agrees with it.
+    const RecordingFrameHeader header = frameHeader(indexed.offset);
+    if (header.magic != RECORDING_FRAME_MAGIC || header.size != indexed.size) {
+        return nullptr;
+    }
+
+    return mSegment.view + indexed.offset + mFrameHeaderSize;
+}
+
+FrameMetadata RecordingReader::metadata(size_t frame) const
+{
+    if (frame >= mCount || mEntries[frame].offset + mFrameHeaderSize > mSegment.size) {
+        return FrameMetadata();
+    }
+
+    return RecordingFrameMetadata(frameHeader(mEntries[frame].offset));
+}
+
+bool RecordingReader::framePlanes(size_t frame, const FormatConvertor& converter, FramePlanes& planes) const
+{
+    const uint8_t* data = frameData(frame);
+    if (!data || mHeader.stride == 0) {
+        return false;
+    }
+
+    planes = converter.planes(data, std::abs(mHeader.stride), mHeader.width, mHeader.height,
+        mEntries[frame].size);
+
+    // The header describes the frame; the payload has to hold it.
+    for (uint32_t i = 0; i < planes.count; i++) {
+        const FramePlane& plane = planes.planes[i];
+        const size_t end = size_t(plane.data - data) + size_t(plane.stride) * (plane.height - 1) +
+            size_t(plane.width) * plane.sampleBytes;
+
+        if (plane.height == 0 || end > mEntries[frame].size) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------
+// Thumbnail
+//
+// Conversion and scaling run as one pass of an area resampler, which
+// is kept for the next thumbnail of the same size.
+//-------------------------------------------------------------------
+
+bool RecordingReader::thumbnail(size_t frame, uint32_t width, uint32_t height, std::vector<uint8_t>& pixels)
+{
+    const FormatConvertor* converter = DrawDevice::findConversionFunction(mHeader.subtype);
+    FramePlanes planes;
+
+    if (!converter || width == 0 || height == 0 || !framePlanes(frame, *converter, planes)) {
+        return false;
+    }
+
+    if (!mThumbnailScaler || mThumbnailScaler->srcWidth() != mHeader.width ||
+        mThumbnailScaler->srcHeight() != mHeader.height ||
+        mThumbnailScaler->dstWidth() != width || mThumbnailScaler->dstHeight() != height) {
+        mThumbnailScaler = std::make_unique<Resampler>(mHeader.width, mHeader.height, width, height,
+            ResampleFilter::Area);
+    }
+
+    pixels.resize(size_t(width) * height * 4);
+    return mThumbnailScaler->resample(*converter, planes, pixels.data(), width * 4);
+}
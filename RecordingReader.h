@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+#include "RecordingFormat.h"
+
+class FormatConvertor;
+class Resampler;
+struct FramePlanes;
+
+//-------------------------------------------------------------------
+// RecordingReader
+//
+// Random access to one recorded segment. The segment and its sidecar
+// index are memory-mapped, so opening costs no reads and frame data
+// is used in place. Frames are found by timestamp with a binary search
+// of the index.
+//
+// Without a usable sidecar, e.g. for a pre-event file or a segment
+// whose recording was cut short, the index is rebuilt by walking the
+// frame headers once.
+//-------------------------------------------------------------------
+
+class RecordingReader
+{
+public:
+    RecordingReader();
+    ~RecordingReader();
+
+    RecordingReader(const RecordingReader&) = delete;
+    RecordingReader& operator=(const RecordingReader&) = delete;
+
+    bool open(const std::wstring& path);
+    void close();
+
+    const RecordingFileHeader& header() const { return mHeader; }
+
+    size_t frameCount() const { return mCount; }
+    const RecordingIndexEntry& entry(size_t frame) const { return mEntries[frame]; }
+
+    // True if the index came from the sidecar rather than a scan.
+    bool hasSidecar() const { return mScanned.empty() && mCount > 0; }
+
+    // The last frame at or before timestamp, or with keyframe the last
+    // keyframe; the first frame if timestamp is before all of them.
+    size_t seek(int64_t timestamp, bool keyframe = true) const;
+
+    // Payload of a frame inside the mapping, entry(frame).size bytes.
+    const uint8_t* frameData(size_t frame) const;
+
+    // What was recorded about a frame. Fields the file version does not
+    // have are zero.
+    FrameMetadata metadata(size_t frame) const;
+
+    // Planes of a frame for converter, checked against the payload.
+    bool framePlanes(size_t frame, const FormatConvertor& converter, FramePlanes& planes) const;
+
+    // Converts and scales a frame to width x height RGB32.
+    bool thumbnail(size_t frame, uint32_t width, uint32_t height, std::vector<uint8_t>& pixels);
+
+private:
+    struct Mapping
+    {
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE section = nullptr;
+        const uint8_t* view = nullptr;
+        uint64_t size = 0;
+
+        bool open(const std::wstring& path);
+        void close();
+    };
+
+    bool useSidecar(const std::wstring& path);
+    bool scan();
+    RecordingFrameHeader frameHeader(uint64_t offset) const;
+
+    Mapping mSegment;
+    Mapping mIndex;
+    RecordingFileHeader mHeader;
+    size_t mFrameHeaderSize = 0;
+
+    const RecordingIndexEntry* mEntries = nullptr;
+    size_t mCount = 0;
+    std::vector<RecordingIndexEntry> mScanned;
+
+    std::unique_ptr<Resampler> mThumbnailScaler;
+};
@@ -0,0 +1,447 @@
+#include "Resampler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+
+#include "FormatConvertor.h"
+#include "Simd.h"
+#include "WorkerPool.h"
+
+namespace {
+    const int WEIGHT_BITS = 14;
+    const int WEIGHT_ONE = 1 << WEIGHT_BITS;
+    const int WEIGHT_ROUND = 1 << (WEIGHT_BITS - 1);
+    const double PI = 3.14159265358979323846;
+
+    double sinc(double x)
+    {
+        if (x == 0.0) {
+            return 1.0;
+        }
+
+        x *= PI;
+        return std::sin(x) / x;
+    }
+
+    double lanczos3(double x)
+    {
+        return std::abs(x) < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+    }
+
+    inline uint8_t clampWeighted(int32_t sum)
+    {
+        const int32_t value = (sum + WEIGHT_ROUND) >> WEIGHT_BITS;
+        return uint8_t(value < 0 ? 0 : (value > 255 ? 255 : value));
+    }
+
+#if MFCAMERA_SIMD_SSSE3
+    // Two 16-bit weights replicated for _mm_madd_epi16 on interleaved pairs.
+    inline __m128i weightPair(const int16_t* weights)
+    {
+        return _mm_set1_epi32(int(uint16_t(weights[0])) | (int(weights[1]) << 16));
+    }
+
+    inline __m128i finish(__m128i sum)
+    {
+        return _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(WEIGHT_ROUND)), WEIGHT_BITS);
+    }
+#endif
+}
+
+//-------------------------------------------------------------------
+// BuildTable
+//
+// Area weights are the overlap of each source sample with the
+// footprint of the destination sample. Lanczos is widened by the
+// reduction factor when shrinking so that it also low-pass filters.
+//-------------------------------------------------------------------
+
+Resampler::FilterTable Resampler::buildTable(uint32_t srcSize, uint32_t dstSize, ResampleFilter filter)
+{
+    const double scale = double(srcSize) / double(dstSize);
+
+    std::vector<uint32_t> firsts(dstSize);
+    std::vector<std::vector<double>> windows(dstSize);
+    uint32_t maxTaps = 1;
+
+    for (uint32_t i = 0; i < dstSize; i++) {
+        std::vector<double>& window = windows[i];
+        uint32_t first = 0;
+
+        if (filter == ResampleFilter::Area) {
+            const double lo = double(i) * scale;
+            const double hi = double(i + 1) * scale;
+
+            first = std::min(uint32_t(lo), srcSize - 1);
+            const uint32_t last = std::min(uint32_t(std::ceil(hi)), srcSize);
+
+            for (uint32_t j = first; j < last; j++) {
+                window.push_back(std::max(0.0, std::min(hi, double(j + 1)) - std::max(lo, double(j))));
+            }
+        }
+        else {
+            const double filterScale = std::max(scale, 1.0);
+            const double center = (double(i) + 0.5) * scale;
+            const double support = 3.0 * filterScale;
+
+            first = uint32_t(std::max(0.0, std::floor(center - support)));
+            const uint32_t last = uint32_t(std::min(double(srcSize), std::ceil(center + support)));
+
+            for (uint32_t j = first; j < last; j++) {
+                window.push_back(lanczos3((double(j) + 0.5 - center) / filterScale));
+            }
+        }
+
+        double total = 0.0;
+        for (double w : window) {
+            total += w;
+        }
+
+        if (window.empty() || total == 0.0) {
+            window.assign(1, 1.0);
+            total = 1.0;
+        }
+
+        for (double& w : window) {
+            w /= total;
+        }
+
+        firsts[i] = first;
+        maxTaps = std::max(maxTaps, uint32_t(window.size()));
+    }
+
+    // Even tap counts let the vector code take samples in pairs.
+    FilterTable table;
+    table.taps = std::min(maxTaps + (maxTaps & 1), srcSize);
+    table.starts.resize(dstSize);
+    table.weights.assign(size_t(dstSize) * table.taps, 0);
+
+    for (uint32_t i = 0; i < dstSize; i++) {
+        const uint32_t start = std::min(firsts[i], srcSize - table.taps);
+        int16_t* weights = table.weights.data() + size_t(i) * table.taps;
+        const std::vector<double>& window = windows[i];
+
+        int sum = 0;
+        size_t largest = 0;
+
+        for (size_t k = 0; k < window.size(); k++) {
+            const size_t tap = firsts[i] - start + k;
+            weights[tap] = int16_t(std::lround(window[k] * WEIGHT_ONE));
+            sum += weights[tap];
+
+            if (std::abs(weights[tap]) > std::abs(weights[largest])) {
+                largest = tap;
+            }
+        }
+
+        // Make the fixed-point weights sum to exactly one.
+        weights[largest] = int16_t(weights[largest] + WEIGHT_ONE - sum);
+        table.starts[i] = start;
+    }
+
+    return table;
+}
+
+Resampler::Resampler(uint32_t srcWidth, uint32_t srcHeight, uint32_t dstWidth, uint32_t dstHeight,
+    ResampleFilter filter, Layout layout, uint32_t bands) :
+    mSrcWidth(srcWidth), mSrcHeight(srcHeight), mDstWidth(dstWidth), mDstHeight(dstHeight),
+    mFilter(filter), mLayout(layout), mChannels(layout == Layout::RGB32 ? 4 : 1)
+{
+    if (!srcWidth || !srcHeight || !dstWidth || !dstHeight) {
+        return;
+    }
+
+    mHorizontal = buildTable(srcWidth, dstWidth, filter);
+    mVertical = buildTable(srcHeight, dstHeight, filter);
+
+    bands = std::clamp(bands, 1u, dstHeight);
+    const uint32_t bandRows = (dstHeight + bands - 1) / bands;
+    const size_t rowBytes = size_t(dstWidth) * mChannels;
+
+    for (uint32_t first = 0; first < dstHeight; first += bandRows) {
+        Band band;
+        band.firstRow = first;
+        band.endRow = std::min(first + bandRows, dstHeight);
+        band.firstSourceRow = mVertical.starts[band.firstRow];
+        band.sourceRows = mVertical.starts[band.endRow - 1] + mVertical.taps - band.firstSourceRow;
+        band.scratch.resize(band.sourceRows * rowBytes);
+
+        if (layout == Layout::RGB32) {
+            band.converted.resize(size_t(srcWidth) * 4 * 2);
+        }
+
+        mBands.push_back(std::move(band));
+    }
+}
+
+bool Resampler::resample(const uint8_t* source, uint32_t srcStride, uint8_t* destination, uint32_t dstStride,
+    WorkerPool* pool)
+{
+    FramePlanes frame;
+    frame.width = mSrcWidth;
+    frame.height = mSrcHeight;
+    frame.count = 1;
+    frame.planes[0] = { source, int32_t(srcStride), mSrcWidth, mSrcHeight };
+
+    return run(nullptr, frame, destination, dstStride, pool);
+}
+
+bool Resampler::resample(const FormatConvertor& converter, const FramePlanes& source,
+    uint8_t* destination, uint32_t dstStride, WorkerPool* pool)
+{
+    if (mLayout != Layout::RGB32 || source.width != mSrcWidth || source.height != mSrcHeight) {
+        return false;
+    }
+
+    return run(&converter, source, destination, dstStride, pool);
+}
+
+void Resampler::squarePixelSize(uint32_t width, uint32_t height, uint32_t parNumerator,
+    uint32_t parDenominator, uint32_t& squareWidth, uint32_t& squareHeight)
+{
+    squareWidth = width;
+    squareHeight = height;
+
+    if (parNumerator == 0 || parDenominator == 0) {
+        return;
+    }
+
+    if (parNumerator > parDenominator) {
+        squareWidth = uint32_t((uint64_t(width) * parNumerator + parDenominator / 2) / parDenominator);
+    }
+    else if (parNumerator < parDenominator) {
+        squareHeight = uint32_t((uint64_t(height) * parDenominator + parNumerator / 2) / parNumerator);
+    }
+}
+
+bool Resampler::run(const FormatConvertor* converter, const FramePlanes& source,
+    uint8_t* destination, uint32_t dstStride, WorkerPool* pool)
+{
+    if (mBands.empty()) {
+        return false;
+    }
+
+    if (pool && mBands.size() > 1) {
+        std::atomic<bool> ok = true;
+
+        pool->run(mBands.size(), [&](size_t index) {
+            if (!scaleBand(mBands[index], converter, source, destination, dstStride)) {
+                ok.store(false, std::memory_order_relaxed);
+            }
+        });
+
+        return ok.load(std::memory_order_relaxed);
+    }
+
+    for (Band& band : mBands) {
+        if (!scaleBand(band, converter, source, destination, dstStride)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Fails, leaving the band's destination rows unwritten, if a source
+// row cannot be converted.
+bool Resampler::scaleBand(Band& band, const FormatConvertor* converter, const FramePlanes& source,
+    uint8_t* destination, uint32_t dstStride) const
+{
+    const bool simd = Simd::enabled();
+    const size_t rowBytes = size_t(mDstWidth) * mChannels;
+
+    band.convertedPair = UINT32_MAX;
+
+    for (uint32_t row = 0; row < band.sourceRows; row++) {
+        const uint8_t* sourceLine = sourceRow(band, converter, source, band.firstSourceRow + row);
+        if (!sourceLine) {
+            return false;
+        }
+
+        scaleRowHorizontal(sourceLine, band.scratch.data() + row * rowBytes, simd);
+    }
+
+    for (uint32_t y = band.firstRow; y < band.endRow; y++) {
+        const uint8_t* rows = band.scratch.data() + (mVertical.starts[y] - band.firstSourceRow) * rowBytes;
+        const int16_t* weights = mVertical.weights.data() + size_t(y) * mVertical.taps;
+
+        scaleRowVertical(rows, uint32_t(rowBytes), weights, destination + size_t(y) * dstStride, simd);
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------
+// SourceRow
+//
+// Rows are converted in pairs because 4:2:0 formats share chroma
+// between two rows. Returns nullptr if the conversion fails.
+//-------------------------------------------------------------------
+
+const uint8_t* Resampler::sourceRow(Band& band, const FormatConvertor* converter, const FramePlanes& source,
+    uint32_t row) const
+{
+    if (!converter) {
+        return source.planes[0].data + ptrdiff_t(row) * source.planes[0].stride;
+    }
+
+    const uint32_t pair = row & ~1u;
+    const uint32_t rowBytes = mSrcWidth * 4;
+
+    if (band.convertedPair != pair) {
+        if (!converter->convertRegion(band.converted.data(), rowBytes, source,
+            0, pair, mSrcWidth, std::min(2u, mSrcHeight - pair))) {
+            band.convertedPair = UINT32_MAX;
+            return nullptr;
+        }
+
+        band.convertedPair = pair;
+    }
+
+    return band.converted.data() + size_t(row - pair) * rowBytes;
+}
+
+//-------------------------------------------------------------------
+// ScaleRowHorizontal
+//
+// RGB32 pixels are filtered two taps at a time: the channels of both
+// pixels are interleaved into 16-bit pairs and multiplied with the
+// pair of weights in one madd.
+//-------------------------------------------------------------------
+
+void Resampler::scaleRowHorizontal(const uint8_t* source, uint8_t* destination, bool simd) const
+{
+    const uint32_t taps = mHorizontal.taps;
+    const int16_t* weights = mHorizontal.weights.data();
+
+#if MFCAMERA_SIMD_SSSE3
+    if (simd && mChannels == 4 && taps % 2 == 0) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i pairs = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+
+        for (uint32_t x = 0; x < mDstWidth; x++, weights += taps) {
+            const uint8_t* pixels = source + size_t(mHorizontal.starts[x]) * 4;
+            __m128i sum = zero;
+
+            for (uint32_t k = 0; k < taps; k += 2) {
+                const __m128i two = _mm_loadl_epi64((const __m128i*)(pixels + k * 4));
+                const __m128i interleaved = _mm_unpacklo_epi8(_mm_shuffle_epi8(two, pairs), zero);
+                sum = _mm_add_epi32(sum, _mm_madd_epi16(interleaved, weightPair(weights + k)));
+            }
+
+            const __m128i packed = _mm_packs_epi32(finish(sum), zero);
+            const int pixel = _mm_cvtsi128_si32(_mm_packus_epi16(packed, zero));
+            memcpy(destination + size_t(x) * 4, &pixel, 4);
+        }
+
+        return;
+    }
+#elif MFCAMERA_SIMD_NEON
+    if (simd && mChannels == 4) {
+        for (uint32_t x = 0; x < mDstWidth; x++, weights += taps) {
+            const uint8_t* pixels = source + size_t(mHorizontal.starts[x]) * 4;
+            int32x4_t sum = vdupq_n_s32(0);
+
+            for (uint32_t k = 0; k < taps; k++) {
+                uint32_t pixel = 0;
+                memcpy(&pixel, pixels + k * 4, 4);
+                const int16x4_t channels = vget_low_s16(vreinterpretq_s16_u16(vmovl_u8(vcreate_u8(pixel))));
+                sum = vmlal_n_s16(sum, channels, weights[k]);
+            }
+
+            const uint8x8_t result = vqmovn_u16(vcombine_u16(vqrshrun_n_s32(sum, WEIGHT_BITS), vdup_n_u16(0)));
+            vst1_lane_u32((uint32_t*)(destination + size_t(x) * 4), vreinterpret_u32_u8(result), 0);
+        }
+
+        return;
+    }
+#endif
+
+    (void)simd;
+
+    for (uint32_t x = 0; x < mDstWidth; x++, weights += taps) {
+        const uint8_t* pixels = source + size_t(mHorizontal.starts[x]) * mChannels;
+
+        for (uint32_t c = 0; c < mChannels; c++) {
+            int32_t sum = 0;
+            for (uint32_t k = 0; k < taps; k++) {
+                sum += weights[k] * pixels[k * mChannels + c];
+            }
+
+            destination[size_t(x) * mChannels + c] = clampWeighted(sum);
+        }
+    }
+}
+
+//-------------------------------------------------------------------
+// ScaleRowVertical
+//
+// Every byte column is filtered independently, so the vertical pass
+// is the same for all layouts.
+//-------------------------------------------------------------------
+
+void Resampler::scaleRowVertical(const uint8_t* rows, uint32_t rowStride, const int16_t* weights,
+    uint8_t* destination, bool simd) const
+{
+    const uint32_t taps = mVertical.taps;
+    const uint32_t count = rowStride;
+    uint32_t x = 0;
+
+#if MFCAMERA_SIMD_SSSE3
+    if (simd && taps % 2 == 0) {
+        const __m128i zero = _mm_setzero_si128();
+
+        for (; x + 16 <= count; x += 16) {
+            __m128i sum0 = zero, sum1 = zero, sum2 = zero, sum3 = zero;
+
+            for (uint32_t k = 0; k < taps; k += 2) {
+                const __m128i a = _mm_loadu_si128((const __m128i*)(rows + size_t(k) * rowStride + x));
+                const __m128i b = _mm_loadu_si128((const __m128i*)(rows + size_t(k + 1) * rowStride + x));
+                const __m128i w = weightPair(weights + k);
+
+                const __m128i lo = _mm_unpacklo_epi8(a, b);
+                const __m128i hi = _mm_unpackhi_epi8(a, b);
+
+                sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+                sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+                sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+                sum3 = _mm_add_epi32(sum3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+            }
+
+            const __m128i lo = _mm_packs_epi32(finish(sum0), finish(sum1));
+            const __m128i hi = _mm_packs_epi32(finish(sum2), finish(sum3));
+            _mm_storeu_si128((__m128i*)(destination + x), _mm_packus_epi16(lo, hi));
+        }
+    }
+#elif MFCAMERA_SIMD_NEON
+    if (simd) {
+        for (; x + 8 <= count; x += 8) {
+            int32x4_t lo = vdupq_n_s32(0);
+            int32x4_t hi = vdupq_n_s32(0);
+
+            for (uint32_t k = 0; k < taps; k++) {
+                const int16x8_t row = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(rows + size_t(k) * rowStride + x)));
+                lo = vmlal_n_s16(lo, vget_low_s16(row), weights[k]);
+                hi = vmlal_n_s16(hi, vget_high_s16(row), weights[k]);
+            }
+
+            const uint16x8_t wide = vcombine_u16(vqrshrun_n_s32(lo, WEIGHT_BITS), vqrshrun_n_s32(hi, WEIGHT_BITS));
+            vst1_u8(destination + x, vqmovn_u16(wide));
+        }
+    }
+#endif
+
+    (void)simd;
+
+    for (; x < count; x++) {
+        int32_t sum = 0;
+        for (uint32_t k = 0; k < taps; k++) {
+            sum += weights[k] * rows[size_t(k) * rowStride + x];
+        }
+
+        destination[x] = clampWeighted(sum);
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class FormatConvertor;
+struct FramePlanes;
+class WorkerPool;
+
+enum class ResampleFilter
+{
+    Area,       // Box average; cheap, no ringing, good for large reductions.
+    Lanczos3    // Sharper, slight ringing on hard edges.
+};
+
+//-------------------------------------------------------------------
+// Resampler
+//
+// Scales 8-bit images with separable filtering: a horizontal pass
+// into a scratch buffer, then a vertical pass into the destination.
+// Filter taps and 14-bit fixed-point weights for both directions are
+// computed once per (source, destination) size, so a Resampler is
+// meant to be kept for as long as the sizes stay the same.
+//
+// The destination is split into horizontal bands that are scaled
+// independently, on a WorkerPool if one is given. Each band owns its
+// scratch rows, so resample() does not allocate.
+//
+// Layouts: RGB32 (4 bytes per pixel, all channels filtered) and Gray8
+// (single plane, e.g. the Y or UV plane of NV12 or pyramid levels).
+//
+// An RGB32 resampler can also read frames in any format a
+// FormatConvertor handles. Source rows are then converted in pairs
+// just before the horizontal pass, so conversion and scaling share one
+// pass and no full-size RGB32 frame is written.
+//-------------------------------------------------------------------
+
+class Resampler
+{
+public:
+    enum class Layout
+    {
+        RGB32, Gray8
+    };
+
+    Resampler(uint32_t srcWidth, uint32_t srcHeight, uint32_t dstWidth, uint32_t dstHeight,
+        ResampleFilter filter, Layout layout = Layout::RGB32, uint32_t bands = 1);
+
+    Resampler(const Resampler&) = delete;
+    Resampler& operator=(const Resampler&) = delete;
+
+    // Not reentrant: the scratch buffers are shared between calls.
+    bool resample(const uint8_t* source, uint32_t srcStride, uint8_t* destination, uint32_t dstStride,
+        WorkerPool* pool = nullptr);
+
+    // Converts and scales in one pass; RGB32 layout only.
+    bool resample(const FormatConvertor& converter, const FramePlanes& source,
+        uint8_t* destination, uint32_t dstStride, WorkerPool* pool = nullptr);
+
+    // Size of a frame with the given pixel aspect ratio once its pixels
+    // are square. Wide pixels stretch the width, tall pixels the height.
+    static void squarePixelSize(uint32_t width, uint32_t height, uint32_t parNumerator,
+        uint32_t parDenominator, uint32_t& squareWidth, uint32_t& squareHeight);
+
+    uint32_t srcWidth() const { return mSrcWidth; }
+    uint32_t srcHeight() const { return mSrcHeight; }
+    uint32_t dstWidth() const { return mDstWidth; }
+    uint32_t dstHeight() const { return mDstHeight; }
+    ResampleFilter filter() const { return mFilter; }
+    Layout layout() const { return mLayout; }
+
+private:
+    // Contributions of the source samples to each destination sample.
+    // Every window has the same (even) number of taps and lies inside
+    // the source; unused taps have zero weight.
+    struct FilterTable
+    {
+        uint32_t taps = 0;
+        std::vector<uint32_t> starts;   // First source sample per destination sample.
+        std::vector<int16_t> weights;   // taps weights per destination sample.
+    };
+
+    struct Band
+    {
+        uint32_t firstRow = 0;          // Destination rows [firstRow, endRow).
+        uint32_t endRow = 0;
+        uint32_t firstSourceRow = 0;    // Source rows needed, horizontally scaled.
+        uint32_t sourceRows = 0;
+        std::vector<uint8_t> scratch;
+        std::vector<uint8_t> converted; // Two converted source rows.
+        uint32_t convertedPair = 0;
+    };
+
+    static FilterTable buildTable(uint32_t srcSize, uint32_t dstSize, ResampleFilter filter);
+
+    bool run(const FormatConvertor* converter, const FramePlanes& source,
+        uint8_t* destination, uint32_t dstStride, WorkerPool* pool);
+    bool scaleBand(Band& band, const FormatConvertor* converter, const FramePlanes& source,
+        uint8_t* destination, uint32_t dstStride) const;
+    const uint8_t* sourceRow(Band& band, const FormatConvertor* converter, const FramePlanes& source,
+        uint32_t row) const;
+    void scaleRowHorizontal(const uint8_t* source, uint8_t* destination, bool simd) const;
+    void scaleRowVertical(const uint8_t* rows, uint32_t rowStride, const int16_t* weights,
+        uint8_t* destination, bool simd) const;
+
+    uint32_t mSrcWidth = 0;
+    uint32_t mSrcHeight = 0;
+    uint32_t mDstWidth = 0;
+    uint32_t mDstHeight = 0;
+    ResampleFilter mFilter = ResampleFilter::Area;
+    Layout mLayout = Layout::RGB32;
+    uint32_t mChannels = 4;
+
+    FilterTable mHorizontal;
+    FilterTable mVertical;
+    std::vector<Band> mBands;
+};
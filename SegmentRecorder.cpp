@@ -0,0 +1,590 @@
+#include "SegmentRecorder.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Debug.h"
+#include "DrawDevice.h"
+#include "Metrics.h"
+#include "SessionConfig.h"
+#include "Y4m.h"
+
+namespace {
+    // Unbuffered writes must start and end on sector boundaries; 4 KiB
+    // covers both 512-byte and 4K-native disks.
+    const size_t SECTOR_SIZE = 4096;
+    const ULONG_PTR STOP_KEY = 1;
+    const size_t INDEX_BATCH = 256;
+    const LONGLONG TICKS_PER_SECOND = 10000000;
+
+    struct RecorderMetrics
+    {
+        MetricHistogram& writeLatency = Metrics::instance().histogram("mfcamera_recording_write_seconds",
+            "Time from submitting a recording write to its completion.");
+        MetricCounter& bytes = Metrics::instance().counter("mfcamera_recording_bytes_total",
+            "Bytes written to recording segments.");
+        MetricCounter& segments = Metrics::instance().counter("mfcamera_recording_segments_total",
+            "Recording segments opened.");
+        MetricCounter& dropped = Metrics::instance().counter("mfcamera_recording_dropped_total",
+            "Frames the recorder could not write.");
+        MetricGauge& inFlight = Metrics::instance().gauge("mfcamera_recording_writes_in_flight",
+            "Recording writes submitted and not yet completed.");
+    };
+
+    RecorderMetrics& recorderMetrics()
+    {
+        static RecorderMetrics metrics;
+        return metrics;
+    }
+
+    size_t alignUp(size_t value)
+    {
+        return (value + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+    }
+
+    std::wstring segmentPath(const std::wstring& directory, const std::wstring& prefix, uint32_t index,
+        const wchar_t* extension)
+    {
+        SYSTEMTIME now = {};
+        GetLocalTime(&now);
+
+        wchar_t name[96];
+        swprintf_s(name, L"%s-%04u%02u%02u-%02u%02u%02u-%04u.%s", prefix.c_str(),
+            now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond, index, extension);
+
+        std::wstring path = directory;
+        if (!path.empty() && path.back() != L'\\') {
+            path += L'\\';
+        }
+
+        return path + name;
+    }
+
+    // Bytes a frame of length payload bytes adds to a segment; 0 if the
+    // container cannot hold it.
+    uint64_t recordedBytes(RecordingContainer container, const FrameInfo& info, DWORD length)
+    {
+        if (container == RecordingContainer::Raw) {
+            return sizeof(RecordingFrameHeader) + length;
+        }
+
+        Y4m::Chroma chroma;
+        return Y4m::chromaOf(info.subtype, chroma) ?
+            Y4m::FRAME_TAG_SIZE + Y4m::frameBytes(chroma, info.width, info.height) : 0;
+    }
+}
+
+SegmentRecorder::Options SegmentRecorder::configure(const SessionConfig& config)
+{
+    Options options;
+    options.directory = config.recordingDirectory;
+    options.segmentDuration = std::chrono::seconds(config.segmentSeconds);
+    options.segmentBytes = uint64_t(config.segmentMB) << 20;
+    options.container = config.recordingFormat;
+    options.fps = config.fps;
+    options.streamCapacity = config.streamCapacity;
+
+    return options;
+}
+
+SegmentRecorder::SegmentRecorder(const Options& options)
+    : mOptions(options)
+    , mFeeder([this](const Frame& frame) { push(frame); })
+{
+    mOptions.bufferBytes = alignUp(std::max(mOptions.bufferBytes, SECTOR_SIZE));
+    mOptions.buffers = std::max(mOptions.buffers, 2u);
+
+    mMemory = static_cast<uint8_t*>(VirtualAlloc(nullptr, mOptions.bufferBytes * mOptions.buffers,
+        MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+
+    mIndex.reserve(INDEX_BATCH);
+
+    mBuffers.resize(mOptions.buffers);
+    for (uint32_t i = 0; mMemory && i < mOptions.buffers; i++) {
+        mBuffers[i].data = mMemory + mOptions.bufferBytes * i;
+        mFree.push_back(&mBuffers[i]);
+    }
+
+    mPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+
+    mCompletion = std::thread([this] {
+        completionLoop();
+    });
+}
+
+SegmentRecorder::~SegmentRecorder()
+{
+    stop();
+
+    if (mPort) {
+        PostQueuedCompletionStatus(mPort, 0, STOP_KEY, nullptr);
+    }
+
+    mCompletion.join();
+
+    if (mPort) {
+        CloseHandle(mPort);
+    }
+
+    if (mMemory) {
+        VirtualFree(mMemory, 0, MEM_RELEASE);
+    }
+}
+
+bool SegmentRecorder::start(FrameSource& source)
+{
+    if (mFeeder.isRunning() || !mMemory || !mPort) {
+        return false;
+    }
+
+    return mFeeder.start(source, mOptions.streamCapacity);
+}
+
+void SegmentRecorder::stop()
+{
+    mFeeder.stop();
+    closeSegment();
+}
+
+//-------------------------------------------------------------------
+// Push
+//
+// A failed write ends the segment; the next frame tries a new one.
+//-------------------------------------------------------------------
+
+bool SegmentRecorder::push(const Frame& frame)
+{
+    if (!frame.sample() || !mMemory) {
+        return false;
+    }
+
+    if (mWriteFailed.exchange(false)) {
+        closeSegment();
+    }
+
+    const FrameFeeder::Bytes bytes(frame);
+    if (!bytes) {
+        return false;
+    }
+
+    const FrameInfo& info = frame.info();
+    const uint64_t frameBytes = recordedBytes(mOptions.container, info, bytes.length());
+
+    if (mFile != INVALID_HANDLE_VALUE && needsNewSegment(info, frameBytes)) {
+        closeSegment();
+    }
+
+    const bool written = (mFile != INVALID_HANDLE_VALUE || openSegment(info)) &&
+        appendFrame(info, bytes.data(), bytes.length());
+
+    if (!written) {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        recorderMetrics().dropped.add();
+    }
+
+    return written;
+}
+
+bool SegmentRecorder::needsNewSegment(const FrameInfo& info, uint64_t frameBytes) const
+{
+    if (info.subtype != mHeader.subtype || info.width != mHeader.width || info.height != mHeader.height) {
+        return true;
+    }
+
+    // Every segment holds at least one frame, however large.
+    if (mSegmentBytes == mHeaderBytes) {
+        return false;
+    }
+
+    if (mOptions.segmentDuration.count() > 0 &&
+        info.timestamp - mSegmentStart >= mOptions.segmentDuration.count() * TICKS_PER_SECOND) {
+        return true;
+    }
+
+    return mOptions.segmentBytes > 0 && mSegmentBytes + frameBytes > mOptions.segmentBytes;
+}
+
+//-------------------------------------------------------------------
+// AppendFrame
+//
+// Y4M frames are split into planes first, except I420, which is
+// stored as delivered. The planes come from the converter of the
+// format, which finds the chroma of NV12 with padding rows. A payload
+// shorter than its format is dropped.
+//-------------------------------------------------------------------
+
+bool SegmentRecorder::appendFrame(const FrameInfo& info, const uint8_t* data, DWORD length)
+{
+    if (mOptions.container == RecordingContainer::Y4m) {
+        if (length < mPlanar.size()) {
+            return false;
+        }
+
+        const bool planar = info.subtype == MFVideoFormat_I420;
+        const FormatConvertor* converter = planar ? nullptr : DrawDevice::findConversionFunction(info.subtype);
+        if (!planar && (!converter || mHeader.stride <= 0)) {
+            return false;
+        }
+
+        if (!append(Y4m::FRAME_TAG, Y4m::FRAME_TAG_SIZE)) {
+            return false;
+        }
+
+        if (planar) {
+            return append(data, mPlanar.size());
+        }
+
+        Y4m::toPlanar(info.subtype, converter->planes(data, mHeader.stride, info.width, info.height, length),
+            mPlanar.data());
+        return append(mPlanar.data(), mPlanar.size());
+    }
+
+    const RecordingFrameHeader header = RecordingFrameHeaderFor(info, length);
+
+    RecordingIndexEntry entry;
+    entry.timestamp = header.timestamp;
+    entry.offset = mSegmentBytes;
+    entry.sequence = header.sequence;
+    entry.size = header.size;
+    entry.flags = header.flags;
+
+    if (!append(&header, sizeof(header)) || !append(data, length)) {
+        return false;
+    }
+
+    if (mIndexFile != INVALID_HANDLE_VALUE) {
+        mIndex.push_back(entry);
+
+        if (mIndex.size() == INDEX_BATCH) {
+            flushIndex();
+        }
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------
+// OpenSegment
+//
+// Creates the next segment file, associates it with the completion
+// port and queues the file header.
+//-------------------------------------------------------------------
+
+bool SegmentRecorder::openSegment(const FrameInfo& info)
+{
+    const bool y4m = mOptions.container == RecordingContainer::Y4m;
+
+    Y4m::Chroma chroma = Y4m::Chroma::C420;
+    if (y4m && !Y4m::chromaOf(info.subtype, chroma)) {
+        if (info.subtype != mRejected) {
+            Error("SegmentRecorder: %.4s frames cannot be recorded as Y4M\n",
+                reinterpret_cast<const char*>(&info.subtype.Data1));
+            mRejected = info.subtype;
+        }
+
+        return false;
+    }
+
+    const uint32_t index = mSegments.load(std::memory_order_relaxed);
+    const std::wstring path = segmentPath(mOptions.directory, mOptions.prefix, index, y4m ? L"y4m" : L"mfcr");
+
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_NEW,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_NO_BUFFERING, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE && GetLastError() == ERROR_INVALID_PARAMETER) {
+        Warn("SegmentRecorder: unbuffered I/O not supported, writing through the cache\n");
+        file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_NEW,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, nullptr);
+    }
+
+    if (file == INVALID_HANDLE_VALUE) {
+        Error("SegmentRecorder: cannot create %S (%u)\n", path.c_str(), GetLastError());
+        return false;
+    }
+
+    if (!CreateIoCompletionPort(file, mPort, 0, 0)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    // Reserve the clusters up front; the end of file is set on close.
+    FILE_ALLOCATION_INFO allocation = {};
+    allocation.AllocationSize.QuadPart = LONGLONG(mOptions.segmentBytes > 0 ?
+        mOptions.segmentBytes : mOptions.preallocateBytes);
+
+    if (allocation.AllocationSize.QuadPart > 0 &&
+        !SetFileInformationByHandle(file, FileAllocationInfo, &allocation, sizeof(allocation))) {
+        Warn("SegmentRecorder: cannot preallocate %S (%u)\n", path.c_str(), GetLastError());
+    }
+
+    mFile = file;
+    mFileOffset = 0;
+    mSegmentBytes = 0;
+    mSegmentStart = info.timestamp;
+
+    mHeader = RecordingFileHeader();
+    mHeader.subtype = info.subtype;
+    mHeader.width = info.width;
+    mHeader.height = info.height;
+
+    LONG stride = 0;
+    if (SUCCEEDED(MFGetStrideForBitmapInfoHeader(mHeader.subtype.Data1, mHeader.width, &stride))) {
+        mHeader.stride = stride;
+    }
+
+    mSegments.fetch_add(1, std::memory_order_relaxed);
+    recorderMetrics().segments.add();
+    Info("SegmentRecorder: recording to %S\n", path.c_str());
+
+    if (y4m) {
+        Y4m::StreamHeader stream;
+        stream.width = info.width;
+        stream.height = info.height;
+        stream.rateNumerator = mOptions.fps;
+        stream.chroma = chroma;
+
+        const std::string text = Y4m::formatHeader(stream);
+        mPlanar.resize(Y4m::frameBytes(chroma, info.width, info.height));
+        mHeaderBytes = text.size();
+
+        return append(text.data(), text.size());
+    }
+
+    openIndex(path);
+    mHeaderBytes = sizeof(mHeader);
+
+    return append(&mHeader, sizeof(mHeader));
+}
+
+//-------------------------------------------------------------------
+// CloseSegment
+//
+// The last buffer is padded to a whole sector for the unbuffered
+// write; once every write has completed the end of file is moved back
+// to the real length, which also releases the unused preallocation.
+//-------------------------------------------------------------------
+
+void SegmentRecorder::closeSegment()
+{
+    if (mFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    if (mCurrent && mCurrent->used > 0) {
+        const size_t padded = alignUp(mCurrent->used);
+        memset(mCurrent->data + mCurrent->used, 0, padded - mCurrent->used);
+        mCurrent->used = padded;
+
+        submit(mCurrent);
+        mCurrent = nullptr;
+    }
+
+    waitIdle();
+
+    FILE_END_OF_FILE_INFO end = {};
+    end.EndOfFile.QuadPart = LONGLONG(mSegmentBytes);
+    if (!SetFileInformationByHandle(mFile, FileEndOfFileInfo, &end, sizeof(end))) {
+        Error("SegmentRecorder: cannot set the segment length (%u)\n", GetLastError());
+    }
+
+    CloseHandle(mFile);
+    mFile = INVALID_HANDLE_VALUE;
+
+    if (mIndexFile != INVALID_HANDLE_VALUE) {
+        flushIndex();
+        CloseHandle(mIndexFile);
+        mIndexFile = INVALID_HANDLE_VALUE;
+    }
+}
+
+//-------------------------------------------------------------------
+// OpenIndex
+//
+// Recording goes on without an index if it cannot be created; replay
+// then scans the segment instead.
+//-------------------------------------------------------------------
+
+void SegmentRecorder::openIndex(const std::wstring& segment)
+{
+    const std::wstring path = RecordingIndexPath(segment);
+
+    mIndex.clear();
+    mIndexFile = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_NEW,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+    if (mIndexFile == INVALID_HANDLE_VALUE) {
+        Warn("SegmentRecorder: cannot create %S (%u)\n", path.c_str(), GetLastError());
+        return;
+    }
+
+    RecordingIndexHeader header;
+    header.entrySize = sizeof(RecordingIndexEntry);
+
+    DWORD written = 0;
+    if (!WriteFile(mIndexFile, &header, sizeof(header), &written, nullptr) || written != sizeof(header)) {
+        CloseHandle(mIndexFile);
+        mIndexFile = INVALID_HANDLE_VALUE;
+    }
+}
+
+void SegmentRecorder::flushIndex()
+{
+    if (mIndex.empty()) {
+        return;
+    }
+
+    const DWORD bytes = DWORD(mIndex.size() * sizeof(RecordingIndexEntry));
+    DWORD written = 0;
+
+    if (!WriteFile(mIndexFile, mIndex.data(), bytes, &written, nullptr) || written != bytes) {
+        Warn("SegmentRecorder: cannot write the index (%u)\n", GetLastError());
+        CloseHandle(mIndexFile);
+        mIndexFile = INVALID_HANDLE_VALUE;
+    }
+
+    mIndex.clear();
+}
+
+//-------------------------------------------------------------------
+// Append
+//
+// Copies into the current buffer and submits every buffer that fills
+// up. Buffers are always written whole, so file offsets stay sector
+// aligned.
+//-------------------------------------------------------------------
+
+bool SegmentRecorder::append(const void* data, size_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    while (size > 0) {
+        if (!mCurrent && !(mCurrent = acquire())) {
+            return false;
+        }
+
+        const size_t chunk = std::min(size, mOptions.bufferBytes - mCurrent->used);
+        memcpy(mCurrent->data + mCurrent->used, bytes, chunk);
+        mCurrent->used += chunk;
+        mSegmentBytes += chunk;
+        bytes += chunk;
+        size -= chunk;
+
+        if (mCurrent->used == mOptions.bufferBytes) {
+            WriteBuffer* full = mCurrent;
+            mCurrent = nullptr;
+
+            if (!submit(full)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool SegmentRecorder::submit(WriteBuffer* buffer)
+{
+    buffer->overlapped = OVERLAPPED();
+    buffer->overlapped.Offset = DWORD(mFileOffset);
+    buffer->overlapped.OffsetHigh = DWORD(mFileOffset >> 32);
+    mFileOffset += buffer->used;
+
+    LARGE_INTEGER now = {};
+    QueryPerformanceCounter(&now);
+    buffer->submitted = now.QuadPart;
+
+    {
+        std::lock_guard lock(mMutex);
+        mInFlight++;
+        recorderMetrics().inFlight.set(mInFlight);
+    }
+
+    // Even writes that complete at once are reported through the port.
+    if (!WriteFile(mFile, buffer->data, DWORD(buffer->used), nullptr, &buffer->overlapped) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        Error("SegmentRecorder: write failed (%u)\n", GetLastError());
+
+        std::lock_guard lock(mMutex);
+        mInFlight--;
+        buffer->used = 0;
+        mFree.push_back(buffer);
+        mWriteFailed = true;
+        mBufferFree.notify_all();
+        return false;
+    }
+
+    return true;
+}
+
+SegmentRecorder::WriteBuffer* SegmentRecorder::acquire()
+{
+    std::unique_lock lock(mMutex);
+
+    mBufferFree.wait(lock, [this] {
+        return !mFree.empty();
+    });
+
+    WriteBuffer* buffer = mFree.back();
+    mFree.pop_back();
+    buffer->used = 0;
+
+    return buffer;
+}
+
+void SegmentRecorder::waitIdle()
+{
+    std::unique_lock lock(mMutex);
+
+    mBufferFree.wait(lock, [this] {
+        return mInFlight == 0;
+    });
+}
+
+//-------------------------------------------------------------------
+// CompletionLoop
+//
+// Reaps finished writes, records their latency and returns the
+// buffers.
+//-------------------------------------------------------------------
+
+void SegmentRecorder::completionLoop()
+{
+    RecorderMetrics& metrics = recorderMetrics();
+
+    for (;;) {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = nullptr;
+
+        const BOOL ok = GetQueuedCompletionStatus(mPort, &bytes, &key, &overlapped, INFINITE);
+
+        if (!overlapped) {
+            if (key == STOP_KEY || !ok) {
+                return;
+            }
+
+            continue;
+        }
+
+        WriteBuffer* buffer = CONTAINING_RECORD(overlapped, WriteBuffer, overlapped);
+
+        LARGE_INTEGER now = {};
+        QueryPerformanceCounter(&now);
+        metrics.writeLatency.observe(ElapsedMicroseconds(buffer->submitted, now.QuadPart));
+
+        if (ok && bytes == buffer->used) {
+            metrics.bytes.add(bytes);
+        }
+        else {
+            Error("SegmentRecorder: write failed (%u)\n", ok ? ERROR_WRITE_FAULT : GetLastError());
+            mWriteFailed = true;
+        }
+
+        std::lock_guard lock(mMutex);
+        mInFlight--;
+        metrics.inFlight.set(mInFlight);
+        buffer->used = 0;
+        mFree.push_back(buffer);
+        mBufferFree.notify_all();
+    }
+}
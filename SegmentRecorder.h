@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <windows.h>
+
+#include "Frame.h"
+#include "FrameFeeder.h"
+#include "RecordingFormat.h"
+#include "SessionConfig.h"
+
+class FrameSource;
+
+//-------------------------------------------------------------------
+// SegmentRecorder
+//
+// Records raw frames in the recording format or as YUV4MPEG2, split
+// into segment files that are closed after a duration or size. A new segment also
+// starts when the format changes, so every file has one header that
+// is valid for all of its frames.
+//
+// Frames are copied into large page-aligned buffers, which are written
+// with unbuffered overlapped I/O and completed on an I/O completion
+// port. The capture data therefore does not pass through the file
+// cache, and several writes are in flight at once. Each segment is
+// preallocated so that the file system does not have to extend it on
+// every write. Volumes that refuse unbuffered I/O are written through
+// the cache on the same path.
+//
+// Next to every segment a sidecar index (see RecordingFormat.h) is
+// built as frames are appended. It is written in batches through the
+// cache; it is small, and a missing tail is rebuilt on replay. Y4M
+// segments have no index; the tools that read them stream them.
+//
+// The recorder feeds itself from a subscriber stream of the source on
+// its own thread. If the disk falls behind, that thread waits for a
+// free buffer and the stream drops frames; capture is not slowed down.
+//-------------------------------------------------------------------
+
+class SegmentRecorder
+{
+public:
+    struct Options
+    {
+        std::wstring directory;
+        std::wstring prefix = L"capture";
+        RecordingContainer container = RecordingContainer::Raw;
+        uint32_t fps = 30;                          // Frame rate in Y4M headers.
+        std::chrono::seconds segmentDuration = std::chrono::seconds(60);    // 0 = no limit
+        uint64_t segmentBytes = 0;                  // 0 = no limit
+        uint64_t preallocateBytes = 256ull << 20;   // Without a size limit.
+        size_t bufferBytes = 4 << 20;
+        uint32_t buffers = 4;
+        size_t streamCapacity = 4;                  // Frames queued for the recorder.
+    };
+
+    // The [recording] section of the session configuration, and the
+    // queue size of [pipeline].
+    static Options configure(const SessionConfig& config);
+
+    explicit SegmentRecorder(const Options& options);
+    ~SegmentRecorder();
+
+    SegmentRecorder(const SegmentRecorder&) = delete;
+    SegmentRecorder& operator=(const SegmentRecorder&) = delete;
+
+    // Starts recording the frames of source. Call stop() before the
+    // source goes away.
+    bool start(FrameSource& source);
+
+    // Stops feeding and closes the current segment.
+    void stop();
+
+    // Appends one frame. Called by the feeding thread; can be called
+    // directly if the recorder is not started.
+    bool push(const Frame& frame);
+
+    uint32_t segments() const { return mSegments.load(std::memory_order_relaxed); }
+    uint64_t droppedFrames() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+    struct WriteBuffer
+    {
+        OVERLAPPED overlapped = {};
+        uint8_t* data = nullptr;
+        size_t used = 0;
+        LONGLONG submitted = 0;
+    };
+
+    bool openSegment(const FrameInfo& info);
+    void closeSegment();
+    bool needsNewSegment(const FrameInfo& info, uint64_t frameBytes) const;
+    bool appendFrame(const FrameInfo& info, const uint8_t* data, DWORD length);
+    bool append(const void* data, size_t size);
+    void openIndex(const std::wstring& segment);
+    void flushIndex();
+    bool submit(WriteBuffer* buffer);
+    WriteBuffer* acquire();
+    void waitIdle();
+    void completionLoop();
+
+    Options mOptions;
+
+    // One page-aligned block carved into the write buffers.
+    uint8_t* mMemory = nullptr;
+    std::vector<WriteBuffer> mBuffers;
+    std::vector<WriteBuffer*> mFree;
+    uint32_t mInFlight = 0;
+    WriteBuffer* mCurrent = nullptr;
+
+    HANDLE mPort = nullptr;
+    HANDLE mFile = INVALID_HANDLE_VALUE;
+    RecordingFileHeader mHeader;
+    uint64_t mFileOffset = 0;       // Next write position; sector aligned.
+    uint64_t mSegmentBytes = 0;     // Bytes of the segment, without padding.
+    uint64_t mHeaderBytes = 0;
+    LONGLONG mSegmentStart = 0;     // Timestamp of the first frame.
+    HANDLE mIndexFile = INVALID_HANDLE_VALUE;
+    std::vector<RecordingIndexEntry> mIndex;
+    std::vector<uint8_t> mPlanar;   // Y4M frame being written.
+    GUID mRejected = GUID_NULL;     // Last format Y4M could not store.
+    std::atomic<uint32_t> mSegments = 0;
+    std::atomic<uint64_t> mDropped = 0;
+    std::atomic<bool> mWriteFailed = false;
+
+    std::thread mCompletion;
+    FrameFeeder mFeeder;
+    std::mutex mMutex;
+    std::condition_variable mBufferFree;
+};
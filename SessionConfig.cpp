@@ -0,0 +1,281 @@
+#include "SessionConfig.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+
+#include "Debug.h"
+
+namespace {
+    struct FormatName
+    {
+        const char* name;
+        GUID subtype;
+    };
+
+    const FormatName formatNames[] =
+    {
+        { "RGB32", MFVideoFormat_RGB32 },
+        { "RGB24", MFVideoFormat_RGB24 },
+        { "YUY2",  MFVideoFormat_YUY2 },
+        { "NV12",  MFVideoFormat_NV12 },
+    };
+
+    std::string trim(const std::string& text)
+    {
+        const size_t begin = text.find_first_not_of(" \t\r\n");
+        if (begin == std::string::npos) {
+            return {};
+        }
+
+        const size_t end = text.find_last_not_of(" \t\r\n");
+        return text.substr(begin, end - begin + 1);
+    }
+
+    std::string lower(std::string text)
+    {
+        std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) {
+            return char(std::tolower(c));
+        });
+        return text;
+    }
+
+    std::vector<std::string> split(const std::string& text)
+    {
+        std::vector<std::string> items;
+
+        size_t begin = 0;
+        while (begin <= text.size()) {
+            size_t end = text.find(',', begin);
+            if (end == std::string::npos) {
+                end = text.size();
+            }
+
+            std::string item = trim(text.substr(begin, end - begin));
+            if (!item.empty()) {
+                items.push_back(item);
+            }
+
+            begin = end + 1;
+        }
+
+        return items;
+    }
+
+    bool parseNumber(const std::string& text, uint64_t& value)
+    {
+        if (text.empty()) {
+            return false;
+        }
+
+        char* end = nullptr;
+        value = std::strtoull(text.c_str(), &end, 0);   // Accepts 0x prefixes.
+        return *end == 0;
+    }
+
+    bool parseNumber(const std::string& text, uint32_t& value)
+    {
+        uint64_t wide = 0;
+        if (!parseNumber(text, wide) || wide > UINT32_MAX) {
+            return false;
+        }
+
+        value = uint32_t(wide);
+        return true;
+    }
+
+    bool parseBool(const std::string& text, bool& value)
+    {
+        const std::string word = lower(text);
+
+        if (word == "on" || word == "true" || word == "yes" || word == "1") {
+            value = true;
+            return true;
+        }
+
+        if (word == "off" || word == "false" || word == "no" || word == "0") {
+            value = false;
+            return true;
+        }
+
+        return false;
+    }
+
+    std::wstring widen(const std::string& text)
+    {
+        const int length = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), int(text.size()), nullptr, 0);
+        std::wstring wide(size_t(length), L'\0');
+        MultiByteToWideChar(CP_UTF8, 0, text.c_str(), int(text.size()), wide.data(), length);
+
+        return wide;
+    }
+}
+
+//-------------------------------------------------------------------
+// Load
+//
+// Returns false if the file cannot be read or contains an invalid
+// value. Unknown keys are reported and ignored.
+//-------------------------------------------------------------------
+
+bool SessionConfig::load(const std::wstring& path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    std::string section;
+    std::string line;
+    uint32_t lineNumber = 0;
+
+    while (std::getline(file, line)) {
+        ++lineNumber;
+
+        line = trim(line.substr(0, line.find(';')));
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        if (line.front() == '[' && line.back() == ']') {
+            section = lower(trim(line.substr(1, line.size() - 2)));
+            continue;
+        }
+
+        const size_t separator = line.find('=');
+        if (separator == std::string::npos) {
+            Error("Config line %u: expected key = value\n", lineNumber);
+            return false;
+        }
+
+        const std::string key = section + "." + lower(trim(line.substr(0, separator)));
+        const std::string value = trim(line.substr(separator + 1));
+
+        bool valid = true;
+
+        if (key == "capture.device") {
+            device = widen(value);
+        }
+        else if (key == "capture.width") {
+            valid = parseNumber(value, width);
+        }
+        else if (key == "capture.height") {
+            valid = parseNumber(value, height);
+        }
+        else if (key == "capture.fps") {
+            valid = parseNumber(value, fps) && fps > 0;
+        }
+        else if (key == "capture.resolution") {
+            const std::string policy = lower(value);
+            valid = policy == "exact" || policy == "closest";
+            resolution = policy == "closest" ? ResolutionPolicy::Closest : ResolutionPolicy::Exact;
+        }
+        else if (key == "capture.formats") {
+            formats.clear();
+            for (const std::string& name : split(value)) {
+                auto it = std::find_if(std::begin(formatNames), std::end(formatNames), [&](const FormatName& f) {
+                    return _stricmp(f.name, name.c_str()) == 0;
+                });
+
+                if (it == std::end(formatNames)) {
+                    valid = false;
+                    break;
+                }
+
+                formats.push_back(it->subtype);
+            }
+        }
+        else if (key == "capture.rotation") {
+            uint32_t degrees = 0;
+            valid = parseNumber(value, degrees) && degrees % 90 == 0 && degrees < 360;
+            orientation.rotation = Orientation::Rotation(degrees / 90);
+        }
+        else if (key == "capture.mirror") {
+            const std::string mirror = lower(value);
+            valid = mirror == "none" || mirror == "horizontal" || mirror == "vertical" || mirror == "both";
+            orientation.flipHorizontal = mirror == "horizontal" || mirror == "both";
+            orientation.flipVertical = mirror == "vertical" || mirror == "both";
+        }
+        else if (key == "pipeline.depth") {
+            valid = parseNumber(value, pipelineDepth) && pipelineDepth > 0;
+        }
+        else if (key == "pipeline.stream_capacity") {
+            valid = parseNumber(value, streamCapacity) && streamCapacity > 0;
+        }
+        else if (key == "pipeline.sinks") {
+            sinks = split(lower(value));
+        }
+        else if (key == "pipeline.square_pixels") {
+            valid = parseBool(value, squarePixels);
+        }
+        else if (key == "denoise.strength") {
+            valid = parseNumber(value, denoiseStrength) && denoiseStrength <= 100;
+        }
+        else if (key == "denoise.motion_threshold") {
+            valid = parseNumber(value, denoiseThreshold) && denoiseThreshold > 0 && denoiseThreshold < 256;
+        }
+        else if (key == "preview.scaler") {
+            const std::string scaler = lower(value);
+            valid = scaler == "linear" || scaler == "area" || scaler == "lanczos";
+            previewScaler = scaler == "area" ? PreviewScaler::Area :
+                scaler == "lanczos" ? PreviewScaler::Lanczos3 : PreviewScaler::Linear;
+        }
+        else if (key == "threads.workers") {
+            valid = parseNumber(value, workerThreads);
+        }
+        else if (key == "threads.affinity") {
+            valid = parseNumber(value, affinityMask);
+        }
+        else if (key == "metrics.port") {
+            uint32_t port = 0;
+            valid = parseNumber(value, port) && port <= UINT16_MAX;
+            metricsPort = uint16_t(port);
+        }
+        else if (key == "overlay.timecode") {
+            valid = parseBool(value, timecode);
+        }
+        else if (key == "recording.directory") {
+            recordingDirectory = widen(value);
+        }
+        else if (key == "recording.segment_seconds") {
+            valid = parseNumber(value, segmentSeconds);
+        }
+        else if (key == "recording.segment_mb") {
+            valid = parseNumber(value, segmentMB);
+        }
+        else if (key == "recording.format") {
+            const std::string format = lower(value);
+            valid = format == "raw" || format == "y4m";
+            recordingFormat = format == "y4m" ? RecordingContainer::Y4m : RecordingContainer::Raw;
+        }
+        else if (key == "pre_event.seconds") {
+            valid = parseNumber(value, preEventSeconds);
+        }
+        else if (key == "pre_event.memory_mb") {
+            valid = parseNumber(value, preEventMemoryMB) && preEventMemoryMB > 0;
+        }
+        else if (key == "pre_event.directory") {
+            preEventDirectory = widen(value);
+        }
+        else if (key == "pre_event.motion") {
+            valid = parseBool(value, preEventMotion);
+        }
+        else {
+            Warn("Config line %u: unknown key %s\n", lineNumber, key.c_str());
+        }
+
+        if (!valid) {
+            Error("Config line %u: invalid value for %s\n", lineNumber, key.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool SessionConfig::hasSink(const char* name) const
+{
+    return std::find(sinks.begin(), sinks.end(), name) != sinks.end();
+}
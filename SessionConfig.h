@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <mfapi.h>
+
+#include "FormatConvertor.h"
+
+enum class ResolutionPolicy
+{
+    Exact,      // Only the configured width, height and frame rate.
+    Closest     // Nearest native mode if the exact one is not offered.
+};
+
+// How the preview is shrunk to fit the window.
+enum class PreviewScaler
+{
+    Linear,     // Direct3D StretchRect; cheap, aliases on large reductions.
+    Area,
+    Lanczos3
+};
+
+// File format of recorded segments.
+enum class RecordingContainer
+{
+    Raw,        // RecordingFormat.h, with a sidecar index.
+    Y4m         // YUV4MPEG2, for NV12, I420 and YUY2 only.
+};
+
+//-------------------------------------------------------------------
+// SessionConfig
+//
+// Capture session settings, loaded from an INI-style file:
+//
+//     [capture]
+//     device = Integrated Camera      ; friendly name or symbolic link
+//     width = 1920
+//     height = 1080
+//     fps = 30
+//     resolution = closest            ; exact | closest
+//     formats = NV12, YUY2            ; preferred output formats
+//     rotation = 90                   ; 0 | 90 | 180 | 270, clockwise
+//     mirror = horizontal             ; none | horizontal | vertical | both
+//
+//     [pipeline]
+//     depth = 8                       ; frames in flight
+//     stream_capacity = 4             ; per-subscriber queue
+//     sinks = preview                 ; preview | headless | record
+//     square_pixels = on              ; rescale anamorphic headless frames,
+//                                     ; and record those
+//
+//     [denoise]
+//     strength = 60                   ; temporal noise reduction 0..100, 0 = off
+//     motion_threshold = 10           ; differences above this are motion
+//
+//     [preview]
+//     scaler = lanczos                ; linear | area | lanczos
+//
+//     [threads]
+//     workers = 0                     ; 0 = one per logical processor
+//     affinity = 0xF0                 ; worker affinity mask, 0 = any
+//
+//     [metrics]
+//     port = 9464                     ; Prometheus endpoint on localhost, 0 = off
+//
+//     [overlay]
+//     timecode = on                   ; burn the wall-clock time into frames
+//
+//     [recording]                     ; used by the record sink
+//     directory = D:\Recordings       ; where segments go
+//     segment_seconds = 60            ; start a new file after this long, 0 = no limit
+//     segment_mb = 1024               ; or at this size, 0 = no limit
+//     format = raw                    ; raw | y4m
+//
+//     [pre_event]
+//     seconds = 10                    ; raw frames kept for saving, 0 = off
+//     memory_mb = 256                 ; preallocated for them
+//     directory = D:\Incidents        ; where saved buffers go
+//     motion = on                     ; save when the picture changes
+//
+// Keys that are missing keep their defaults.
+//-------------------------------------------------------------------
+
+struct SessionConfig
+{
+    std::wstring device;
+    uint32_t width = 1280;
+    uint32_t height = 720;
+    uint32_t fps = 30;
+    ResolutionPolicy resolution = ResolutionPolicy::Exact;
+    std::vector<GUID> formats;
+    Orientation orientation;
+
+    uint32_t pipelineDepth = 8;
+    uint32_t streamCapacity = 4;
+    std::vector<std::string> sinks = { "preview" };
+    bool squarePixels = false;
+
+    uint32_t denoiseStrength = 0;
+    uint32_t denoiseThreshold = 10;
+
+    PreviewScaler previewScaler = PreviewScaler::Linear;
+
+    uint32_t workerThreads = 0;
+    uint64_t affinityMask = 0;
+
+    uint16_t metricsPort = 0;
+
+    bool timecode = false;
+
+    std::wstring recordingDirectory;
+    uint32_t segmentSeconds = 60;
+    uint32_t segmentMB = 0;
+    RecordingContainer recordingFormat = RecordingContainer::Raw;
+
+    uint32_t preEventSeconds = 0;
+    uint32_t preEventMemoryMB = 256;
+    std::wstring preEventDirectory;
+    bool preEventMotion = false;
+
+    bool load(const std::wstring& path);
+    bool hasSink(const char* name) const;
+};
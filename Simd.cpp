@@ -0,0 +1,46 @@
+#include "Simd.h"
+
+#include <atomic>
+
+#if defined(_MSC_VER) && MFCAMERA_SIMD_SSSE3
+#include <intrin.h>
+#endif
+
+namespace {
+    bool detect()
+    {
+#if MFCAMERA_SIMD_SSSE3
+#if defined(_MSC_VER)
+        int info[4] = {};
+        __cpuid(info, 1);
+        return (info[2] & (1 << 9)) != 0;   // ECX bit 9: SSSE3
+#else
+        return __builtin_cpu_supports("ssse3");
+#endif
+#elif MFCAMERA_SIMD_NEON
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    const bool simdSupported = detect();
+    std::atomic<bool> simdEnabled = simdSupported;
+}
+
+namespace Simd {
+    bool supported()
+    {
+        return simdSupported;
+    }
+
+    bool enabled()
+    {
+        return simdEnabled.load(std::memory_order_relaxed);
+    }
+
+    void setEnabled(bool enabled)
+    {
+        simdEnabled.store(enabled && simdSupported, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+//-------------------------------------------------------------------
+// Simd
+//
+// Selects the vector code paths of the pixel kernels. x86 builds use
+// SSSE3, ARM64 builds use NEON; everything else, and CPUs without
+// SSSE3, take the scalar loops.
+//
+// Kernels check Simd::enabled() once per call, so the scalar path can
+// be forced at run time to compare both.
+//-------------------------------------------------------------------
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MFCAMERA_SIMD_SSSE3 1
+#include <tmmintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define MFCAMERA_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace Simd {
+    // True if the CPU supports the vector paths of this build.
+    bool supported();
+
+    bool enabled();
+    void setEnabled(bool enabled);
+}
@@ -0,0 +1,184 @@
+#include "SyntheticSource.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "SafeRelease.h"
+#include "Debug.h"
+
+namespace {
+    const size_t FRAME_POOL_SIZE = 8;
+    const size_t FRAME_ARENA_SIZE = 512 * 1024;
+    const std::chrono::milliseconds CONSUMER_WAIT(100);
+
+    // Luma ramp with a vertical bar that moves one step per frame.
+    uint8_t PatternLuma(uint32_t x, uint32_t y, uint32_t width, uint64_t sequence)
+    {
+        const uint32_t bar = uint32_t((sequence * 8) % width);
+        if (x >= bar && x < bar + 16) {
+            return 235;
+        }
+
+        return uint8_t(16 + ((x + y) & 0xff) * 219 / 255);
+    }
+}
+
+SyntheticSource::SyntheticSource(REFGUID subtype, uint32_t width, uint32_t height, uint32_t fps, bool realTime) :
+    mSubtype(subtype), mWidth(width), mHeight(height), mFps(fps ? fps : 30), mRealTime(realTime),
+    mFramePool(std::make_shared<FramePool>(FRAME_POOL_SIZE, FRAME_ARENA_SIZE))
+{
+}
+
+SyntheticSource::~SyntheticSource()
+{
+    stop();
+    closeStreams();
+}
+
+DWORD SyntheticSource::frameSize() const
+{
+    if (mSubtype == MFVideoFormat_NV12) {
+        return mWidth * mHeight * 3 / 2;
+    }
+
+    if (mSubtype == MFVideoFormat_YUY2) {
+        return mWidth * mHeight * 2;
+    }
+
+    if (mSubtype == MFVideoFormat_RGB32) {
+        return mWidth * mHeight * 4;
+    }
+
+    return 0;
+}
+
+bool SyntheticSource::start()
+{
+    if (mRunning) {
+        return true;
+    }
+
+    const DWORD size = frameSize();
+    if (size == 0 || (mWidth & 1) || (mHeight & 1)) {
+        Error("Unsupported synthetic format %ux%u\n", mWidth, mHeight);
+        return false;
+    }
+
+    if (!mFramePool->allocate(size)) {
+        return false;
+    }
+
+    mRunning = true;
+    mThread = std::thread(&SyntheticSource::run, this);
+
+    return true;
+}
+
+void SyntheticSource::stop()
+{
+    mRunning = false;
+
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+void SyntheticSource::run()
+{
+    const auto period = std::chrono::nanoseconds(1'000'000'000 / mFps);
+    auto deadline = std::chrono::steady_clock::now();
+
+    uint64_t sequence = 0;
+
+    while (mRunning) {
+        if (mRealTime) {
+            deadline += period;
+            std::this_thread::sleep_until(deadline);
+        }
+        else if (!waitForConsumers(CONSUMER_WAIT)) {
+            continue;
+        }
+
+        // Dropped frames still take a sequence number, so consumers see the gap.
+        const uint64_t frameSequence = sequence++;
+
+        Frame frame = mFramePool->acquire();
+        if (!frame) {
+            countDroppedFrame();
+            continue;
+        }
+
+        if (!renderFrame(frame.sample(), frameSequence)) {
+            continue;
+        }
+
+        LARGE_INTEGER now = {};
+        QueryPerformanceCounter(&now);
+
+        FrameInfo info;
+        info.sequence = frameSequence;
+        info.timestamp = LONGLONG(frameSequence) * 10'000'000 / mFps;
+        info.captureTime = now.QuadPart;
+        info.sourceId = sourceId();
+        info.subtype = mSubtype;
+        info.width = mWidth;
+        info.height = mHeight;
+        frame.setInfo(info);
+
+        (void)frame.sample()->SetSampleTime(info.timestamp);
+        (void)frame.sample()->SetSampleDuration(10'000'000 / mFps);
+
+        publish(frame);
+    }
+}
+
+bool SyntheticSource::renderFrame(IMFSample* sample, uint64_t sequence) const
+{
+    IMFMediaBuffer* buffer = nullptr;
+    if (HRESULT hr = sample->GetBufferByIndex(0, &buffer); FAILED(hr)) {
+        SafeRelease(&buffer);
+        return false;
+    }
+
+    uint8_t* data = nullptr;
+    if (HRESULT hr = buffer->Lock(&data, nullptr, nullptr); FAILED(hr)) {
+        buffer->Release();
+        return false;
+    }
+
+    if (mSubtype == MFVideoFormat_NV12) {
+        for (uint32_t y = 0; y < mHeight; y++) {
+            uint8_t* line = data + y * mWidth;
+            for (uint32_t x = 0; x < mWidth; x++) {
+                line[x] = PatternLuma(x, y, mWidth, sequence);
+            }
+        }
+
+        // Neutral chroma.
+        std::memset(data + mWidth * mHeight, 128, mWidth * mHeight / 2);
+    }
+    else if (mSubtype == MFVideoFormat_YUY2) {
+        for (uint32_t y = 0; y < mHeight; y++) {
+            uint8_t* line = data + y * mWidth * 2;
+            for (uint32_t x = 0; x < mWidth; x++) {
+                line[x * 2] = PatternLuma(x, y, mWidth, sequence);
+                line[x * 2 + 1] = 128;
+            }
+        }
+    }
+    else {
+        for (uint32_t y = 0; y < mHeight; y++) {
+            uint32_t* line = (uint32_t*)(data + y * mWidth * 4);
+            for (uint32_t x = 0; x < mWidth; x++) {
+                const uint32_t l = PatternLuma(x, y, mWidth, sequence);
+                line[x] = 0xff000000 | (l << 16) | (l << 8) | l;
+            }
+        }
+    }
+
+    (void)buffer->Unlock();
+    (void)buffer->SetCurrentLength(frameSize());
+    buffer->Release();
+
+    return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <mfapi.h>
+
+#include "FramePool.h"
+#include "FrameSource.h"
+
+//-------------------------------------------------------------------
+// SyntheticSource
+//
+// Generates a moving test pattern without any capture hardware.
+// In real-time mode frames are paced at the configured frame rate;
+// otherwise a new frame is produced as soon as every subscriber has
+// room for it, so batch jobs run as fast as they can consume.
+//-------------------------------------------------------------------
+
+class SyntheticSource : public FrameSource
+{
+public:
+    SyntheticSource(REFGUID subtype, uint32_t width, uint32_t height, uint32_t fps, bool realTime = true);
+    ~SyntheticSource();
+
+    bool start();
+    void stop();
+
+    uint32_t width() const { return mWidth; }
+    uint32_t height() const { return mHeight; }
+    const GUID& subtype() const { return mSubtype; }
+
+    FrameArena::Stats arenaStats() const override { return mFramePool->arenaStats(); }
+
+private:
+    void run();
+    bool renderFrame(IMFSample* sample, uint64_t sequence) const;
+    DWORD frameSize() const;
+
+    GUID mSubtype = GUID_NULL;
+    uint32_t mWidth = 0;
+    uint32_t mHeight = 0;
+    uint32_t mFps = 30;
+    bool mRealTime = true;
+    std::shared_ptr<FramePool> mFramePool;
+    std::atomic<bool> mRunning = false;
+    std::thread mThread;
+};
@@ -0,0 +1,236 @@
+#include "TemporalDenoiser.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "Simd.h"
+#include "WorkerPool.h"
+
+namespace {
+    const int K_ONE = 128;      // k is in 1/128 units.
+    const int K_MIN = 16;       // Full strength still keeps 1/8 of each new frame.
+
+    //-------------------------------------------------------------------
+    // Row filters
+    //
+    // k = base + max(|d| - threshold, 0) * gain, capped at 128.
+    //
+    // All arithmetic is 16-bit: the excess times gain plus base stays
+    // below 32768 because gain is at most 127, and d * k is at most
+    // 255 * 128. The vector paths handle 16 samples per iteration,
+    // rounding exactly like the scalar loop, which takes the remainder.
+    //-------------------------------------------------------------------
+
+    struct Curve
+    {
+        int base;
+        int threshold;
+        int gain;
+    };
+
+    void filterRowScalar(uint8_t* history, const uint8_t* source, uint32_t begin, uint32_t count,
+        const Curve& curve)
+    {
+        for (uint32_t i = begin; i < count; i++) {
+            const int prev = history[i];
+            const int d = int(source[i]) - prev;
+            const int excess = std::max(std::abs(d) - curve.threshold, 0);
+            const int k = std::min(curve.base + excess * curve.gain, K_ONE);
+
+            history[i] = uint8_t(prev + ((d * k + K_ONE / 2) >> 7));
+        }
+    }
+
+#if MFCAMERA_SIMD_SSSE3
+    inline __m128i filterHalf(__m128i prev, __m128i cur, __m128i base, __m128i threshold, __m128i gain)
+    {
+        const __m128i d = _mm_sub_epi16(cur, prev);
+        const __m128i excess = _mm_subs_epu16(_mm_abs_epi16(d), threshold);
+        const __m128i k = _mm_min_epi16(_mm_add_epi16(base, _mm_mullo_epi16(excess, gain)),
+            _mm_set1_epi16(K_ONE));
+        const __m128i step = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(d, k), _mm_set1_epi16(K_ONE / 2)), 7);
+
+        return _mm_add_epi16(prev, step);
+    }
+
+    uint32_t filterRowSimd(uint8_t* history, const uint8_t* source, uint32_t count, const Curve& curve)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i base = _mm_set1_epi16(short(curve.base));
+        const __m128i threshold = _mm_set1_epi16(short(curve.threshold));
+        const __m128i gain = _mm_set1_epi16(short(curve.gain));
+
+        uint32_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            const __m128i prev = _mm_loadu_si128((const __m128i*)(history + i));
+            const __m128i cur = _mm_loadu_si128((const __m128i*)(source + i));
+
+            const __m128i low = filterHalf(_mm_unpacklo_epi8(prev, zero), _mm_unpacklo_epi8(cur, zero),
+                base, threshold, gain);
+            const __m128i high = filterHalf(_mm_unpackhi_epi8(prev, zero), _mm_unpackhi_epi8(cur, zero),
+                base, threshold, gain);
+
+            _mm_storeu_si128((__m128i*)(history + i), _mm_packus_epi16(low, high));
+        }
+
+        return i;
+    }
+#elif MFCAMERA_SIMD_NEON
+    inline int16x8_t filterHalf(uint8x8_t prev, uint8x8_t cur, int16x8_t base, int16x8_t threshold, int16_t gain)
+    {
+        const int16x8_t d = vreinterpretq_s16_u16(vsubl_u8(cur, prev));
+        const int16x8_t excess = vmaxq_s16(vsubq_s16(vabsq_s16(d), threshold), vdupq_n_s16(0));
+        const int16x8_t k = vminq_s16(vmlaq_n_s16(base, excess, gain), vdupq_n_s16(K_ONE));
+        const int16x8_t step = vrshrq_n_s16(vmulq_s16(d, k), 7);
+
+        return vaddq_s16(vreinterpretq_s16_u16(vmovl_u8(prev)), step);
+    }
+
+    uint32_t filterRowSimd(uint8_t* history, const uint8_t* source, uint32_t count, const Curve& curve)
+    {
+        const int16x8_t base = vdupq_n_s16(int16_t(curve.base));
+        const int16x8_t threshold = vdupq_n_s16(int16_t(curve.threshold));
+        const int16_t gain = int16_t(curve.gain);
+
+        uint32_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            const uint8x16_t prev = vld1q_u8(history + i);
+            const uint8x16_t cur = vld1q_u8(source + i);
+
+            const int16x8_t low = filterHalf(vget_low_u8(prev), vget_low_u8(cur), base, threshold, gain);
+            const int16x8_t high = filterHalf(vget_high_u8(prev), vget_high_u8(cur), base, threshold, gain);
+
+            vst1q_u8(history + i, vcombine_u8(vqmovun_s16(low), vqmovun_s16(high)));
+        }
+
+        return i;
+    }
+#else
+    uint32_t filterRowSimd(uint8_t*, const uint8_t*, uint32_t, const Curve&)
+    {
+        return 0;
+    }
+#endif
+
+    uint32_t rowBytes(const FramePlane& plane)
+    {
+        return plane.width * plane.sampleBytes;
+    }
+}
+
+TemporalDenoiser::TemporalDenoiser(uint32_t strength, uint32_t motionThreshold, uint32_t bands)
+    : mBands(std::max(bands, 1u))
+{
+    strength = std::min(strength, 100u);
+    mBase = K_ONE - int(strength) * (K_ONE - K_MIN) / 100;
+
+    // k reaches K_ONE at twice the threshold.
+    mThreshold = int(std::clamp(motionThreshold, 1u, 255u));
+    mGain = std::clamp((K_ONE - mBase + mThreshold - 1) / mThreshold, 1, 127);
+}
+
+FramePlanes TemporalDenoiser::process(const FramePlanes& source, WorkerPool* pool)
+{
+    filter(source, pool, false);
+    return mOutput;
+}
+
+void TemporalDenoiser::processInPlace(const FramePlanes& frame, WorkerPool* pool)
+{
+    filter(frame, pool, true);
+}
+
+// A primed frame is its own history, so there is nothing to write back.
+void TemporalDenoiser::filter(const FramePlanes& source, WorkerPool* pool, bool writeBack)
+{
+    if (!mPrimed || !matches(source)) {
+        prime(source);
+        return;
+    }
+
+    const bool simd = Simd::enabled();
+
+    if (pool && mBands > 1) {
+        pool->run(mBands, [&](size_t band) {
+            filterBand(source, uint32_t(band), simd, writeBack);
+        });
+    }
+    else {
+        for (uint32_t band = 0; band < mBands; band++) {
+            filterBand(source, band, simd, writeBack);
+        }
+    }
+}
+
+bool TemporalDenoiser::matches(const FramePlanes& source) const
+{
+    if (source.count != mOutput.count || source.width != mOutput.width || source.height != mOutput.height) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < source.count; i++) {
+        const FramePlane& a = source.planes[i];
+        const FramePlane& b = mOutput.planes[i];
+
+        if (a.width != b.width || a.height != b.height || a.sampleBytes != b.sampleBytes) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------
+// Prime
+//
+// Starts the history from a copy of the frame. History rows are packed
+// without padding.
+//-------------------------------------------------------------------
+
+void TemporalDenoiser::prime(const FramePlanes& source)
+{
+    mOutput = source;
+
+    for (uint32_t i = 0; i < source.count; i++) {
+        const FramePlane& plane = source.planes[i];
+        const uint32_t bytes = rowBytes(plane);
+
+        mHistory[i].resize(size_t(bytes) * plane.height);
+
+        for (uint32_t y = 0; y < plane.height; y++) {
+            memcpy(mHistory[i].data() + size_t(y) * bytes, plane.data + ptrdiff_t(y) * plane.stride, bytes);
+        }
+
+        mOutput.planes[i].data = mHistory[i].data();
+        mOutput.planes[i].stride = int32_t(bytes);
+    }
+
+    mPrimed = true;
+}
+
+void TemporalDenoiser::filterBand(const FramePlanes& source, uint32_t band, bool simd, bool writeBack)
+{
+    const Curve curve = { mBase, mThreshold, mGain };
+
+    for (uint32_t i = 0; i < source.count; i++) {
+        const FramePlane& plane = source.planes[i];
+        const uint32_t bytes = rowBytes(plane);
+
+        // Chroma planes are split in the same proportion as luma.
+        const uint32_t first = uint32_t(uint64_t(plane.height) * band / mBands);
+        const uint32_t end = uint32_t(uint64_t(plane.height) * (band + 1) / mBands);
+
+        for (uint32_t y = first; y < end; y++) {
+            uint8_t* history = mHistory[i].data() + size_t(y) * bytes;
+            const uint8_t* row = plane.data + ptrdiff_t(y) * plane.stride;
+
+            const uint32_t done = simd ? filterRowSimd(history, row, bytes, curve) : 0;
+            filterRowScalar(history, row, done, bytes, curve);
+
+            if (writeBack) {
+                memcpy(const_cast<uint8_t*>(row), history, bytes);
+            }
+        }
+    }
+}
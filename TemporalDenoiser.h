@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "FormatConvertor.h"
+
+class WorkerPool;
+
+//-------------------------------------------------------------------
+// TemporalDenoiser
+//
+// Recursive temporal filter on the source planes, run before the frame
+// is converted. Every sample is blended with the filtered sample of
+// the previous frame:
+//
+//     out = prev + (cur - prev) * k / 128
+//
+// Differences up to the motion threshold are taken for noise and
+// blended with the strength's weight, so still areas lose their sensor
+// noise. Beyond it k ramps up, and samples that changed by twice the
+// threshold are taken from the new frame as is, so moving objects do
+// not smear. Each byte of each plane is filtered on its own, which
+// covers Y, interleaved UV and packed formats alike.
+//
+// The history is the output: process() filters into it and returns
+// planes that point at it, so no frame is copied. processInPlace()
+// also writes each filtered row back into the frame while it is still
+// in cache, for buffers shared with other consumers. Rows are split
+// into bands that run on a WorkerPool if one is given.
+//-------------------------------------------------------------------
+
+class TemporalDenoiser
+{
+public:
+    // strength 0..100: how much history still areas keep. The motion
+    // threshold is a difference in code values, about the noise level.
+    TemporalDenoiser(uint32_t strength, uint32_t motionThreshold, uint32_t bands = 1);
+
+    TemporalDenoiser(const TemporalDenoiser&) = delete;
+    TemporalDenoiser& operator=(const TemporalDenoiser&) = delete;
+
+    // The returned planes stay valid until the next process() or
+    // reset(). The first frame, and the first after a change of
+    // geometry, passes through unfiltered.
+    FramePlanes process(const FramePlanes& source, WorkerPool* pool = nullptr);
+
+    // Like process(), but leaves the filtered frame in the planes'
+    // own buffer, which must be writable.
+    void processInPlace(const FramePlanes& frame, WorkerPool* pool = nullptr);
+
+    // Forgets the history, e.g. after a scene cut or a reconnect.
+    void reset() { mPrimed = false; }
+
+private:
+    bool matches(const FramePlanes& source) const;
+    void prime(const FramePlanes& source);
+    void filter(const FramePlanes& source, WorkerPool* pool, bool writeBack);
+    void filterBand(const FramePlanes& source, uint32_t band, bool simd, bool writeBack);
+
+    int mBase = 128;        // k for noise, 1/128 units.
+    int mThreshold = 1;
+    int mGain = 127;        // k added per code value above the threshold.
+    uint32_t mBands = 1;
+
+    std::vector<uint8_t> mHistory[FramePlanes::MaxPlanes];
+    FramePlanes mOutput;
+    bool mPrimed = false;
+};
@@ -0,0 +1,141 @@
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+#include <windows.h>
+
+#include "Debug.h"
+
+WorkerPool::WorkerPool(uint32_t threads, uint64_t affinityMask)
+{
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    mThreads.reserve(threads - 1);
+    for (uint32_t i = 1; i < threads; i++) {
+        mThreads.emplace_back(&WorkerPool::workerLoop, this);
+
+        if (affinityMask && !SetThreadAffinityMask(mThreads.back().native_handle(), DWORD_PTR(affinityMask))) {
+            Warn("Cannot set worker affinity 0x%llx\n", (unsigned long long)affinityMask);
+        }
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard lock(mMutex);
+        mStopping = true;
+    }
+
+    mWake.notify_all();
+
+    for (std::thread& thread : mThreads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::execute(size_t count, void* context, TaskFunction function)
+{
+    if (count == 0) {
+        return;
+    }
+
+    // Not worth waking anybody up. Jobs too large for the claim counter
+    // are not worth splitting that finely either.
+    if (count == 1 || mThreads.empty() || count > UINT32_MAX) {
+        for (size_t i = 0; i < count; i++) {
+            function(context, i);
+        }
+        return;
+    }
+
+    std::lock_guard runLock(mRunMutex);
+
+    Job job;
+
+    {
+        std::lock_guard lock(mMutex);
+        job.function = function;
+        job.context = context;
+        job.count = count;
+        job.generation = mJob.generation + 1;
+
+        // mDone is reset before the new generation becomes claimable.
+        mDone.store(0, std::memory_order_relaxed);
+        mClaim.store(uint64_t(job.generation) << 32, std::memory_order_release);
+        mJob = job;
+    }
+
+    mWake.notify_all();
+
+    drain(job);
+
+    std::unique_lock lock(mMutex);
+    mFinished.wait(lock, [&] {
+        return mDone.load(std::memory_order_acquire) == job.count;
+    });
+
+    mJob.function = nullptr;
+}
+
+//-------------------------------------------------------------------
+// Drain
+//
+// Claims and runs tasks of job until none are left. A claim only
+// succeeds while the claim counter still carries the job's generation.
+//-------------------------------------------------------------------
+
+void WorkerPool::drain(const Job& job)
+{
+    size_t completed = 0;
+    uint64_t claim = mClaim.load(std::memory_order_acquire);
+
+    for (;;) {
+        const size_t index = size_t(claim & UINT32_MAX);
+        if (uint32_t(claim >> 32) != job.generation || index >= job.count) {
+            break;
+        }
+
+        if (!mClaim.compare_exchange_weak(claim, claim + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            continue;
+        }
+
+        job.function(job.context, index);
+        ++completed;
+
+        claim = mClaim.load(std::memory_order_acquire);
+    }
+
+    if (completed == 0) {
+        return;
+    }
+
+    if (mDone.fetch_add(completed, std::memory_order_acq_rel) + completed == job.count) {
+        std::lock_guard lock(mMutex);
+        mFinished.notify_all();
+    }
+}
+
+void WorkerPool::workerLoop()
+{
+    Job job;
+
+    for (;;) {
+        {
+            std::unique_lock lock(mMutex);
+            mWake.wait(lock, [&] {
+                return mStopping || (mJob.generation != job.generation && mJob.function);
+            });
+
+            if (mStopping) {
+                return;
+            }
+
+            job = mJob;
+        }
+
+        drain(job);
+    }
+}
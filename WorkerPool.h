@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+//-------------------------------------------------------------------
+// WorkerPool
+//
+// Persistent worker threads for data-parallel loops. run() splits
+// [0, count) into tasks that workers claim one at a time; the calling
+// thread takes part as well and returns when every task is done.
+// Dispatching a job does not allocate.
+//-------------------------------------------------------------------
+
+class WorkerPool
+{
+public:
+    // threads = 0 uses one thread per logical processor. A non-zero
+    // affinity mask pins the worker threads to those processors.
+    explicit WorkerPool(uint32_t threads = 0, uint64_t affinityMask = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    template <class Fn>
+    void run(size_t count, Fn&& fn)
+    {
+        using Task = std::remove_reference_t<Fn>;
+
+        execute(count, &fn, [](void* context, size_t index) {
+            (*static_cast<Task*>(context))(index);
+        });
+    }
+
+    // Number of threads taking part in run(), including the caller.
+    uint32_t concurrency() const { return uint32_t(mThreads.size()) + 1; }
+
+private:
+    using TaskFunction = void (*)(void* context, size_t index);
+
+    // What a thread works on, copied under mMutex when it picks up a
+    // generation.
+    struct Job
+    {
+        TaskFunction function = nullptr;
+        void* context = nullptr;
+        size_t count = 0;
+        uint32_t generation = 0;
+    };
+
+    void execute(size_t count, void* context, TaskFunction function);
+    void workerLoop();
+    void drain(const Job& job);
+
+    std::vector<std::thread> mThreads;
+
+    // Current job. mClaim holds the job's generation in its upper half
+    // and the next task index in its lower half, so a thread still
+    // holding an older job can never claim a task of the current one.
+    Job mJob;
+    std::atomic<uint64_t> mClaim = 0;
+    std::atomic<size_t> mDone = 0;
+    bool mStopping = false;
+
+    std::mutex mRunMutex;   // Serializes callers of run().
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mFinished;
+};
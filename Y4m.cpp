@@ -0,0 +1,371 @@
+#include "Y4m.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "Debug.h"
+
+namespace {
+    const char STREAM_MAGIC[] = "YUV4MPEG2";
+    const size_t READ_BUFFER_SIZE = 4 << 20;
+    const size_t MAX_LINE = 1024;
+
+    bool parseUnsigned(const std::string& text, uint32_t& value)
+    {
+        char* end = nullptr;
+        const unsigned long parsed = strtoul(text.c_str(), &end, 10);
+        if (text.empty() || *end != '\0' || parsed > UINT32_MAX) {
+            return false;
+        }
+
+        value = uint32_t(parsed);
+        return true;
+    }
+
+    bool parseRatio(const std::string& text, uint32_t& numerator, uint32_t& denominator)
+    {
+        const size_t colon = text.find(':');
+        return colon != std::string::npos &&
+            parseUnsigned(text.substr(0, colon), numerator) &&
+            parseUnsigned(text.substr(colon + 1), denominator);
+    }
+}
+
+namespace Y4m {
+    bool chromaOf(REFGUID subtype, Chroma& chroma)
+    {
+        if (subtype == MFVideoFormat_NV12 || subtype == MFVideoFormat_I420) {
+            chroma = Chroma::C420;
+            return true;
+        }
+
+        if (subtype == MFVideoFormat_YUY2) {
+            chroma = Chroma::C422;
+            return true;
+        }
+
+        return false;
+    }
+
+    size_t frameBytes(Chroma chroma, uint32_t width, uint32_t height)
+    {
+        const size_t luma = size_t(width) * height;
+        return chroma == Chroma::C420 ? luma * 3 / 2 : luma * 2;
+    }
+
+    // NV12 and I420 from Media Foundation have MPEG-2 chroma siting.
+    std::string formatHeader(const StreamHeader& header)
+    {
+        char text[128];
+        sprintf_s(text, "%s W%u H%u F%u:%u Ip A1:1 %s\n", STREAM_MAGIC, header.width, header.height,
+            header.rateNumerator, header.rateDenominator,
+            header.chroma == Chroma::C420 ? "C420mpeg2" : "C422");
+
+        return text;
+    }
+
+    //-------------------------------------------------------------------
+    // ParseHeader
+    //
+    // Interlacing, aspect ratio and X tags are accepted and ignored.
+    // Only 8-bit 4:2:0 and 4:2:2 streams with even dimensions map onto
+    // the capture formats.
+    //-------------------------------------------------------------------
+
+    bool parseHeader(const char* line, size_t length, StreamHeader& header)
+    {
+        const std::string text(line, length);
+        if (text.compare(0, sizeof(STREAM_MAGIC) - 1, STREAM_MAGIC) != 0) {
+            return false;
+        }
+
+        header = StreamHeader();
+
+        size_t position = sizeof(STREAM_MAGIC) - 1;
+        while (position < text.size()) {
+            const size_t end = std::min(text.find(' ', position), text.size());
+            const std::string tag = text.substr(position, end - position);
+            position = end + 1;
+
+            if (tag.empty()) {
+                continue;
+            }
+
+            const std::string value = tag.substr(1);
+            bool valid = true;
+
+            switch (tag[0]) {
+            case 'W':
+                valid = parseUnsigned(value, header.width);
+                break;
+            case 'H':
+                valid = parseUnsigned(value, header.height);
+                break;
+            case 'F':
+                valid = parseRatio(value, header.rateNumerator, header.rateDenominator) &&
+                    header.rateNumerator > 0 && header.rateDenominator > 0;
+                break;
+            case 'C':
+                if (value == "420" || value == "420jpeg" || value == "420mpeg2" || value == "420paldv") {
+                    header.chroma = Chroma::C420;
+                }
+                else if (value == "422") {
+                    header.chroma = Chroma::C422;
+                }
+                else {
+                    valid = false;
+                }
+                break;
+            default:
+                break;
+            }
+
+            if (!valid) {
+                Error("Y4m: unsupported header tag %s\n", tag.c_str());
+                return false;
+            }
+        }
+
+        return header.width > 0 && header.height > 0 && !(header.width & 1) && !(header.height & 1);
+    }
+
+    void toPlanar(REFGUID subtype, const FramePlanes& source, uint8_t* dst)
+    {
+        const uint32_t width = source.width;
+        const uint32_t height = source.height;
+        const size_t luma = size_t(width) * height;
+        const FramePlane& first = source.planes[0];
+
+        if (subtype == MFVideoFormat_NV12) {
+            const FramePlane& chroma = source.planes[1];
+            uint8_t* u = dst + luma;
+            uint8_t* v = u + luma / 4;
+
+            for (uint32_t y = 0; y < height; y++) {
+                memcpy(dst + size_t(y) * width, first.data + ptrdiff_t(y) * first.stride, width);
+            }
+
+            for (uint32_t y = 0; y < chroma.height; y++) {
+                const uint8_t* uv = chroma.data + ptrdiff_t(y) * chroma.stride;
+
+                for (uint32_t x = 0; x < chroma.width; x++) {
+                    u[x] = uv[x * 2];
+                    v[x] = uv[x * 2 + 1];
+                }
+
+                u += chroma.width;
+                v += chroma.width;
+            }
+        }
+        else {
+            uint8_t* luminance = dst;
+            uint8_t* u = dst + luma;
+            uint8_t* v = u + luma / 2;
+
+            for (uint32_t y = 0; y < height; y++) {
+                const uint8_t* row = first.data + ptrdiff_t(y) * first.stride;
+
+                for (uint32_t x = 0; x < width / 2; x++) {
+                    luminance[x * 2] = row[x * 4];
+                    u[x] = row[x * 4 + 1];
+                    luminance[x * 2 + 1] = row[x * 4 + 2];
+                    v[x] = row[x * 4 + 3];
+                }
+
+                luminance += width;
+                u += width / 2;
+                v += width / 2;
+            }
+        }
+    }
+
+    void fromPlanar(Chroma chroma, uint32_t width, uint32_t height, const uint8_t* src, uint8_t* dst)
+    {
+        const size_t luma = size_t(width) * height;
+
+        if (chroma == Chroma::C420) {
+            memcpy(dst, src, luma);
+
+            const uint8_t* u = src + luma;
+            const uint8_t* v = u + luma / 4;
+            uint8_t* uv = dst + luma;
+
+            for (size_t i = 0; i < luma / 4; i++) {
+                uv[i * 2] = u[i];
+                uv[i * 2 + 1] = v[i];
+            }
+        }
+        else {
+            const uint8_t* y = src;
+            const uint8_t* u = src + luma;
+            const uint8_t* v = u + luma / 2;
+
+            for (size_t i = 0; i < luma / 2; i++) {
+                dst[i * 4] = y[i * 2];
+                dst[i * 4 + 1] = u[i];
+                dst[i * 4 + 2] = y[i * 2 + 1];
+                dst[i * 4 + 3] = v[i];
+            }
+        }
+    }
+}
+
+Y4mReader::~Y4mReader()
+{
+    close();
+}
+
+bool Y4mReader::open(const std::wstring& path)
+{
+    close();
+
+    mFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (mFile == INVALID_HANDLE_VALUE) {
+        Error("Y4mReader: cannot open %S\n", path.c_str());
+        return false;
+    }
+
+    mBuffer.resize(READ_BUFFER_SIZE);
+
+    if (!readLine(mLine) || !Y4m::parseHeader(mLine.data(), mLine.size(), mHeader)) {
+        Error("Y4mReader: %S is not a supported YUV4MPEG2 stream\n", path.c_str());
+        close();
+        return false;
+    }
+
+    mFirstFrame = mLine.size() + 1;
+    mPlanar.resize(Y4m::frameBytes(mHeader.chroma, mHeader.width, mHeader.height));
+
+    return true;
+}
+
+void Y4mReader::close()
+{
+    if (mFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(mFile);
+        mFile = INVALID_HANDLE_VALUE;
+    }
+
+    mHeader = Y4m::StreamHeader();
+    mFirstFrame = 0;
+    mRead = 0;
+    mEnd = 0;
+}
+
+const GUID& Y4mReader::subtype() const
+{
+    return mHeader.chroma == Y4m::Chroma::C420 ? MFVideoFormat_NV12 : MFVideoFormat_YUY2;
+}
+
+//-------------------------------------------------------------------
+// ReadFrame
+//
+// Frame tags may carry parameters after FRAME; they are skipped.
+//-------------------------------------------------------------------
+
+bool Y4mReader::readFrame(uint8_t* frame)
+{
+    if (mFile == INVALID_HANDLE_VALUE || !readLine(mLine)) {
+        return false;
+    }
+
+    if (mLine.compare(0, Y4m::FRAME_TAG_SIZE - 1, Y4m::FRAME_TAG, Y4m::FRAME_TAG_SIZE - 1) != 0) {
+        Error("Y4mReader: missing frame tag\n");
+        return false;
+    }
+
+    if (!read(mPlanar.data(), mPlanar.size())) {
+        return false;
+    }
+
+    Y4m::fromPlanar(mHeader.chroma, mHeader.width, mHeader.height, mPlanar.data(), frame);
+    return true;
+}
+
+bool Y4mReader::rewind()
+{
+    LARGE_INTEGER position = {};
+    position.QuadPart = LONGLONG(mFirstFrame);
+
+    mRead = 0;
+    mEnd = 0;
+
+    return mFile != INVALID_HANDLE_VALUE && SetFilePointerEx(mFile, position, nullptr, FILE_BEGIN);
+}
+
+bool Y4mReader::readLine(std::string& line)
+{
+    line.clear();
+
+    for (;;) {
+        const uint8_t* begin = mBuffer.data() + mRead;
+        const uint8_t* newline = static_cast<const uint8_t*>(memchr(begin, '\n', mEnd - mRead));
+        const size_t length = newline ? size_t(newline - begin) : mEnd - mRead;
+
+        line.append(reinterpret_cast<const char*>(begin), length);
+        mRead += newline ? length + 1 : length;
+
+        if (newline) {
+            return true;
+        }
+
+        if (line.size() > MAX_LINE) {
+            return false;
+        }
+
+        DWORD bytes = 0;
+        if (!ReadFile(mFile, mBuffer.data(), DWORD(mBuffer.size()), &bytes, nullptr) || bytes == 0) {
+            return false;
+        }
+
+        mRead = 0;
+        mEnd = bytes;
+    }
+}
+
+//-------------------------------------------------------------------
+// Read
+//
+// Drains the buffer first; a remainder at least as large as the buffer
+// is read directly, anything smaller refills it.
+//-------------------------------------------------------------------
+
+bool Y4mReader::read(uint8_t* data, size_t size)
+{
+    const size_t buffered = std::min(size, mEnd - mRead);
+    memcpy(data, mBuffer.data() + mRead, buffered);
+    mRead += buffered;
+    data += buffered;
+    size -= buffered;
+
+    while (size >= mBuffer.size()) {
+        DWORD bytes = 0;
+        if (!ReadFile(mFile, data, DWORD(std::min<size_t>(size, MAXDWORD)), &bytes, nullptr) || bytes == 0) {
+            return false;
+        }
+
+        data += bytes;
+        size -= bytes;
+    }
+
+    while (size > 0) {
+        DWORD bytes = 0;
+        if (!ReadFile(mFile, mBuffer.data(), DWORD(mBuffer.size()), &bytes, nullptr) || bytes == 0) {
+            return false;
+        }
+
+        mRead = 0;
+        mEnd = bytes;
+
+        const size_t chunk = std::min(size, mEnd);
+        memcpy(data, mBuffer.data(), chunk);
+        mRead = chunk;
+        data += chunk;
+        size -= chunk;
+    }
+
+    return true;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+#include <mfapi.h>
+
+#include "FormatConvertor.h"
+
+//-------------------------------------------------------------------
+// Y4m
+//
+// YUV4MPEG2, the uncompressed stream format that ffmpeg, x264 and
+// most other video tools read and write:
+//
+//     YUV4MPEG2 W1920 H1080 F30:1 Ip A1:1 C420mpeg2\n
+//     FRAME\n, Y plane, U plane, V plane      (repeated)
+//
+// Planes are tightly packed. NV12 and I420 frames are stored as 4:2:0,
+// YUY2 frames as 4:2:2; the interleaved formats are split into planes
+// on the way out and put back together on the way in.
+//-------------------------------------------------------------------
+
+namespace Y4m {
+    enum class Chroma
+    {
+        C420,
+        C422
+    };
+
+    struct StreamHeader
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t rateNumerator = 30;
+        uint32_t rateDenominator = 1;
+        Chroma chroma = Chroma::C420;
+    };
+
+    const char FRAME_TAG[] = "FRAME\n";
+    const size_t FRAME_TAG_SIZE = sizeof(FRAME_TAG) - 1;
+
+    // The chroma layout a capture format is stored in; false for formats
+    // that have no Y4M form.
+    bool chromaOf(REFGUID subtype, Chroma& chroma);
+
+    // Bytes of one frame, without the FRAME tag.
+    size_t frameBytes(Chroma chroma, uint32_t width, uint32_t height);
+
+    std::string formatHeader(const StreamHeader& header);
+
+    // Parses the stream header line, without its newline.
+    bool parseHeader(const char* line, size_t length, StreamHeader& header);
+
+    // Writes the planes of an NV12 or YUY2 frame as Y4M planes. The
+    // source rows can be padded; I420 is already planar.
+    void toPlanar(REFGUID subtype, const FramePlanes& source, uint8_t* dst);
+
+    // Reads Y4M planes back as NV12 (4:2:0) or YUY2 (4:2:2).
+    void fromPlanar(Chroma chroma, uint32_t width, uint32_t height, const uint8_t* src, uint8_t* dst);
+}
+
+//-------------------------------------------------------------------
+// Y4mReader
+//
+// Reads a Y4M file front to back through one large buffer. Frames
+// bigger than the buffer are read straight into their destination.
+//-------------------------------------------------------------------
+
+class Y4mReader
+{
+public:
+    Y4mReader() = default;
+    ~Y4mReader();
+
+    Y4mReader(const Y4mReader&) = delete;
+    Y4mReader& operator=(const Y4mReader&) = delete;
+
+    bool open(const std::wstring& path);
+    void close();
+
+    const Y4m::StreamHeader& header() const { return mHeader; }
+
+    // NV12 or YUY2, depending on the chroma of the stream.
+    const GUID& subtype() const;
+
+    size_t frameBytes() const { return mPlanar.size(); }
+
+    // Reads the next frame, frameBytes() bytes. False at the end of the
+    // stream or on a malformed frame.
+    bool readFrame(uint8_t* frame);
+
+    // Goes back to the first frame.
+    bool rewind();
+
+private:
+    bool readLine(std::string& line);
+    bool read(uint8_t* data, size_t size);
+
+    HANDLE mFile = INVALID_HANDLE_VALUE;
+    Y4m::StreamHeader mHeader;
+    uint64_t mFirstFrame = 0;       // File offset of the first FRAME tag.
+    std::vector<uint8_t> mBuffer;
+    size_t mRead = 0;
+    size_t mEnd = 0;
+    std::vector<uint8_t> mPlanar;
+    std::string mLine;
+};
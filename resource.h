@@ -7,6 +7,7 @@
 #define IDC_LIST1                       1001
 #define IDC_DEVICE_LIST                 1001
 #define ID_FILE_CHOOSEDEVICE            40001
+#define ID_FILE_SAVEPREEVENT            40002
 #define IDC_STATIC                      -1
 
 // Next default values for new objects
@@ -14,7 +15,7 @@
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        103
-#define _APS_NEXT_COMMAND_VALUE         40002
+#define _APS_NEXT_COMMAND_VALUE         40003
 #define _APS_NEXT_CONTROL_VALUE         1002
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
@@ -19,8 +19,21 @@
 #include <strsafe.h>
 #include <assert.h>
 
+#include <algorithm>
+#include <chrono>
+#include <string>
+
 #include "SafeRelease.h"
 #include "Camera.h"
+#include "AllocationCheck.h"
+#include "GlyphAtlas.h"
+#include "MetricsServer.h"
+#include "MotionTrigger.h"
+#include "PreEventBuffer.h"
+#include "ReconnectCheck.h"
+#include "ReconnectSupervisor.h"
+#include "SegmentRecorder.h"
+#include "SessionConfig.h"
 #include "resource.h"
 
 // Include the v6 common controls in the manifest
@@ -49,6 +62,7 @@ struct ChooseDeviceParam
 
 
 
+BOOL    LoadSessionConfig(PCWSTR cmdLine);
 BOOL    InitializeApplication();
 BOOL    InitializeWindow(HWND *pHwnd);
 void    CleanUp();
@@ -63,10 +77,11 @@ BOOL    OnCreate(HWND hwnd, LPCREATESTRUCT lpCreateStruct);
 void    OnClose(HWND hwnd);
 void    OnCommand(HWND hwnd, int id, HWND hwndCtl, UINT codeNotify);
 void    OnSize(HWND hwnd, UINT state, int cx, int cy);
-void    OnDeviceChange(HWND hwnd, DEV_BROADCAST_HDR *pHdr);
+void    OnDeviceChange(HWND hwnd, UINT event, DEV_BROADCAST_HDR *pHdr);
 
 // Command handlers
 void    OnChooseDevice(HWND hwnd, BOOL bPrompt);
+BOOL    SavePreEventBuffer();
 
 
 // Constants 
@@ -74,9 +89,21 @@ const WCHAR CLASS_NAME[]  = L"MFCapture Window Class";
 const WCHAR WINDOW_NAME[] = L"MFCapture Sample Application";
 
 
+// Frames for the /alloccheck run.
+const UINT32 ALLOCATION_CHECK_FRAMES = 10000;
+const UINT32 ALLOCATION_CHECK_WARMUP = 100;
+const UINT32 TIMECODE_HEIGHT = 24;
+const POINT TIMECODE_POSITION = { 16, 16 };
+
+
 // Global variables
 
 std::unique_ptr<Camera> preview;
+std::unique_ptr<ReconnectSupervisor> supervisor;
+std::unique_ptr<PreEventBuffer> g_preEvent;
+std::unique_ptr<SegmentRecorder> g_recorder;
+MetricsServer g_metricsServer;
+SessionConfig g_config;
 HDEVNOTIFY  g_hdevnotify = NULL;
 
 
@@ -84,14 +111,41 @@ HDEVNOTIFY  g_hdevnotify = NULL;
 // WinMain
 //
 // Application entry-point. 
+//
+// /config <path> selects the session configuration; by default
+// MFCameraExample.ini next to the executable is used if present.
+// /alloccheck runs the allocation-free steady state check without
+// creating a window; the exit code is 0 on success. /reconnectcheck
+// runs the reconnect supervisor against a simulated device the same
+// way.
 //-------------------------------------------------------------------
 
-INT WINAPI wWinMain(HINSTANCE,HINSTANCE,LPWSTR,INT)
+INT WINAPI wWinMain(HINSTANCE,HINSTANCE,LPWSTR lpCmdLine,INT)
 {
     HWND hwnd = 0;
 
     (void)HeapSetInformation(NULL, HeapEnableTerminationOnCorruption, NULL, 0);
 
+    if (!LoadSessionConfig(lpCmdLine))
+    {
+        return 1;
+    }
+
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/alloccheck"))
+    {
+        BOOL ok = InitializeApplication() &&
+            AllocationCheck::run(ALLOCATION_CHECK_FRAMES, ALLOCATION_CHECK_WARMUP);
+
+        CleanUp();
+
+        return ok ? 0 : 1;
+    }
+
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/reconnectcheck"))
+    {
+        return ReconnectCheck::run() ? 0 : 1;
+    }
+
     if (InitializeApplication() && InitializeWindow(&hwnd))
     {
         MessageLoop(hwnd);
@@ -119,7 +173,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
         HANDLE_MSG(hwnd, WM_SIZE,    OnSize);
 
     case WM_DEVICECHANGE:
-        OnDeviceChange(hwnd, (PDEV_BROADCAST_HDR)lParam);
+        OnDeviceChange(hwnd, (UINT)wParam, (PDEV_BROADCAST_HDR)lParam);
         break;
 
     case WM_ERASEBKGND:
@@ -129,6 +183,52 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 }
 
 
+//-------------------------------------------------------------------
+// LoadSessionConfig
+//
+// Loads the capture session settings. A missing default file is not
+// an error; an explicitly requested or malformed one is.
+//-------------------------------------------------------------------
+
+BOOL LoadSessionConfig(PCWSTR cmdLine)
+{
+    const WCHAR* option = cmdLine ? wcsstr(cmdLine, L"/config ") : NULL;
+
+    if (option)
+    {
+        std::wstring path = option + wcslen(L"/config ");
+        path = path.substr(0, path.find(L" /"));
+        path.erase(std::remove(path.begin(), path.end(), L'"'), path.end());
+
+        if (!g_config.load(path))
+        {
+            ShowErrorMessage(L"Cannot load the session configuration.", E_INVALIDARG);
+            return FALSE;
+        }
+
+        return TRUE;
+    }
+
+    WCHAR modulePath[MAX_PATH] = {};
+    GetModuleFileName(NULL, modulePath, MAX_PATH);
+
+    std::wstring path = modulePath;
+    path = path.substr(0, path.find_last_of(L'\\') + 1) + L"MFCameraExample.ini";
+
+    if (GetFileAttributes(path.c_str()) == INVALID_FILE_ATTRIBUTES)
+    {
+        return TRUE;
+    }
+
+    if (!g_config.load(path))
+    {
+        ShowErrorMessage(L"Cannot load MFCameraExample.ini.", E_INVALIDARG);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 //-------------------------------------------------------------------
 // InitializeApplication
 //
@@ -162,11 +262,23 @@ void CleanUp()
         UnregisterDeviceNotification(g_hdevnotify);
     }
 
+    g_metricsServer.stop();
+
+    if (preview)
+    {
+        preview->setDeviceLostHandler(nullptr);
+    }
+
+    supervisor.reset();
+
     if (preview)
     {
         preview->closeDevice();
     }
 
+    // After the device: the motion stage may still be saving.
+    g_preEvent.reset();
+    g_recorder.reset();
     preview.reset();
 
     MFShutdown();
@@ -275,14 +387,77 @@ BOOL OnCreate(HWND hwnd, LPCREATESTRUCT)
     }
 
     // Create the object that manages video preview. 
-    preview = std::make_unique<Camera>(hwnd, hwnd, 1280, 720, 30);
-    preview->AddRef();
+    // Without the preview sink the camera converts into memory only.
+    HWND videoWindow = g_config.hasSink("preview") ? hwnd : NULL;
+
+    preview = std::make_unique<Camera>(videoWindow, hwnd, g_config);
     if (!preview->init())
     {
         ShowErrorMessage(L"CPreview::CreateInstance failed.", hr);
         return FALSE;
     }
 
+    // Recover from device loss without user interaction.
+    supervisor = std::make_unique<ReconnectSupervisor>(*preview);
+    if (!g_config.device.empty())
+    {
+        supervisor->setIdentity(g_config.device);
+    }
+    preview->setDeviceLostHandler([](const std::wstring& symbolicLink) {
+        supervisor->onDeviceLost(symbolicLink);
+    });
+
+    if (g_config.timecode)
+    {
+        std::shared_ptr<GlyphAtlas> atlas = GlyphAtlas::create(L"Consolas", TIMECODE_HEIGHT);
+        if (atlas)
+        {
+            auto timecode = std::make_shared<TextStage>(atlas, TIMECODE_POSITION, 0xFFFFFF);
+            timecode->setClock(true);
+            preview->addStage(timecode);
+        }
+    }
+
+    // Headless with square pixels, recordings get the corrected picture
+    // instead of the anamorphic samples. Y4M holds YUV only, so its
+    // segments keep the raw frames.
+    const bool squareFrames = !videoWindow && g_config.squarePixels;
+
+    if (g_config.hasSink("record"))
+    {
+        FrameSource& recorded = squareFrames && g_config.recordingFormat == RecordingContainer::Raw ?
+            preview->convertedFrames() : *preview;
+
+        g_recorder = std::make_unique<SegmentRecorder>(SegmentRecorder::configure(g_config));
+        if (!g_recorder->start(recorded))
+        {
+            ShowErrorMessage(L"Cannot start recording.", E_FAIL);
+        }
+    }
+
+    // Keep the last seconds of raw frames; saved from the menu or on motion.
+    if (g_config.preEventSeconds > 0)
+    {
+        const size_t maxFrames = size_t(g_config.preEventSeconds) * std::max(g_config.fps, 1u) * 2;
+
+        g_preEvent = std::make_unique<PreEventBuffer>(size_t(g_config.preEventMemoryMB) << 20,
+            std::chrono::seconds(g_config.preEventSeconds), maxFrames);
+        g_preEvent->start(squareFrames ? preview->convertedFrames() : *preview, g_config.streamCapacity);
+
+        if (g_config.preEventMotion)
+        {
+            preview->addStage(std::make_shared<MotionTrigger>([] {
+                SavePreEventBuffer();
+            }));
+        }
+    }
+
+    // Metrics are diagnostic only; capture runs without them.
+    if (g_config.metricsPort != 0 && !g_metricsServer.start(g_config.metricsPort))
+    {
+        ShowErrorMessage(L"Cannot start the metrics endpoint.", E_FAIL);
+    }
+
     return TRUE;
 }
 
@@ -331,6 +506,13 @@ void OnCommand(HWND hwnd, int id, HWND /*hwndCtl*/, UINT /*codeNotify*/)
         case ID_FILE_CHOOSEDEVICE:
             OnChooseDevice(hwnd, TRUE);
             break;
+
+        case ID_FILE_SAVEPREEVENT:
+            if (!SavePreEventBuffer())
+            {
+                MessageBeep(MB_ICONWARNING);
+            }
+            break;
     }
 }
 
@@ -396,8 +578,9 @@ void OnChooseDevice(HWND hwnd, BOOL bPrompt)
     }
 
     if (!bCancel && (param.count > 0)) {
-        // Give this source to the CPlayer object for preview.
-        if (!preview->setDevice(param.ppDevices[iDevice])) {
+        // Give this source to the CPlayer object for preview. The current
+        // device keeps running until the new one delivers its first frame.
+        if (!preview->switchDevice(param.ppDevices[iDevice])) {
             ShowErrorMessage(L"Cannot create a video capture device", hr);
         }
     }
@@ -419,21 +602,58 @@ done:
 }
 
 
+//-------------------------------------------------------------------
+//  SavePreEventBuffer
+//
+//  Saves the pre-event buffer to a time-stamped file in the configured
+//  directory. Returns FALSE if the buffer is off, empty or still busy
+//  with the previous save.
+//-------------------------------------------------------------------
+
+BOOL SavePreEventBuffer()
+{
+    if (!g_preEvent)
+    {
+        return FALSE;
+    }
+
+    SYSTEMTIME now = {};
+    GetLocalTime(&now);
+
+    WCHAR name[64];
+    StringCchPrintf(name, ARRAYSIZE(name), L"preevent-%04u%02u%02u-%02u%02u%02u.mfcr",
+        now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond);
+
+    std::wstring path = g_config.preEventDirectory;
+    if (!path.empty() && path.back() != L'\\')
+    {
+        path += L'\\';
+    }
+
+    return g_preEvent->trigger(path + name) ? TRUE : FALSE;
+}
+
+
 //-------------------------------------------------------------------
 //  OnDeviceChange
 //
-//  Handles WM_DEVICECHANGE messages.
+//  Handles WM_DEVICECHANGE messages. A lost device is handed to the
+//  reconnect supervisor; arrivals let it retry right away.
 //-------------------------------------------------------------------
 
-void OnDeviceChange(HWND hwnd, DEV_BROADCAST_HDR *pHdr)
+void OnDeviceChange(HWND /*hwnd*/, UINT event, DEV_BROADCAST_HDR *pHdr)
 {
-    if (!preview || !pHdr) {
+    if (!preview || !supervisor || !pHdr) {
         return;
     }
 
-    if (preview->isDeviceLost(pHdr)) {
-        preview->closeDevice();
-        MessageBox(hwnd, L"Lost the capture device.", WINDOW_NAME, MB_OK);
+    if (event == DBT_DEVICEARRIVAL) {
+        supervisor->onDeviceArrived();
+        return;
+    }
+
+    if (event == DBT_DEVICEREMOVECOMPLETE && preview->isDeviceLost(pHdr)) {
+        supervisor->onDeviceLost(preview->symbolicLink());
     }
 }
 